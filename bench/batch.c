@@ -0,0 +1,192 @@
+/**
+ * @file   batch.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief A benchmark of run_fsm_batch - a machine that reads HTTP
+ * request lines is run on a batch of generated records, most of them
+ * short and a few very long, with 1, 2, 4, ... threads up to the
+ * number of online processors, and the time each takes is printed
+ * along with how much faster it is than one thread.
+ *
+ * usage: batch [records] [max threads]
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fsm.h>
+#include <fsm_batch.h>
+
+#define DEFAULT_RECORDS 1000000
+
+extern transition segment_fsm[];
+
+transition segment_fsm[] =
+  {
+    {0, EXACT_STRING("/"),                                      1, -1, ACCEPT},
+    {1, SINGLE_CHARACTER("abcdefghijklmnopqrstuvwxyz0123456789-._~%"), 1, -1, ACCEPT},
+    {-1},
+  };
+
+transition request_fsm[] =
+  {
+    {0, EXACT_STRING("GET "),           1, -1},
+    {0, EXACT_STRING("HEAD "),          1, -1},
+    {0, EXACT_STRING("POST "),          1, -1},
+    {1, FSM(segment_fsm),               2, -1},
+    {2, FSM(segment_fsm),               2, -1},
+    {2, EXACT_STRING("?"),              3, -1},
+    {2, EXACT_STRING(" HTTP/1.0"),     -1, -1, ACCEPT},
+    {2, EXACT_STRING(" HTTP/1.1"),     -1, -1, ACCEPT},
+    {3, SINGLE_CHARACTER("abcdefghijklmnopqrstuvwxyz0123456789=&"), 3, -1},
+    {3, EXACT_STRING(" HTTP/1.0"),     -1, -1, ACCEPT},
+    {3, EXACT_STRING(" HTTP/1.1"),     -1, -1, ACCEPT},
+    {-1},
+  };
+
+/* each worker counts the bytes it accepted in its context */
+void *new_count(int worker, void *arg)
+{
+  return calloc(1, sizeof(long));
+}
+
+void *dup_count(void *context)
+{
+  long *copy = malloc(sizeof(long));
+  if(copy != NULL) {
+    *copy = *(long*)context;
+  }
+  return copy;
+}
+
+void count_record(void *context, int record, int result, void *arg)
+{
+  if(result > 0) {
+    *(long*)context += result;
+  }
+}
+
+char *make_record(size_t *length)
+{
+  /* one record in a hundred is a hundred times longer than the rest,
+     so the records are far from even */
+  static const char *methods[] = {"GET ", "HEAD ", "POST "};
+  static const char *chars = "abcdefghijklmnopqrstuvwxyz0123456789";
+  int segments = 1 + rand() % 6;
+  char *record, *p;
+  int i, j;
+
+  if(rand() % 100 == 0) {
+    segments *= 100;
+  }
+
+  record = p = malloc(segments * 12 + 32);
+  if(record == NULL) {
+    return NULL;
+  }
+
+  p += sprintf(p, "%s", methods[rand() % 3]);
+  for(i = 0; i < segments; i++) {
+    int len = 1 + rand() % 10;
+    *p++ = '/';
+    for(j = 0; j < len; j++) {
+      *p++ = chars[rand() % 36];
+    }
+  }
+  p += sprintf(p, " HTTP/1.%d", rand() % 2);
+
+  *length = p - record;
+  return record;
+}
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  int n = (argc > 1) ? atoi(argv[1]) : DEFAULT_RECORDS;
+  int max_threads = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  fsm_record *records;
+  int *results;
+  fsm *request;
+  fsm_batch_contexts contexts = {new_count, count_record, dup_count, free, NULL};
+  size_t bytes = 0;
+  double one = 0;
+  int threads, i;
+
+  if((n <= 0) ||
+     (max_threads <= 0)) {
+    printf("usage: %s [records] [max threads]\n", argv[0]);
+    return 1;
+  }
+
+  records = malloc(n * sizeof(fsm_record));
+  results = malloc(n * sizeof(int));
+  request = fsm_prepare(request_fsm);
+  if((records == NULL) ||
+     (results == NULL) ||
+     (request == NULL)) {
+    printf("Unable to allocate the batch.\n");
+    return 1;
+  }
+
+  srand(1);
+  for(i = 0; i < n; i++) {
+    records[i].data = make_record(&records[i].length);
+    if(records[i].data == NULL) {
+      printf("Unable to allocate the batch.\n");
+      return 1;
+    }
+    bytes += records[i].length;
+  }
+
+  printf("%d records, %lu bytes\n", n, (unsigned long)bytes);
+  printf("threads    seconds    records/s    speedup\n");
+
+  for(threads = 1; ; threads *= 2) {
+    double start, took;
+
+    if(threads > max_threads) {
+      threads = max_threads;
+    }
+
+    start = now();
+    if(run_prepared_fsm_batch(request, records, n, results, threads, &contexts) < 0) {
+      printf("Unable to run the batch.\n");
+      return 1;
+    }
+    took = now() - start;
+
+    if(threads == 1) {
+      one = took;
+    }
+    printf("%7d %10.3f %12.0f %10.2f\n", threads, took, n / took, one / took);
+
+    if(threads == max_threads) {
+      break;
+    }
+  }
+
+  /* every record was generated to be accepted */
+  for(i = 0; i < n; i++) {
+    if(results[i] != (int)records[i].length) {
+      printf("Record %d was not accepted: %.*s\n", i, (int)records[i].length, records[i].data);
+      return 1;
+    }
+    free(records[i].data);
+  }
+
+  free(records);
+  free(results);
+  fsm_free(request);
+  return 0;
+}
@@ -0,0 +1,570 @@
+/**
+ * @file   grammar.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief A benchmark of the machines of the examples. It is linked
+ * with an example built with FSM_BENCH (see grammar.h), makes a
+ * corpus of records for the example's grammar - access log URIs for
+ * the URI examples, dates in all three HTTP formats for the date
+ * example, torrent-like metainfo for the bencode example and lines
+ * of text for the whitespace example - or reads one from a file, one
+ * record per line, and runs the machine over every record of it. It
+ * prints how long each record took, the MB/s that makes, and how
+ * many times each record called malloc, calloc or realloc - which
+ * are wrapped by the linker so that they can be counted - and can
+ * add the same as a line of JSON to a file, so that runs can be
+ * compared from one commit to the next. The corpus is the same for
+ * the same seed on every machine. With -r, the warmup records are
+ * profiled, and the machine is reordered by the profile (see
+ * fsm_reorder) before it is timed.
+ *
+ * Whatever the examples print while they run goes to /dev/null.
+ *
+ * usage: grammar-<example> [-n records] [-f corpus] [-s seed]
+ *                          [-j results] [-l label] [-r]
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "grammar.h"
+
+/* the longest record a corpus is made with */
+#define MAX_RECORD 8192
+
+/* the records the machine is run on before it is timed */
+#define WARMUP_RECORDS 1000
+
+/* a corpus - every record is followed by a NUL, for the machines
+   that read C strings */
+typedef struct corpus_s corpus;
+struct corpus_s {
+  char *data;
+  size_t *offsets;
+  size_t *lengths;
+  size_t n;
+  size_t bytes;
+};
+
+/* how to make the records of the corpus for a grammar */
+typedef struct generator_s generator;
+struct generator_s {
+  const char *name;
+  size_t (*make_record)(char *out);
+  size_t default_records;
+};
+
+/* the calls to malloc, calloc and realloc made so far */
+static unsigned long allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  allocations++;
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  allocations++;
+  return __real_realloc(ptr, size);
+}
+
+/* the corpus is made with a generator of its own, rather than rand,
+   so that it is the same wherever the benchmark is run */
+static unsigned long long random_state;
+
+unsigned random_below(unsigned n)
+{
+  /* xorshift64* */
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return (unsigned)((random_state * 2685821657736338717ULL) >> 33) % n;
+}
+
+#define PICK(a) ((a)[random_below(sizeof(a) / sizeof((a)[0]))])
+
+char *put_word(char *p, const char *chars, int min, int max)
+{
+  /* a word of between min and max of chars */
+  int len = min + random_below(max - min + 1);
+  size_t nchars = strlen(chars);
+
+  while(len-- > 0) {
+    *p++ = chars[random_below(nchars)];
+  }
+  return p;
+}
+
+size_t make_uri(char *out)
+{
+  /* a URI as it would be found in an access log - mostly the paths
+     of requests, some with queries, and some whole URIs of referrers
+     and proxied requests, with the odd userinfo, port, IP address
+     and fragment */
+  static const char *schemes[] = {"http", "http", "https", "https", "https", "ftp"};
+  static const char *hosts[] = {"www.example.com", "cdn.example.net", "api.example.org",
+				"static.example.co.uk", "localhost", "192.168.1.20",
+				"10.0.0.7", "[2001:db8::1]", "[fe80::1ff:fe23:4567:890a]"};
+  static const char *dirs[] = {"static", "images", "api", "v1", "v2", "users", "products",
+			       "search", "js", "css", "blog", "2026", "10", "assets",
+			       "download", "wp-content", "uploads", "~adam"};
+  static const char *files[] = {"index.html", "app.min.js", "style.css", "logo.png",
+				"favicon.ico", "feed.xml", "robots.txt", "report%20final.pdf",
+				"search", "view.php", ""};
+  static const char *keys[] = {"q", "page", "id", "lang", "sort", "utm_source",
+			       "utm_campaign", "fields", "session", "ref"};
+  static const char *values = "abcdefghijklmnopqrstuvwxyz0123456789";
+  char *p = out;
+  int i, ndirs, nkeys;
+
+  if(random_below(10) < 3) {
+    p += sprintf(p, "%s://", PICK(schemes));
+    if(random_below(20) == 0) {
+      p = put_word(p, values, 3, 8);
+      *p++ = '@';
+    }
+    p += sprintf(p, "%s", PICK(hosts));
+    if(random_below(8) == 0) {
+      p += sprintf(p, ":%u", 1024 + random_below(64000));
+    }
+  }
+
+  ndirs = random_below(5);
+  for(i = 0; i < ndirs; i++) {
+    p += sprintf(p, "/%s", PICK(dirs));
+  }
+  if(random_below(4) == 0) {
+    /* an id in the path */
+    p += sprintf(p, "/%u", random_below(1000000));
+  }
+  p += sprintf(p, "/%s", PICK(files));
+
+  nkeys = (random_below(2) == 0) ? 0 : 1 + random_below(4);
+  for(i = 0; i < nkeys; i++) {
+    p += sprintf(p, "%c%s=", (i == 0) ? '?' : '&', PICK(keys));
+    p = put_word(p, values, 1, 12);
+    if(random_below(6) == 0) {
+      p += sprintf(p, "%s", (random_below(2) == 0) ? "%2F" : "+");
+      p = put_word(p, values, 1, 6);
+    }
+  }
+
+  if(random_below(25) == 0) {
+    *p++ = '#';
+    p = put_word(p, values, 1, 10);
+  }
+
+  *p = '\0';
+  return p - out;
+}
+
+size_t make_date(char *out)
+{
+  /* a date in one of the three formats HTTP allows */
+  static const char *wkdays[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+  static const char *weekdays[] = {"Sunday", "Monday", "Tuesday", "Wednesday",
+				   "Thursday", "Friday", "Saturday"};
+  static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+				 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  unsigned day = 1 + random_below(28);
+  unsigned year = 1970 + random_below(68);
+  unsigned hour = random_below(24), minute = random_below(60), second = random_below(60);
+
+  switch(random_below(3)) {
+  case 0:
+    return sprintf(out, "%s, %02u %s %04u %02u:%02u:%02u GMT",
+		   PICK(wkdays), day, PICK(months), year, hour, minute, second);
+
+  case 1:
+    return sprintf(out, "%s, %02u-%s-%02u %02u:%02u:%02u GMT",
+		   PICK(weekdays), day, PICK(months), year % 100, hour, minute, second);
+
+  default:
+    return sprintf(out, "%s %s %2u %02u:%02u:%02u %04u",
+		   PICK(wkdays), PICK(months), day, hour, minute, second, year);
+  }
+}
+
+char *put_string(char *p, const char *s, size_t length)
+{
+  /* a bencoded string */
+  p += sprintf(p, "%lu:", (unsigned long)length);
+  memcpy(p, s, length);
+  return p + length;
+}
+
+size_t make_bencode(char *out)
+{
+  /* the metainfo of a torrent - a dictionary of an announce URL, a
+     comment, a creation date and an info dictionary, with the name
+     and length of a file, or a list of files, and the SHA1s of its
+     pieces, which are binary */
+  static const char *trackers[] = {"http://tracker.example.com:6969/announce",
+				   "udp://tracker.example.org:1337/announce",
+				   "https://torrent.example.net/announce.php"};
+  static const char *names[] = {"ubuntu-26.04-desktop-amd64.iso", "linux-6.18.tar.xz",
+				"Big Buck Bunny", "dataset-2026-10", "podcast-episode-42.mp3"};
+  const char *tracker = PICK(trackers);
+  const char *name = PICK(names);
+  char *p = out;
+  char pieces[20 * 32];
+  unsigned npieces = 1 + random_below(32);
+  unsigned i;
+
+  p += sprintf(p, "d");
+  p = put_string(p, "announce", 8);
+  p = put_string(p, tracker, strlen(tracker));
+  if(random_below(2) == 0) {
+    const char *comment = "Made with the FSM bencode example";
+    p = put_string(p, "comment", 7);
+    p = put_string(p, comment, strlen(comment));
+  }
+  p = put_string(p, "creation date", 13);
+  p += sprintf(p, "i%ue", 1500000000 + random_below(300000000));
+
+  p = put_string(p, "info", 4);
+  p += sprintf(p, "d");
+  if(random_below(3) == 0) {
+    unsigned nfiles = 2 + random_below(6);
+
+    p = put_string(p, "files", 5);
+    p += sprintf(p, "l");
+    for(i = 0; i < nfiles; i++) {
+      char file[16];
+      int length = sprintf(file, "part%02u.bin", i);
+
+      p += sprintf(p, "d");
+      p = put_string(p, "length", 6);
+      p += sprintf(p, "i%ue", random_below(1 << 30));
+      p = put_string(p, "path", 4);
+      p += sprintf(p, "l");
+      p = put_string(p, file, length);
+      p += sprintf(p, "ee");
+    }
+    p += sprintf(p, "e");
+  } else {
+    p = put_string(p, "length", 6);
+    p += sprintf(p, "i%ue", random_below(1 << 30));
+  }
+  p = put_string(p, "name", 4);
+  p = put_string(p, name, strlen(name));
+  p = put_string(p, "piece length", 12);
+  p += sprintf(p, "i%ue", 16384u << random_below(6));
+  for(i = 0; i < npieces * 20; i++) {
+    pieces[i] = (char)random_below(256);
+  }
+  p = put_string(p, "pieces", 6);
+  p = put_string(p, pieces, npieces * 20);
+  p += sprintf(p, "ee");
+
+  *p = '\0';
+  return p - out;
+}
+
+size_t make_text(char *out)
+{
+  /* a line of text, with spaces, tabs and the odd carriage return
+     between its words */
+  static const char *words[] = {"the", "quick", "brown", "fox", "jumps", "over",
+				"lazy", "dog", "finite", "state", "machine", "table",
+				"transition", "a", "of", "to", "and", "2026,"};
+  static const char *spaces[] = {" ", " ", " ", " ", "  ", "\t", " \t", "\r\n"};
+  char *p = out;
+  int nwords = 4 + random_below(16);
+  int i;
+
+  for(i = 0; i < nwords; i++) {
+    if(i > 0) {
+      p += sprintf(p, "%s", PICK(spaces));
+    }
+    p += sprintf(p, "%s", PICK(words));
+  }
+
+  *p = '\0';
+  return p - out;
+}
+
+generator generators[] =
+  {
+    {"uri-rfc3986", make_uri,     1000000},
+    {"uri-rfc2396", make_uri,     1000000},
+    {"date",        make_date,    1000000},
+    {"bencode",     make_bencode,   50000},
+    {"whitespace",  make_text,     500000},
+    {NULL}
+  };
+
+int add_record(corpus *c, size_t *size, size_t *max, const char *record, size_t length)
+{
+  /* add a record to the end of a corpus */
+  if(c->bytes + c->n + length + 1 > *size) {
+    char *data;
+
+    while(c->bytes + c->n + length + 1 > *size) {
+      *size *= 2;
+    }
+    data = realloc(c->data, *size);
+    if(data == NULL) {
+      return -1;
+    }
+    c->data = data;
+  }
+  if(c->n == *max) {
+    size_t *offsets, *lengths;
+
+    *max *= 2;
+    offsets = realloc(c->offsets, *max * sizeof(size_t));
+    if(offsets != NULL) {
+      c->offsets = offsets;
+    }
+    lengths = realloc(c->lengths, *max * sizeof(size_t));
+    if(lengths != NULL) {
+      c->lengths = lengths;
+    }
+    if((offsets == NULL) ||
+       (lengths == NULL)) {
+      return -1;
+    }
+  }
+
+  c->offsets[c->n] = c->bytes + c->n;
+  c->lengths[c->n] = length;
+  memcpy(c->data + c->offsets[c->n], record, length);
+  c->data[c->offsets[c->n] + length] = '\0';
+  c->bytes += length;
+  c->n++;
+  return 0;
+}
+
+int make_corpus(corpus *c, generator *g, size_t n, const char *file)
+{
+  /* make a corpus of n records with a generator, or read one from a
+     file, a record to a line */
+  size_t size = 1 << 20, max = 1024;
+
+  c->n = 0;
+  c->bytes = 0;
+  c->data = malloc(size);
+  c->offsets = malloc(max * sizeof(size_t));
+  c->lengths = malloc(max * sizeof(size_t));
+  if((c->data == NULL) ||
+     (c->offsets == NULL) ||
+     (c->lengths == NULL)) {
+    return -1;
+  }
+
+  if(file != NULL) {
+    FILE *in = fopen(file, "r");
+    char line[MAX_RECORD];
+
+    if(in == NULL) {
+      return -1;
+    }
+    while(fgets(line, sizeof(line), in) != NULL) {
+      size_t length = strcspn(line, "\r\n");
+      if(add_record(c, &size, &max, line, length) < 0) {
+	fclose(in);
+	return -1;
+      }
+    }
+    fclose(in);
+    return 0;
+  }
+
+  while(c->n < n) {
+    char record[MAX_RECORD];
+    size_t length = g->make_record(record);
+
+    if(add_record(c, &size, &max, record, length) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int quiet(int saved)
+{
+  /* send what the example prints to /dev/null, returning where it
+     went before - or with that, put it back */
+  fflush(stdout);
+  if(saved < 0) {
+    int null = open("/dev/null", O_WRONLY);
+
+    saved = dup(1);
+    if(null >= 0) {
+      dup2(null, 1);
+      close(null);
+    }
+    return saved;
+  }
+
+  dup2(saved, 1);
+  close(saved);
+  return -1;
+}
+
+void json_string(FILE *out, const char *s)
+{
+  fputc('"', out);
+  for(; *s != '\0'; s++) {
+    if((*s == '"') || (*s == '\\')) {
+      fputc('\\', out);
+    }
+    if((unsigned char)*s >= ' ') {
+      fputc(*s, out);
+    }
+  }
+  fputc('"', out);
+}
+
+int main(int argc, char **argv)
+{
+  generator *g;
+  corpus c;
+  size_t n = 0, i, warmup, accepted = 0, whole = 0;
+  const char *file = NULL, *results = NULL, *label = "";
+  unsigned long long seed = 1;
+  unsigned long before;
+  double start, took, ns, mbs, allocs;
+  fsm_profile *profile = NULL;
+  int opt, saved, reorder = 0, reordered = 0;
+
+  while((opt = getopt(argc, argv, "n:f:s:j:l:r")) != -1) {
+    switch(opt) {
+    case 'n': n = strtoul(optarg, NULL, 10); break;
+    case 'f': file = optarg; break;
+    case 's': seed = strtoull(optarg, NULL, 10); break;
+    case 'j': results = optarg; break;
+    case 'l': label = optarg; break;
+    case 'r': reorder = 1; break;
+    default:
+      printf("usage: %s [-n records] [-f corpus] [-s seed] [-j results] [-l label] [-r]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  for(g = generators; g->name != NULL; g++) {
+    if(strcmp(g->name, bench_example.name) == 0) {
+      break;
+    }
+  }
+  if(g->name == NULL) {
+    printf("No corpus for the %s example.\n", bench_example.name);
+    return 1;
+  }
+
+  random_state = (seed == 0) ? 1 : seed;
+  if(make_corpus(&c, g, (n > 0) ? n : g->default_records, file) < 0) {
+    printf("Unable to make the corpus.\n");
+    return 1;
+  }
+  if(c.n == 0) {
+    printf("The corpus is empty.\n");
+    return 1;
+  }
+
+  if(bench_example.setup() < 0) {
+    printf("Unable to set up the %s example.\n", bench_example.name);
+    return 1;
+  }
+  if(reorder) {
+    profile = fsm_profile_new();
+    if((profile == NULL) ||
+       (bench_example.reorder == NULL)) {
+      printf("Unable to reorder the %s example.\n", bench_example.name);
+      return 1;
+    }
+    fsm_profile_start(profile);
+  }
+
+  saved = quiet(-1);
+
+  warmup = (c.n < WARMUP_RECORDS) ? c.n : WARMUP_RECORDS;
+  for(i = 0; i < warmup; i++) {
+    bench_example.parse(c.data + c.offsets[i], c.lengths[i]);
+  }
+
+  if(profile != NULL) {
+    /* the warmup records are the training data */
+    fsm_profile_stop();
+    reordered = bench_example.reorder(profile);
+    fsm_profile_free(profile);
+  }
+
+  before = allocations;
+  start = now();
+  for(i = 0; i < c.n; i++) {
+    int ret = bench_example.parse(c.data + c.offsets[i], c.lengths[i]);
+
+    if(ret >= 0) {
+      accepted++;
+    }
+    if((size_t)ret == c.lengths[i]) {
+      whole++;
+    }
+  }
+  took = now() - start;
+  allocs = (double)(allocations - before) / c.n;
+
+  quiet(saved);
+  bench_example.teardown();
+
+  ns = took * 1e9 / c.n;
+  mbs = c.bytes / took / 1e6;
+  printf("%s: %lu records, %lu bytes, %lu accepted, %lu of them whole\n", bench_example.name,
+	 (unsigned long)c.n, (unsigned long)c.bytes, (unsigned long)accepted, (unsigned long)whole);
+  if(reorder) {
+    printf("reordered %d groups of transitions\n", reordered);
+  }
+  printf("   seconds    ns/record         MB/s  allocs/record\n");
+  printf("%10.3f %12.1f %12.2f %14.2f\n", took, ns, mbs, allocs);
+
+  if(results != NULL) {
+    /* a line of JSON for each run, added to the end of the file */
+    FILE *out = fopen(results, "a");
+
+    if(out == NULL) {
+      printf("Unable to open %s.\n", results);
+      return 1;
+    }
+    fprintf(out, "{\"grammar\": ");
+    json_string(out, bench_example.name);
+    fprintf(out, ", \"label\": ");
+    json_string(out, label);
+    fprintf(out, ", \"records\": %lu, \"bytes\": %lu, \"accepted\": %lu, \"whole\": %lu, "
+	    "\"seconds\": %.6f, \"ns_per_record\": %.2f, \"mb_per_s\": %.3f, "
+	    "\"allocs_per_record\": %.3f}\n",
+	    (unsigned long)c.n, (unsigned long)c.bytes, (unsigned long)accepted,
+	    (unsigned long)whole, took, ns, mbs, allocs);
+    fclose(out);
+  }
+
+  free(c.data);
+  free(c.offsets);
+  free(c.lengths);
+  return 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file   grammar.h
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the header file for the grammar benchmarks. Built
+ * with FSM_BENCH, each example gives up its main, and instead
+ * defines bench_example - the name of its grammar, and how to get
+ * its machine ready and run it on one record, exactly as the example
+ * itself would. grammar.c does the rest: it makes a corpus of
+ * records for the grammar, times the machine over it, and reports
+ * the result.
+ *
+ *
+ */
+
+
+#ifndef BENCH_GRAMMAR_H
+#define BENCH_GRAMMAR_H
+
+#include <stddef.h>
+#include <fsm.h>
+
+typedef struct bench_grammar_s bench_grammar;
+struct bench_grammar_s {
+  /* the name of the example - which picks the corpus for it */
+  const char *name;
+
+  /* get the machine ready, returning -1 if that failed */
+  int (*setup)(void);
+
+  /* run the machine on a record of length bytes, which is followed
+     by a NUL, returning what the machine returned */
+  int (*parse)(char *record, size_t length);
+
+  /* free whatever setup made */
+  void (*teardown)(void);
+
+  /* reorder the machine by a profile of it, returning what
+     fsm_reorder returned - or NULL if the example has no prepared
+     machine to reorder */
+  int (*reorder)(fsm_profile *profile);
+};
+
+/* the grammar of the example the benchmark was built with */
+extern bench_grammar bench_example;
+
+#endif /* BENCH_GRAMMAR_H */
@@ -0,0 +1,189 @@
+/**
+ * @file   split.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief A benchmark of run_prepared_fsm_split and run_dfa_chunked -
+ * one large buffer of generated HTTP request lines, a line each, is
+ * split into records and run with the table engine, and run whole
+ * through the compiled machine of a table that reads line after
+ * line, with 1, 2, 4, ... threads up to the number of online
+ * processors. The time each takes is printed along with how much
+ * faster it is than one thread.
+ *
+ * usage: split [lines] [max threads]
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fsm.h>
+#include <fsm_dfa.h>
+#include <fsm_batch.h>
+
+#define DEFAULT_LINES 2000000
+
+extern transition segment_fsm[];
+extern transition request_fsm[];
+
+transition segment_fsm[] =
+  {
+    {0, EXACT_STRING("/"),                                      1, -1, ACCEPT},
+    {1, SINGLE_CHARACTER("abcdefghijklmnopqrstuvwxyz0123456789-._~%"), 1, -1, ACCEPT},
+    {-1},
+  };
+
+transition request_fsm[] =
+  {
+    {0, EXACT_STRING("GET "),           1, -1},
+    {0, EXACT_STRING("HEAD "),          1, -1},
+    {0, EXACT_STRING("POST "),          1, -1},
+    {1, FSM(segment_fsm),               2, -1},
+    {2, FSM(segment_fsm),               2, -1},
+    {2, EXACT_STRING("?"),              3, -1},
+    {2, EXACT_STRING(" HTTP/1.0"),     -1, -1, ACCEPT},
+    {2, EXACT_STRING(" HTTP/1.1"),     -1, -1, ACCEPT},
+    {3, SINGLE_CHARACTER("abcdefghijklmnopqrstuvwxyz0123456789=&"), 3, -1},
+    {3, EXACT_STRING(" HTTP/1.0"),     -1, -1, ACCEPT},
+    {3, EXACT_STRING(" HTTP/1.1"),     -1, -1, ACCEPT},
+    {-1},
+  };
+
+/* a whole log of request lines, each ended by a newline */
+transition log_fsm[] =
+  {
+    {0, FSM(request_fsm),               1, -1},
+    {1, EXACT_STRING("\n"),             0, -1, ACCEPT},
+    {-1},
+  };
+
+char *make_line(char *p)
+{
+  static const char *methods[] = {"GET ", "HEAD ", "POST "};
+  static const char *chars = "abcdefghijklmnopqrstuvwxyz0123456789";
+  int segments = 1 + rand() % 6;
+  int i, j;
+
+  p += sprintf(p, "%s", methods[rand() % 3]);
+  for(i = 0; i < segments; i++) {
+    int len = 1 + rand() % 10;
+    *p++ = '/';
+    for(j = 0; j < len; j++) {
+      *p++ = chars[rand() % 36];
+    }
+  }
+  if(rand() % 4 == 0) {
+    p += sprintf(p, "?q=%d", rand() % 1000);
+  }
+  p += sprintf(p, " HTTP/1.%d\n", rand() % 2);
+
+  return p;
+}
+
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  int lines = (argc > 1) ? atoi(argv[1]) : DEFAULT_LINES;
+  int max_threads = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  char *data, *p;
+  size_t length;
+  fsm *request;
+  fsm_dfa *log;
+  double one_split = 0, one_dfa = 0;
+  int threads, i;
+
+  if((lines <= 0) ||
+     (max_threads <= 0)) {
+    printf("usage: %s [lines] [max threads]\n", argv[0]);
+    return 1;
+  }
+
+  /* no line is longer than 128 bytes */
+  data = malloc((size_t)lines * 128 + 1);
+  request = fsm_prepare(request_fsm);
+  log = fsm_compile_dfa(log_fsm);
+  if((data == NULL) ||
+     (request == NULL) ||
+     (log == NULL)) {
+    printf("Unable to set up the benchmark.\n");
+    return 1;
+  }
+
+  srand(1);
+  p = data;
+  for(i = 0; i < lines; i++) {
+    p = make_line(p);
+  }
+  *p = '\0';
+  length = p - data;
+
+  printf("%d lines, %lu bytes\n", lines, (unsigned long)length);
+  printf("log machine: %d states (%d before minimizing)\n", log->nstates, log->built_states);
+  printf("threads   split s   split MB/s  speedup     dfa s     dfa MB/s  speedup\n");
+
+  for(threads = 1; ; threads *= 2) {
+    fsm_record *records;
+    int *results;
+    double start, split_took, dfa_took;
+    long long ret;
+    char *in = data;
+    int n;
+
+    if(threads > max_threads) {
+      threads = max_threads;
+    }
+
+    start = now();
+    n = run_prepared_fsm_split(request, data, length, '\n', &records, &results, threads, NULL);
+    split_took = now() - start;
+    if(n != lines) {
+      printf("Unable to split the data.\n");
+      return 1;
+    }
+
+    /* every line was generated to be accepted */
+    for(i = 0; i < n; i++) {
+      if(results[i] != (int)records[i].length) {
+	printf("Line %d was not accepted: %.*s\n", i, (int)records[i].length, records[i].data);
+	return 1;
+      }
+    }
+    free(records);
+    free(results);
+
+    start = now();
+    ret = run_dfa_chunked(log, &in, length, threads);
+    dfa_took = now() - start;
+    if(ret != (long long)length) {
+      printf("The log was not accepted (%lld of %lu bytes).\n", ret, (unsigned long)length);
+      return 1;
+    }
+
+    if(threads == 1) {
+      one_split = split_took;
+      one_dfa = dfa_took;
+    }
+    printf("%7d %9.3f %12.1f %8.2f %9.3f %12.1f %8.2f\n", threads,
+	   split_took, length / split_took / 1e6, one_split / split_took,
+	   dfa_took, length / dfa_took / 1e6, one_dfa / dfa_took);
+
+    if(threads == max_threads) {
+      break;
+    }
+  }
+
+  free(data);
+  fsm_free(request);
+  fsm_dfa_free(log);
+  return 0;
+}
@@ -27,7 +27,8 @@ int xsp = 0;
 /* Private functions */
 void make_negative(char **data, int data_len, void *global_context, void *local_context);
 void read_digit(char **data, int data_len, void *global_context, void *local_context);
-int read_string(char **data, void *global_context, void *local_context);
+int read_string(char **data, char *end, void *global_context, void *local_context);
+void print_string(char **data, int data_len, void *global_context, void *local_context);
 void read_element(char **data, int data_len, void *global_context, void *local_context);
 void read_key(char **data, int data_len, void *global_context, void *local_context);
 void read_value(char **data, int data_len, void *global_context, void *local_context);
@@ -80,12 +81,9 @@ transition integer_fsm[] =
 
 transition string_fsm[] =
   {
-    {0, EXACT_STRING("0"),               1, -1                     },
-    {0, SINGLE_CHARACTER("123456789"),   2, -1, NORMAL, read_digit },
-    {1, EXACT_STRING(":"),               3, -1                     },
-    {2, SINGLE_CHARACTER("0123456789"),  2, -1, NORMAL, read_digit },
-    {2, EXACT_STRING(":"),               3, -1                     },
-    {3, FUNCTION(read_string),          -1, -1, ACCEPT             },
+    /* a string can only start with a digit of its length, and saying
+       so lets a prepared machine skip this table for anything else */
+    {0, FUNCTION_N(read_string),        -1, -1, ACCEPT, print_string, NULL, "read a string", 0, "0123456789"},
     {-1},
   };
 
@@ -145,24 +143,56 @@ void read_digit(char **data, int data_len, void *global_context, void *local_con
   bc->int_value += **data - '0';
 }
 
-int read_string(char **data, void *global_context, void *local_context)
+int read_string(char **data, char *end, void *global_context, void *local_context)
 {
-  /* we used read_digit to build up the ints describing the length of
-     the string, all we need to do now is go ahead and read that many
-     bytes */
-  int strlen;
-  struct bencode_context *bc = (struct bencode_context*)global_context;
+  /* a string is its length, a colon, and then that many bytes - which
+     may include NULs. the length is read here rather than by
+     transitions that build it up in the context, so that nothing has
+     to be written to the context until the string is printed, and
+     the machine can defer its calls */
+  char *p = *data;
+  int strlen = 0;
+
+  if((end != NULL) && (p == end)) {
+    return FSM_MORE;
+  }
+  if((*p < '0') || (*p > '9')) {
+    return -1;
+  }
+  if(*p == '0') {
+    /* no leading zeros */
+    p++;
+  } else {
+    while(((end == NULL) || (p < end)) &&
+	  (*p >= '0') && (*p <= '9')) {
+      strlen = strlen * 10 + (*p - '0');
+      p++;
+    }
+  }
 
-  strlen = bc->int_value;
+  if((end != NULL) && (p == end)) {
+    return FSM_MORE;
+  }
+  if(*p != ':') {
+    return -1;
+  }
+  p++;
 
-  printxsp();
-  printf("%.*s", strlen, *data);
-	 
-  /* cleanup the used context variables */
-  bc->int_is_neg = 0;
-  bc->int_value = 0;
+  if((end != NULL) && (strlen > end - p)) {
+    /* the rest of the string has not arrived (yet) */
+    return FSM_MORE;
+  }
 
-  return strlen;
+  return (p - *data) + strlen;
+}
+
+void print_string(char **data, int data_len, void *global_context, void *local_context)
+{
+  /* the string starts after the colon that ends its length */
+  char *colon = memchr(*data, ':', data_len);
+
+  printxsp();
+  fwrite(colon + 1, 1, data_len - (colon + 1 - *data), stdout);
 }
 
 void read_element(char **data, int data_len, void *global_context, void *local_context)
@@ -234,29 +264,129 @@ void printxsp()
   for(i = 0; i < xsp; i++) printf(" ");
 }
 
+#ifdef FSM2C
+#include <fsm2c.h>
+
+/* the names fsm2c writes the machine's tables and functions with */
+fsm2c_symbol bencode_symbols[] =
+  {
+    FSM2C_SYMBOL(bencode_fsm),
+    FSM2C_SYMBOL(integer_fsm),
+    FSM2C_SYMBOL(string_fsm),
+    FSM2C_SYMBOL(list_fsm),
+    FSM2C_SYMBOL(dict_fsm),
+    FSM2C_SYMBOL(end_dict),
+    FSM2C_SYMBOL(end_list),
+    FSM2C_SYMBOL(integer_finish),
+    FSM2C_SYMBOL(integer_start),
+    FSM2C_SYMBOL(make_negative),
+    FSM2C_SYMBOL(print_string),
+    FSM2C_SYMBOL(read_digit),
+    FSM2C_SYMBOL(read_element),
+    FSM2C_SYMBOL(read_key),
+    FSM2C_SYMBOL(read_string),
+    FSM2C_SYMBOL(read_value),
+    FSM2C_SYMBOL(start_dict),
+    FSM2C_SYMBOL(start_list),
+    {NULL}
+  };
+
 int main(int argc, char **argv)
 {
-  char *str;
+  /* built with FSM2C, this example writes its machine out as C code
+     instead of running it - which is how bencode-fsm.c is made for the
+     FSM_GENERATED build */
+  return (fsm2c(stdout, bencode_fsm, "bencode_parse", bencode_symbols) < 0) ? 1 : 0;
+}
+
+#elif defined(FSM_BENCH)
+#include <bench/grammar.h>
+
+/* built with FSM_BENCH, the example runs its machine for the grammar
+   benchmark (see bench/grammar.c), the same way main does */
+static fsm *bench_parser;
+
+static int bench_setup(void)
+{
+  bench_parser = fsm_prepare(bencode_fsm);
+  if(bench_parser == NULL) {
+    return -1;
+  }
+  fsm_defer_calls(bench_parser, FSM_CALLS_DEFERRED);
+  return 0;
+}
+
+static int bench_parse(char *record, size_t length)
+{
+  struct bencode_context context = {0};
+  void *ctx = &context;
+
+  xsp = 0;
+  return run_prepared_fsm_n(bench_parser, &record, length, &ctx, NULL, NULL);
+}
+
+static void bench_teardown(void)
+{
+  fsm_free(bench_parser);
+}
+
+static int bench_reorder(fsm_profile *profile)
+{
+  return fsm_reorder(bench_parser, profile);
+}
+
+bench_grammar bench_example = {"bencode", bench_setup, bench_parse, bench_teardown, bench_reorder};
+
+#else
+
+#ifdef FSM_GENERATED
+/* built with FSM_GENERATED, the example runs the code fsm2c wrote for
+   its machine, rather than the tables themselves */
+#include "bencode-fsm.c"
+#endif
+
+int main(int argc, char **argv)
+{
+  char buf[MAX_INPUT];
+  char *str = buf;
+  size_t len;
   int ret;
+#ifndef FSM_GENERATED
+  fsm *bencode;
+#endif
   struct bencode_context context = {0};
+  void *ctx = &context;
 
-  /* read a string from the user */
-  str = calloc(MAX_INPUT+1, 1);
-  if(str == NULL) {
-    printf("Unable to allocate string storage space.\n");
+  /* read the data from the user - bencoded strings can hold any
+     bytes, NULs included, so the data is run as it was read rather
+     than as a C string */
+  printf("Please enter a string containing whitespace:\n");
+  len = fread(buf, 1, MAX_INPUT, stdin);
+
+  printf("Processing %d byte string...\n", (int)len);
+#ifdef FSM_GENERATED
+  /* the generated code makes its calls as it goes */
+  ret = bencode_parse(&str, buf + len, &ctx, NULL, NULL, NULL);
+#else
+  /* process string through FSM - nothing is printed until the whole
+     value has been read, so a value that turns out to be bad prints
+     nothing at all */
+  bencode = fsm_prepare(bencode_fsm);
+  if(bencode == NULL) {
+    printf("Unable to prepare FSM\n");
     return 1;
   }
-  printf("Please enter a string containing whitespace:\n");
-  fread(str, 1, MAX_INPUT, stdin);
-
-  printf("Processing %d byte string...\n", (int)strlen(str));
-  /* process string through FSM */
-  ret = run_fsm(bencode_fsm, &str, (void*)&context, NULL, NULL);
+  fsm_defer_calls(bencode, FSM_CALLS_DEFERRED);
+  ret = run_prepared_fsm_n(bencode, &str, len, &ctx, NULL, NULL);
+  fsm_free(bencode);
+#endif
   if(ret < 0) {
-    printf("Unable to execute FSM on string: %s\n", str);
+    printf("Unable to execute FSM on string: %.*s\n", (int)(buf + len - str), str);
   } else {
     printf("\nFSM Done - processed %d characters.\n", ret);
   }
 
   return 0;
 }
+
+#endif /* FSM2C */
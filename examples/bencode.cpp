@@ -0,0 +1,223 @@
+/**
+ * @file   bencode.cpp
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief The bencode example again, written with the C++ front end -
+ * the same machine as bencode.c, but built and checked by the
+ * compiler, with its functions and transfns as lambdas that the
+ * compiler can inline. Lists and dictionaries hold each other, so
+ * each table is named through a type, and run as a rule.
+ *
+ *
+ */
+
+
+#include <cstdio>
+#include <cstring>
+#include <fsm.hpp>
+
+#define MAX_INPUT 2048
+
+using fsm_cxx::row;
+using fsm_cxx::exact;
+using fsm_cxx::one_of;
+using fsm_cxx::func;
+using fsm_cxx::rule;
+
+/* a context for reading the bencoded data - the integer being read,
+   and the number of spaces to print before a value, to make the
+   output of the program nice and pretty */
+struct bencode_context {
+  int int_is_neg;
+  int int_value;
+  int xsp;
+};
+
+static void printxsp(const bencode_context &bc)
+{
+  std::printf("%*s", bc.xsp, "");
+}
+
+static constexpr auto make_negative = [](const char *, int, bencode_context &bc) {
+  bc.int_is_neg = 1;
+};
+
+static constexpr auto read_digit = [](const char *data, int, bencode_context &bc) {
+  bc.int_value = bc.int_value * 10 + (*data - '0');
+};
+
+static constexpr auto integer_finish = [](const char *, int, bencode_context &bc) {
+  printxsp(bc);
+  std::printf("%d", bc.int_value * (bc.int_is_neg == 1 ? -1 : 1));
+
+  /* cleanup */
+  bc.int_is_neg = 0;
+  bc.int_value = 0;
+};
+
+static constexpr auto read_string = [](const char *data, const char *end, bencode_context &) {
+  /* a string is its length, a colon, and then that many bytes - which
+     may include NULs */
+  const char *p = data;
+  int length = 0;
+
+  if(((end != nullptr) && (p == end)) ||
+     (*p < '0') || (*p > '9')) {
+    return -1;
+  }
+  if(*p == '0') {
+    /* no leading zeros */
+    p++;
+  } else {
+    while(((end == nullptr) || (p < end)) &&
+	  (*p >= '0') && (*p <= '9')) {
+      length = length * 10 + (*p - '0');
+      p++;
+    }
+  }
+
+  if(((end != nullptr) && (p == end)) ||
+     (*p != ':')) {
+    return -1;
+  }
+  p++;
+
+  if((end != nullptr) && (length > end - p)) {
+    return -1;
+  }
+
+  return (int)(p - data) + length;
+};
+
+static constexpr auto print_string = [](const char *data, int nbytes, bencode_context &bc) {
+  /* the string starts after the colon that ends its length */
+  const char *colon = (const char *)std::memchr(data, ':', nbytes);
+
+  printxsp(bc);
+  std::fwrite(colon + 1, 1, nbytes - (colon + 1 - data), stdout);
+};
+
+static constexpr auto newline = [](const char *, int, bencode_context &) {
+  std::printf("\n");
+};
+
+static constexpr auto read_key = [](const char *, int, bencode_context &bc) {
+  std::printf(" => \n");
+  bc.xsp++;
+};
+
+static constexpr auto read_value = [](const char *, int, bencode_context &bc) {
+  std::printf("\n");
+  bc.xsp--;
+};
+
+static constexpr auto start_dict = [](const char *, int, bencode_context &bc) {
+  printxsp(bc);
+  std::printf("{\n");
+  bc.xsp++;
+};
+
+static constexpr auto end_dict = [](const char *, int, bencode_context &bc) {
+  bc.xsp--;
+  printxsp(bc);
+  std::printf("}\n");
+};
+
+static constexpr auto start_list = [](const char *, int, bencode_context &bc) {
+  printxsp(bc);
+  std::printf("[\n");
+  bc.xsp++;
+};
+
+static constexpr auto end_list = [](const char *, int, bencode_context &bc) {
+  bc.xsp--;
+  printxsp(bc);
+  std::printf("]\n");
+};
+
+struct integer_g {
+  static constexpr auto table = fsm_cxx::table(
+    row(0, exact("i"),               1, -1),
+    row(1, exact("-"),               2, -1, NORMAL, make_negative),
+    row(1, exact("0"),               3, -1),
+    row(1, one_of("123456789"),      4, -1, NORMAL, read_digit),
+    row(2, exact("0"),               3, -1),
+    row(2, one_of("123456789"),      4, -1, NORMAL, read_digit),
+    row(3, exact("e"),              -1, -1, ACCEPT, integer_finish),
+    row(4, one_of("0123456789"),     4, -1, NORMAL, read_digit),
+    row(4, exact("e"),              -1, -1, ACCEPT, integer_finish));
+};
+
+struct string_g {
+  static constexpr auto table = fsm_cxx::table(
+    row(0, func(read_string),       -1, -1, ACCEPT, print_string));
+};
+
+struct dict_g;
+
+struct list_g {
+  static constexpr auto table = fsm_cxx::table(
+    row(0, exact("l"),               1, -1, NORMAL, start_list),
+    row(1, exact("e"),              -1, -1, ACCEPT, end_list),
+
+    /* read an element of the list */
+    row(1, rule<integer_g>(),        1, -1, NORMAL, newline),
+    row(1, rule<string_g>(),         1, -1, NORMAL, newline),
+    row(1, rule<list_g>(),           1, -1, NORMAL, newline),
+    row(1, rule<dict_g>(),           1, -1, NORMAL, newline));
+};
+
+struct dict_g {
+  static constexpr auto table = fsm_cxx::table(
+    row(0, exact("d"),               1, -1, NORMAL, start_dict),
+    row(1, exact("e"),              -1, -1, ACCEPT, end_dict),
+
+    /* read a key */
+    row(1, rule<string_g>(),         2, -1, NORMAL, read_key),
+
+    /* read a value */
+    row(2, rule<integer_g>(),        1, -1, NORMAL, read_value),
+    row(2, rule<string_g>(),         1, -1, NORMAL, read_value),
+    row(2, rule<list_g>(),           1, -1, NORMAL, read_value),
+    row(2, rule<dict_g>(),           1, -1, NORMAL, read_value));
+};
+
+/* read a single bencoded value */
+static constexpr auto bencode_fsm = fsm_cxx::table(
+  row(0, rule<integer_g>(),         -1, -1, ACCEPT),
+  row(0, rule<string_g>(),          -1, -1, ACCEPT),
+  row(0, rule<list_g>(),            -1, -1, ACCEPT),
+  row(0, rule<dict_g>(),            -1, -1, ACCEPT));
+
+/* a mistake in any of the tables stops the example compiling */
+static_assert(integer_g::table.valid(), "bad integer table");
+static_assert(string_g::table.valid(), "bad string table");
+static_assert(list_g::table.valid(), "bad list table");
+static_assert(dict_g::table.valid(), "bad dictionary table");
+static_assert(bencode_fsm.valid(), "bad bencode table");
+
+int main(int argc, char **argv)
+{
+  char buf[MAX_INPUT];
+  const char *str = buf;
+  size_t len;
+  int ret;
+  bencode_context context = {0, 0, 0};
+
+  /* read the data from the user - bencoded strings can hold any
+     bytes, NULs included, so the data is run as it was read rather
+     than as a C string */
+  std::printf("Please enter a string containing whitespace:\n");
+  len = std::fread(buf, 1, MAX_INPUT, stdin);
+
+  std::printf("Processing %d byte string...\n", (int)len);
+  ret = fsm_cxx::run(bencode_fsm, str, buf + len, context);
+  if(ret < 0) {
+    std::printf("Unable to execute FSM on string: %.*s\n", (int)(buf + len - str), str);
+  } else {
+    std::printf("\nFSM Done - processed %d characters.\n", ret);
+  }
+
+  return 0;
+}
@@ -16,6 +16,7 @@
 #include <string.h>
 #include <time.h>
 #include <fsm.h>
+#include <fsm_trace.h>
 
 #define MAX_INPUT 2048
 
@@ -35,14 +36,24 @@
        time         = 2DIGIT ":" 2DIGIT ":" 2DIGIT
 	       ; 00:00:00 - 23:59:59
        wkday        = "Mon" | "Tue" | "Wed"
-                    | "Thu" | "Fri" | "Sat" | "Sun"
+		    | "Thu" | "Fri" | "Sat" | "Sun"
        weekday      = "Monday" | "Tuesday" | "Wednesday"
-                    | "Thursday" | "Friday" | "Saturday" | "Sunday"
+		    | "Thursday" | "Friday" | "Saturday" | "Sunday"
        month        = "Jan" | "Feb" | "Mar" | "Apr"
-                    | "May" | "Jun" | "Jul" | "Aug"
-                    | "Sep" | "Oct" | "Nov" | "Dec"
+		    | "May" | "Jun" | "Jul" | "Aug"
+		    | "Sep" | "Oct" | "Nov" | "Dec"
 */
 
+/* the context of the date parser - the date being parsed, and the
+   journal the callbacks save their changes to it in, so that an
+   alternative that fails part way through (an rfc850 date that
+   turns out to be an asctime date, say) does not leave anything
+   behind */
+struct date_context {
+  struct tm tm;
+  fsm_journal *journal;
+};
+
 struct setmonth_args {
   int month_num;
 };
@@ -50,8 +61,8 @@ struct setmonth_args {
 void set_month(char **data, int data_used, void *global_context, void *local_context) 
 {
   struct setmonth_args *sma = (struct setmonth_args*)local_context;
-  struct tm *tmp = (struct tm*)global_context;
-  tmp->tm_mon = sma->month_num;
+  struct date_context *dc = (struct date_context*)global_context;
+  FSM_JOURNAL_SET(dc->journal, dc->tm.tm_mon, sma->month_num);
 }
 
 struct setweekday_args
@@ -62,8 +73,8 @@ struct setweekday_args
 void set_weekday(char **date, int date_len, void *global_context, void *local_context)
 {
   struct setweekday_args *swa = (struct setweekday_args*)local_context;
-  struct tm *tmp = (struct tm*)global_context;
-  tmp->tm_wday = swa->weekday;
+  struct date_context *dc = (struct date_context*)global_context;
+  FSM_JOURNAL_SET(dc->journal, dc->tm.tm_wday, swa->weekday);
 }
 
 struct settime_args
@@ -81,32 +92,32 @@ struct settime_args
 void set_time(char **date, int time_len, void *global_context, void *local_context)
 {
   struct settime_args *sta = (struct settime_args*)local_context;
-  struct tm *tmp = (struct tm*)global_context;
+  struct date_context *dc = (struct date_context*)global_context;
   int new_digit = (int)(*date[0] - '0');
 
   switch(sta->time_component) {
   case HOURS_HIGH: {
-    tmp->tm_hour = new_digit * 10;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_hour, new_digit * 10);
   } break;
 
   case HOURS_LOW: {
-    tmp->tm_hour += new_digit;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_hour, dc->tm.tm_hour + new_digit);
   } break;
 
   case MINUTES_HIGH: {
-    tmp->tm_min = new_digit * 10;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_min, new_digit * 10);
   } break;
 
   case MINUTES_LOW: {
-    tmp->tm_min += new_digit;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_min, dc->tm.tm_min + new_digit);
   } break;
 
   case SECONDS_HIGH: {
-    tmp->tm_sec = new_digit * 10;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_sec, new_digit * 10);
   } break;
 
   case SECONDS_LOW: {
-    tmp->tm_sec += new_digit;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_sec, dc->tm.tm_sec + new_digit);
   } break;
 
   };
@@ -149,47 +160,54 @@ void set_year(char **date, int year_len, void *global_context, void *local_conte
   
 }
 
+/* the tables for reading years live as long as the program does, so
+   that a trace or profile of them can still be read once they have
+   been run */
+static transition year4_fsm[] = 
+  {
+    {0, SINGLE_CHARACTER("0123456789"),  1, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_1} },
+    {1, SINGLE_CHARACTER("0123456789"),  2, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_2} },
+    {2, SINGLE_CHARACTER("0123456789"),  3, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_3} },
+    {3, SINGLE_CHARACTER("0123456789"), -1, -1,  ACCEPT, set_year, (void*)&(struct setyear_args){YEAR_4} },
+    {-1}
+  };
+
+static transition year2_fsm[] = 
+  {
+    {0, SINGLE_CHARACTER("0123456789"),  1, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_3} },
+    {1, SINGLE_CHARACTER("0123456789"), -1, -1,  ACCEPT, set_year, (void*)&(struct setyear_args){YEAR_4} },
+    {-1}
+  };
+
 int parse_year4(char **data, void *global_context, void *local_context)
 {
-  struct tm *tmp = (struct tm*)global_context;
-  transition year_fsm[] = 
-    {
-      {0, SINGLE_CHARACTER("0123456789"),  1, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_1} },
-      {1, SINGLE_CHARACTER("0123456789"),  2, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_2} },
-      {2, SINGLE_CHARACTER("0123456789"),  3, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_3} },
-      {3, SINGLE_CHARACTER("0123456789"), -1, -1,  ACCEPT, set_year, (void*)&(struct setyear_args){YEAR_4} },
-      {-1}
-    };
+  struct date_context *dc = (struct date_context*)global_context;
   int year = 0;
+  void *year_context = &year;
   int ret;
 
-  ret = run_fsm(year_fsm, data, (void*)&year, NULL, NULL);
+  ret = run_fsm(year4_fsm, data, &year_context, NULL, NULL);
   if(ret < 0) {
     return -1;
   }
 
-  tmp->tm_year = year - 1900;
+  FSM_JOURNAL_SET(dc->journal, dc->tm.tm_year, year - 1900);
   return ret;
 }
 
 int parse_year2(char **data, void *global_context, void *local_context)
 {
-  struct tm *tmp = (struct tm*)global_context;
-  transition year_fsm[] = 
-    {
-      {0, SINGLE_CHARACTER("0123456789"),  1, -1,  NORMAL, set_year, (void*)&(struct setyear_args){YEAR_3} },
-      {1, SINGLE_CHARACTER("0123456789"), -1, -1,  ACCEPT, set_year, (void*)&(struct setyear_args){YEAR_4} },
-      {-1}
-    };
+  struct date_context *dc = (struct date_context*)global_context;
   int year = 0;
+  void *year_context = &year;
   int ret;
 
-  ret = run_fsm(year_fsm, data, (void*)&year, NULL, NULL);
+  ret = run_fsm(year2_fsm, data, &year_context, NULL, NULL);
   if(ret < 0) {
     return -1;
   }
 
-  tmp->tm_year = year;
+  FSM_JOURNAL_SET(dc->journal, dc->tm.tm_year, year);
   return ret;
 }
 
@@ -203,16 +221,16 @@ struct setdom_args {
 void set_dom(char **date, int dom_len, void *global_context, void *local_context)
 {
   struct setdom_args *sda = (struct setdom_args*)local_context;
-  struct tm *tmp = (struct tm*)global_context;
+  struct date_context *dc = (struct date_context*)global_context;
   int new_digit = (int)(*date[0] - '0');
   
   switch(sda->day_component) {  
   case DAY_HIGH: {
-    tmp->tm_mday = 10 * new_digit;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_mday, 10 * new_digit);
   } break;
 
   case DAY_LOW: {
-    tmp->tm_mday += new_digit;
+    FSM_JOURNAL_SET(dc->journal, dc->tm.tm_mday, dc->tm.tm_mday + new_digit);
   } break;
   };
 }
@@ -334,7 +352,7 @@ transition rfc1123_date_fsm[] =
 
     /* date1 */
     {2, SINGLE_CHARACTER("0123456789"),   3, -1, NORMAL, set_dom, (void*)&(struct setdom_args){DAY_HIGH} },
-    {3, SINGLE_CHARACTER("0123456789"),   4, -1, NORMAL, set_dom, (void*)&(struct setdom_args){DAY_HIGH} },
+    {3, SINGLE_CHARACTER("0123456789"),   4, -1, NORMAL, set_dom, (void*)&(struct setdom_args){DAY_LOW}  },
     {4, EXACT_STRING(" "),                5, -1                                                          },
     {5, FSM(month_fsm),                   6, -1                                                          },
     {6, EXACT_STRING(" "),                7, -1                                                          },
@@ -369,11 +387,112 @@ transition http_date_fsm[] =
   };
 
 
+#ifdef FSM2C
+#include <fsm2c.h>
+
+/* the names fsm2c writes the machine's tables and functions with */
+fsm2c_symbol date_symbols[] =
+  {
+    FSM2C_SYMBOL(http_date_fsm),
+    FSM2C_SYMBOL(time_fsm),
+    FSM2C_SYMBOL(wkday_fsm),
+    FSM2C_SYMBOL(month_fsm),
+    FSM2C_SYMBOL(asctime_date_fsm),
+    FSM2C_SYMBOL(rfc850_date_fsm),
+    FSM2C_SYMBOL(rfc1123_date_fsm),
+    FSM2C_SYMBOL(parse_year2),
+    FSM2C_SYMBOL(parse_year4),
+    FSM2C_SYMBOL(set_dom),
+    FSM2C_SYMBOL(set_month),
+    FSM2C_SYMBOL(set_time),
+    FSM2C_SYMBOL(set_weekday),
+    FSM2C_SYMBOL(set_year),
+    {NULL}
+  };
+
+int main(int argc, char **argv)
+{
+  /* built with FSM2C, this example writes its machine out as C code
+     instead of running it - which is how date-fsm.c is made for the
+     FSM_GENERATED build */
+  return (fsm2c(stdout, http_date_fsm, "http_date_parse", date_symbols) < 0) ? 1 : 0;
+}
+
+#elif defined(FSM_BENCH)
+#include <bench/grammar.h>
+
+/* built with FSM_BENCH, the example runs its machine for the grammar
+   benchmark (see bench/grammar.c), the same way main does */
+static fsm *bench_parser;
+static fsm_journal *bench_journal;
+
+static int bench_setup(void)
+{
+  bench_parser = fsm_prepare(http_date_fsm);
+  bench_journal = fsm_journal_new();
+  return ((bench_parser == NULL) || (bench_journal == NULL)) ? -1 : 0;
+}
+
+static int bench_parse(char *record, size_t length)
+{
+  struct date_context parsed_date = {{0}};
+
+  parsed_date.journal = bench_journal;
+  return run_prepared_fsm_journaled(bench_parser, &record, &parsed_date, bench_journal);
+}
+
+static void bench_teardown(void)
+{
+  fsm_free(bench_parser);
+  fsm_journal_free(bench_journal);
+}
+
+static int bench_reorder(fsm_profile *profile)
+{
+  return fsm_reorder(bench_parser, profile);
+}
+
+bench_grammar bench_example = {"date", bench_setup, bench_parse, bench_teardown, bench_reorder};
+
+#else
+
+#ifdef FSM_GENERATED
+/* built with FSM_GENERATED, the example runs the code fsm2c wrote for
+   its machine, rather than the tables themselves */
+#include "date-fsm.c"
+#endif
+
 int main(int argc, char **argv)
 {
   char *str;
   int ret;
-  struct tm parsed_date = {0};
+  struct date_context parsed_date = {{0}};
+#ifdef FSM_GENERATED
+  void *date_context = &parsed_date;
+#else
+  fsm *date_parser;
+  fsm_trace *trace = NULL;
+  fsm_profile *profile = NULL;
+
+  /* with -t, the run is traced, and the trace printed afterwards -
+     with -p, it is profiled, and the profile printed afterwards */
+  if((argc > 1) &&
+     (strcmp(argv[1], "-t") == 0)) {
+    trace = fsm_trace_new(4096);
+    if(trace == NULL) {
+      printf("Unable to allocate the trace.\n");
+      return 1;
+    }
+  }
+  if((argc > 1) &&
+     (strcmp(argv[1], "-p") == 0)) {
+    profile = fsm_profile_new();
+    if(profile == NULL) {
+      printf("Unable to allocate the profile.\n");
+      return 1;
+    }
+  }
+#endif
 
   /* read a string from the user */
   str = calloc(MAX_INPUT+1, 1);
@@ -386,14 +505,52 @@ int main(int argc, char **argv)
 
   printf("Processing %d byte string...\n", (int)strlen(str));
   /* process string through FSM */
-  ret = run_fsm(http_date_fsm, &str, (void*)&parsed_date, NULL, NULL);
+  parsed_date.journal = fsm_journal_new();
+  if(parsed_date.journal == NULL) {
+    printf("Unable to allocate the journal.\n");
+    return 1;
+  }
+#ifdef FSM_GENERATED
+  ret = http_date_parse(&str, NULL, &date_context, NULL, NULL, parsed_date.journal);
+#else
+  date_parser = fsm_prepare(http_date_fsm);
+  if(date_parser == NULL) {
+    printf("Unable to prepare the date FSM.\n");
+    return 1;
+  }
+  if(trace != NULL) {
+    fsm_trace_start(trace);
+  }
+  if(profile != NULL) {
+    fsm_profile_start(profile);
+  }
+  ret = run_prepared_fsm_journaled(date_parser, &str, &parsed_date, parsed_date.journal);
+  fsm_free(date_parser);
+  if(trace != NULL) {
+    static fsm_trace_event events[4096];
+    size_t n;
+
+    fsm_trace_stop();
+    n = fsm_trace_read(trace, events, 4096);
+    fsm_trace_print(stdout, events, n);
+    fsm_trace_free(trace);
+  }
+  if(profile != NULL) {
+    fsm_profile_stop();
+    fsm_profile_report(stdout, profile, 10);
+    fsm_profile_free(profile);
+  }
+#endif
+  fsm_journal_free(parsed_date.journal);
   if(ret < 0) {
     printf("Unable to execute FSM on string: %s\n", str);
     return EXIT_FAILURE;
   }
   
   printf("\nFSM Done - processed %d characters.\n", ret);
-  printf("Parsed time is %s\n", asctime(&parsed_date));
+  printf("Parsed time is %s\n", asctime(&parsed_date.tm));
  
   return 0;
 }
+
+#endif /* FSM2C */
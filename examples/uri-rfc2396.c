@@ -430,6 +430,29 @@ transition uri_reference_fsm[] =
   };
 
 
+#ifdef FSM_BENCH
+#include <bench/grammar.h>
+
+/* built with FSM_BENCH, the example runs its machine for the grammar
+   benchmark (see bench/grammar.c), the same way main does */
+static int bench_setup(void)
+{
+  return 0;
+}
+
+static int bench_parse(char *record, size_t length)
+{
+  return run_fsm(uri_reference_fsm, &record, NULL, NULL, NULL);
+}
+
+static void bench_teardown(void)
+{
+}
+
+bench_grammar bench_example = {"uri-rfc2396", bench_setup, bench_parse, bench_teardown};
+
+#else
+
 int main(int argc, char **argv)
 {
   char *str;
@@ -457,5 +480,4 @@ int main(int argc, char **argv)
   return 0;
 }
 
-
-
+#endif /* FSM_BENCH */
@@ -15,36 +15,36 @@
 
 #define MAX_INPUT 2048
 
+/* the parts of a URI the machine captures - each is a span of the
+   URI string, so parsing one copies and allocates nothing */
+enum uri_part {
+  URI_SCHEME = 0,
+  URI_USERINFO,
+  URI_HOST,
+  URI_IP_LITERAL,
+  URI_PORT,
+  URI_PATH,
+  URI_QUERY,
+  URI_FRAGMENT,
+  URI_PARTS
+};
+
 typedef struct uri_s uri;
 struct uri_s {
-  char *scheme;
-  char *userinfo;
-  char *host;
+  /* the URI string, and where its parts are in it */
+  char *data;
+  fsm_span parts[URI_PARTS];
   int host_is_ip;
   int port;
-  char *path;
-  char *query;
-  char *fragment;
 };
 
-/* Private functions */
-static void set_scheme(char **uri_string, int scheme_len, void *global_context, void *local_context);
-static void set_userinfo(char **uri_string, int userinfo_len, void *global_context, void *local_context);
-static void set_host(char **uri_string, int host_len, void *global_context, void *local_context);
-static void check_host_is_ip(char **uri_string, int ip_length, void *global_context, void *local_context);
-static void set_host_is_ip(char **uri_string, int not_used, void *global_context, void *local_context);
-static void set_port(char **uri_string, int port_len, void *global_context, void *local_context);
-static void set_path(char **uri_string, int path_len, void *global_context, void *local_context);
-static void set_query(char **uri_string, int query_len, void *global_context, void *local_context);
-static void set_fragment(char **uri_string, int fragment_len, void *global_context, void *local_context);
-
 /*
    URI           = scheme ":" hier-part [ "?" query ] [ "#" fragment ]
 
    hier-part     = "//" authority path-abempty
-                 / path-absolute
-                 / path-rootless
-                 / path-empty
+		 / path-absolute
+		 / path-rootless
+		 / path-empty
 
    URI-reference = URI / relative-ref
 
@@ -53,9 +53,9 @@ static void set_fragment(char **uri_string, int fragment_len, void *global_conte
    relative-ref  = relative-part [ "?" query ] [ "#" fragment ]
 
    relative-part = "//" authority path-abempty
-                 / path-absolute
-                 / path-noscheme
-                 / path-empty
+		 / path-absolute
+		 / path-noscheme
+		 / path-empty
 
    scheme        = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." )
 
@@ -69,32 +69,32 @@ static void set_fragment(char **uri_string, int fragment_len, void *global_conte
    IPvFuture     = "v" 1*HEXDIG "." 1*( unreserved / sub-delims / ":" )
 
    IPv6address   =                            6( h16 ":" ) ls32
-                 /                       "::" 5( h16 ":" ) ls32
-                 / [               h16 ] "::" 4( h16 ":" ) ls32
-                 / [ *1( h16 ":" ) h16 ] "::" 3( h16 ":" ) ls32
-                 / [ *2( h16 ":" ) h16 ] "::" 2( h16 ":" ) ls32
-                 / [ *3( h16 ":" ) h16 ] "::"    h16 ":"   ls32
-                 / [ *4( h16 ":" ) h16 ] "::"              ls32
-                 / [ *5( h16 ":" ) h16 ] "::"              h16
-                 / [ *6( h16 ":" ) h16 ] "::"
+		 /                       "::" 5( h16 ":" ) ls32
+		 / [               h16 ] "::" 4( h16 ":" ) ls32
+		 / [ *1( h16 ":" ) h16 ] "::" 3( h16 ":" ) ls32
+		 / [ *2( h16 ":" ) h16 ] "::" 2( h16 ":" ) ls32
+		 / [ *3( h16 ":" ) h16 ] "::"    h16 ":"   ls32
+		 / [ *4( h16 ":" ) h16 ] "::"              ls32
+		 / [ *5( h16 ":" ) h16 ] "::"              h16
+		 / [ *6( h16 ":" ) h16 ] "::"
 
    h16           = 1*4HEXDIG
    ls32          = ( h16 ":" h16 ) / IPv4address
    IPv4address   = dec-octet "." dec-octet "." dec-octet "." dec-octet
 
    dec-octet     = DIGIT                 ; 0-9
-                 / %x31-39 DIGIT         ; 10-99
-                 / "1" 2DIGIT            ; 100-199
-                 / "2" %x30-34 DIGIT     ; 200-249
-                 / "25" %x30-35          ; 250-255
+		 / %x31-39 DIGIT         ; 10-99
+		 / "1" 2DIGIT            ; 100-199
+		 / "2" %x30-34 DIGIT     ; 200-249
+		 / "25" %x30-35          ; 250-255
 
    reg-name      = *( unreserved / pct-encoded / sub-delims )
 
    path          = path-abempty    ; begins with "/" or is empty
-                 / path-absolute   ; begins with "/" but not "//"
-                 / path-noscheme   ; begins with a non-colon segment
-                 / path-rootless   ; begins with a segment
-                 / path-empty      ; zero characters
+		 / path-absolute   ; begins with "/" but not "//"
+		 / path-noscheme   ; begins with a non-colon segment
+		 / path-rootless   ; begins with a segment
+		 / path-empty      ; zero characters
 
    path-abempty  = *( "/" segment )
    path-absolute = "/" [ segment-nz *( "/" segment ) ]
@@ -105,7 +105,7 @@ static void set_fragment(char **uri_string, int fragment_len, void *global_conte
    segment       = *pchar
    segment-nz    = 1*pchar
    segment-nz-nc = 1*( unreserved / pct-encoded / sub-delims / "@" )
-                 ; non-zero-length segment without any colon ":"
+		 ; non-zero-length segment without any colon ":"
 
    pchar         = unreserved / pct-encoded / sub-delims / ":" / "@"
 
@@ -122,7 +122,7 @@ static void set_fragment(char **uri_string, int fragment_len, void *global_conte
    gen-delims    = ":" / "/" / "?" / "#" / "[" / "]" / "@"
 
    sub-delims    = "!" / "$" / "&" / "'" / "(" / ")"
-                 / "*" / "+" / "," / ";" / "="
+		 / "*" / "+" / "," / ";" / "="
 */
 
 /* some RFC 2234 definitions that RFC3986 requires */
@@ -277,11 +277,11 @@ transition path_abempty_fsm[] =
 
 transition path_fsm[] =
   {
-    {0, FSM(path_abempty_fsm),  -1, -1, ACCEPT, set_path, NULL},
-    {0, FSM(path_absolute_fsm), -1, -1, ACCEPT, set_path, NULL},
-    {0, FSM(path_noscheme_fsm), -1, -1, ACCEPT, set_path, NULL},
-    {0, FSM(path_rootless_fsm), -1, -1, ACCEPT, set_path, NULL},
-    {0, FSM(path_empty_fsm),    -1, -1, ACCEPT, set_path, NULL},
+    {0, FSM(path_abempty_fsm),  -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
+    {0, FSM(path_absolute_fsm), -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
+    {0, FSM(path_noscheme_fsm), -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
+    {0, FSM(path_rootless_fsm), -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
+    {0, FSM(path_empty_fsm),    -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
     {-1}
   };
 
@@ -584,13 +584,13 @@ transition port_fsm[] =
 
 transition host_fsm[] =
     {
-      {0, FSM(ip_literal_fsm),  -1, -1, ACCEPT, set_host_is_ip, NULL, "ip literal"},
+      {0, FSM(ip_literal_fsm),  -1, -1, ACCEPT, NULL, NULL, "ip literal", CAPTURE(URI_IP_LITERAL)},
       
       /* this poses a parsing problem - all IPv4 addresses are valid
 	 reg_name as well. Fix this by doing the reg_name_fsm now,
-	 then on match, do a function to check if its an IPv4
-	 address */
-      {0, FSM(reg_name_fsm),    -1, -1, ACCEPT, check_host_is_ip, NULL, "reg name"},      
+	 then once the URI is parsed, checking if the host is an
+	 IPv4 address (see finish_uri) */
+      {0, FSM(reg_name_fsm),    -1, -1, ACCEPT, NULL, NULL, "reg name"},      
       {-1}
     };
 
@@ -606,7 +606,7 @@ transition userinfo_fsm[] =
 
 transition authority_fsm_1[] =
     {
-      {0, FSM(userinfo_fsm),  1, -1, NORMAL, set_userinfo, NULL, "userinfo"},
+      {0, FSM(userinfo_fsm),  1, -1, NORMAL, NULL, NULL, "userinfo", CAPTURE(URI_USERINFO)},
       {1, EXACT_STRING("@"), -1, -1, ACCEPT, NULL, NULL, "matching a @"},
       {-1}
     };
@@ -614,14 +614,14 @@ transition authority_fsm_1[] =
 transition authority_fsm_2[] =
     {
       {0, EXACT_STRING(":"), 1, -1, NORMAL, NULL, NULL, "matching a :"},
-      {1, FSM(port_fsm),    -1, -1, ACCEPT, set_port, NULL, "port"},
+      {1, FSM(port_fsm),    -1, -1, ACCEPT, NULL, NULL, "port", CAPTURE(URI_PORT)},
       {-1}
     };
 
 transition authority_fsm[] =
     {
       {0, FSM(authority_fsm_1),  1, 1},
-      {1, FSM(host_fsm),         2, -1, ACCEPT, set_host, NULL, "host"},
+      {1, FSM(host_fsm),         2, -1, ACCEPT, NULL, NULL, "host", CAPTURE(URI_HOST)},
       {2, FSM(authority_fsm_2), -1, -1, ACCEPT},
       {-1}
     };
@@ -640,26 +640,26 @@ transition scheme_fsm[] =
 transition relative_part_fsm[] =
     {
       {0, EXACT_STRING("//"),      1, -1},
-      {0, FSM(path_absolute_fsm), -1, -1, ACCEPT, set_path, NULL},
-      {0, FSM(path_noscheme_fsm), -1, -1, ACCEPT, set_path, NULL},
-      {0, FSM(path_empty_fsm),    -1, -1, ACCEPT, set_path, NULL},
+      {0, FSM(path_absolute_fsm), -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
+      {0, FSM(path_noscheme_fsm), -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
+      {0, FSM(path_empty_fsm),    -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
    
       {1, FSM(authority_fsm),      2, -1},
-      {2, FSM(path_abempty_fsm),  -1, -1, ACCEPT, set_path, NULL},
+      {2, FSM(path_abempty_fsm),  -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_PATH)},
       {-1}
     };
 
 transition relative_ref_fsm_1[] =
     {
       {0, EXACT_STRING("?"), 1, -1, NORMAL, NULL, NULL, "matching ?-query"},
-      {1, FSM(query_fsm),   -1, -1, ACCEPT, set_query, NULL, "query"},
+      {1, FSM(query_fsm),   -1, -1, ACCEPT, NULL, NULL, "query", CAPTURE(URI_QUERY)},
       {-1}
     };
 
 transition relative_ref_fsm_2[] =
     {
       {0, EXACT_STRING("#"),    1, -1, NORMAL, NULL, NULL, "matching #-fragment"},
-      {1, FSM(fragment_fsm),   -1, -1, ACCEPT, set_fragment, NULL, "fragment"},
+      {1, FSM(fragment_fsm),   -1, -1, ACCEPT, NULL, NULL, "fragment", CAPTURE(URI_FRAGMENT)},
       {-1}
     };
 
@@ -674,25 +674,25 @@ transition relative_ref_fsm[] =
 transition hier_part_fsm[] =
     {
       {0, EXACT_STRING("//"),      1, -1, NORMAL, NULL, NULL, "matching //"},
-      {0, FSM(path_absolute_fsm), -1, -1, ACCEPT, set_path, NULL, "path_absolute"},
-      {0, FSM(path_rootless_fsm), -1, -1, ACCEPT, set_path, NULL, "path rootless"},
-      {0, FSM(path_empty_fsm),    -1, -1, ACCEPT, set_path, NULL, "path empty"},
+      {0, FSM(path_absolute_fsm), -1, -1, ACCEPT, NULL, NULL, "path_absolute", CAPTURE(URI_PATH)},
+      {0, FSM(path_rootless_fsm), -1, -1, ACCEPT, NULL, NULL, "path rootless", CAPTURE(URI_PATH)},
+      {0, FSM(path_empty_fsm),    -1, -1, ACCEPT, NULL, NULL, "path empty", CAPTURE(URI_PATH)},
    
       {1, FSM(authority_fsm),      2, -1, NORMAL, NULL, NULL, "authority"},
-      {2, FSM(path_abempty_fsm),  -1, -1, ACCEPT, set_path, NULL, "path abempty"},
+      {2, FSM(path_abempty_fsm),  -1, -1, ACCEPT, NULL, NULL, "path abempty", CAPTURE(URI_PATH)},
       {-1}
     };
 
 transition absolute_uri_fsm_1[] =
     {
       {0, EXACT_STRING("?"), 1, -1},
-      {1, FSM(query_fsm),   -1, -1, ACCEPT, set_query, NULL},
+      {1, FSM(query_fsm),   -1, -1, ACCEPT, NULL, NULL, NULL, CAPTURE(URI_QUERY)},
       {-1}
     };
 
 transition absolute_uri_fsm[] =
     {
-      {0, FSM(scheme_fsm),          1, -1, NORMAL, set_scheme, NULL},
+      {0, FSM(scheme_fsm),          1, -1, NORMAL, NULL, NULL, NULL, CAPTURE(URI_SCHEME)},
       {1, EXACT_STRING(":"),        2, -1, NORMAL, NULL, NULL, "matching :"},
       {2, FSM(hier_part_fsm),       3, -1, ACCEPT},
       {3, FSM(absolute_uri_fsm_1), -1, -1, ACCEPT},
@@ -702,20 +702,20 @@ transition absolute_uri_fsm[] =
 transition uri_fsm_1[] =
     {
       {0, EXACT_STRING("?"), 1, -1, NORMAL, NULL, NULL, "matching ?-query"},
-      {1, FSM(query_fsm),   -1, -1, ACCEPT, set_query, NULL, "query"},
+      {1, FSM(query_fsm),   -1, -1, ACCEPT, NULL, NULL, "query", CAPTURE(URI_QUERY)},
       {-1}
     };
 
 transition uri_fsm_2[] =
     {
       {0, EXACT_STRING("#"),    1, -1, NORMAL, NULL, NULL, "matching #-fagment"},
-      {1, FSM(fragment_fsm),   -1, -1, ACCEPT, set_fragment, NULL, "fragment"},
+      {1, FSM(fragment_fsm),   -1, -1, ACCEPT, NULL, NULL, "fragment", CAPTURE(URI_FRAGMENT)},
       {-1}
     };
 
 transition uri_fsm[] =
     {
-      {0, FSM(scheme_fsm),     1, -1, NORMAL, set_scheme, NULL, "scheme"},
+      {0, FSM(scheme_fsm),     1, -1, NORMAL, NULL, NULL, "scheme", CAPTURE(URI_SCHEME)},
       {1, EXACT_STRING(":"),   2, -1, NORMAL, NULL, NULL, "matching : in uri"},
       {2, FSM(hier_part_fsm),  3, -1, ACCEPT, NULL, NULL, "hier-part"},
       {3, FSM(uri_fsm_1),      4, -1, ACCEPT},
@@ -730,205 +730,201 @@ transition uri_reference_fsm[] =
       {-1}
     };
 
+#ifndef FSM2C
 /** 
- * Set the scheme in the global content, a uri type variable
+ * Finish off a URI the machine accepted - its parts are already
+ * captured, which leaves whether the host is an IP address, and the
+ * port as a number
  * 
- * @param uri_string the raw URI string
- * @param scheme_len the length of the scheme string
- * @param global_context a pointer to a URI type
- * @param local_context should be NULL, it gets ignored
+ * @param u the URI, with its parts captured
+ * @param data the URI string the machine was run on
  */
-static void set_scheme(char **uri_string, int scheme_len, void *global_context, void *local_context)
+static void finish_uri(uri *u, char *data)
 {
-  uri *u = (uri*)global_context;
-  u->scheme = malloc(scheme_len+1);
-  if(u->scheme == NULL) {
-    /* could not allocate space to store the scheme - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the scheme string\n");
-    exit(1);
+  fsm_span *host = &u->parts[URI_HOST];
+  fsm_span *port = &u->parts[URI_PORT];
+  char *ip;
+
+  u->data = data;
+  u->host_is_ip = 0;
+  u->port = -1;
+
+  if(u->parts[URI_IP_LITERAL].length >= 0) {
+    u->host_is_ip = 1;
+  } else if(host->length >= 0) {
+    /* this poses a parsing problem - all IPv4 addresses are valid
+       reg_name as well. the machine reads the host as a reg_name,
+       so check here whether all of it is an IPv4 address */
+    ip = data + host->offset;
+    if(run_fsm_n(ipv4address_fsm, &ip, host->length, NULL, NULL, NULL) == host->length) {
+      u->host_is_ip = 1;
+    }
   }
-  memcpy(u->scheme, *uri_string, scheme_len);
-  u->scheme[scheme_len] = '\0';
-}
 
-static void set_userinfo(char **uri_string, int userinfo_len, void *global_context, void *local_context)
-{
-  uri *u = (uri*)global_context;
-  u->userinfo = malloc(userinfo_len+1);
-  if(u->userinfo == NULL) {
-    /* could not allocate space to store the userinfo - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the userinfo string\n");
-    exit(1);
+  if(port->length >= 0) {
+    /* the port is all digits, and is followed by something that is
+       not, so atoi reads exactly the port */
+    u->port = atoi(data + port->offset);
   }
-  memcpy(u->userinfo, *uri_string, userinfo_len);
-  u->userinfo[userinfo_len] = '\0';
 }
+#endif
+
+#ifdef FSM2C
+#include <fsm2c.h>
+
+/* the names fsm2c writes the machine's tables and functions with */
+fsm2c_symbol uri_symbols[] =
+  {
+    FSM2C_SYMBOL(uri_reference_fsm),
+    FSM2C_SYMBOL(alpha_fsm),
+    FSM2C_SYMBOL(digit_fsm),
+    FSM2C_SYMBOL(hexdig_fsm),
+    FSM2C_SYMBOL(sub_delims_fsm),
+    FSM2C_SYMBOL(gen_delims_fsm),
+    FSM2C_SYMBOL(reserved_fsm),
+    FSM2C_SYMBOL(unreserved_fsm),
+    FSM2C_SYMBOL(pct_encoded_fsm),
+    FSM2C_SYMBOL(pchar_fsm),
+    FSM2C_SYMBOL(fragment_fsm),
+    FSM2C_SYMBOL(query_fsm),
+    FSM2C_SYMBOL(segment_nz_nc_fsm),
+    FSM2C_SYMBOL(segment_nz_fsm),
+    FSM2C_SYMBOL(segment_fsm),
+    FSM2C_SYMBOL(path_empty_fsm),
+    FSM2C_SYMBOL(path_rootless_fsm),
+    FSM2C_SYMBOL(path_noscheme_fsm),
+    FSM2C_SYMBOL(path_absolute_fsm),
+    FSM2C_SYMBOL(path_abempty_fsm),
+    FSM2C_SYMBOL(path_fsm),
+    FSM2C_SYMBOL(reg_name_fsm),
+    FSM2C_SYMBOL(dec_octet_fsm_1),
+    FSM2C_SYMBOL(dec_octet_fsm_2),
+    FSM2C_SYMBOL(dec_octet_fsm_3),
+    FSM2C_SYMBOL(dec_octet_fsm_4),
+    FSM2C_SYMBOL(dec_octet_fsm),
+    FSM2C_SYMBOL(ipv4address_fsm),
+    FSM2C_SYMBOL(h16_fsm),
+    FSM2C_SYMBOL(ls32_fsm),
+    FSM2C_SYMBOL(ipv6address_fsm_a),
+    FSM2C_SYMBOL(ipv6address_fsm_1),
+    FSM2C_SYMBOL(ipv6address_fsm_2),
+    FSM2C_SYMBOL(ipv6address_fsm_3),
+    FSM2C_SYMBOL(ipv6address_fsm_4_1),
+    FSM2C_SYMBOL(ipv6address_fsm_4),
+    FSM2C_SYMBOL(ipv6address_fsm_5_1),
+    FSM2C_SYMBOL(ipv6address_fsm_5),
+    FSM2C_SYMBOL(ipv6address_fsm_6_1),
+    FSM2C_SYMBOL(ipv6address_fsm_6),
+    FSM2C_SYMBOL(ipv6address_fsm_7_1),
+    FSM2C_SYMBOL(ipv6address_fsm_7),
+    FSM2C_SYMBOL(ipv6address_fsm_8_1),
+    FSM2C_SYMBOL(ipv6address_fsm_8),
+    FSM2C_SYMBOL(ipv6address_fsm_9_1),
+    FSM2C_SYMBOL(ipv6address_fsm_9),
+    FSM2C_SYMBOL(ipv6address_fsm),
+    FSM2C_SYMBOL(ipvfuture_fsm),
+    FSM2C_SYMBOL(ip_literal_fsm),
+    FSM2C_SYMBOL(port_fsm),
+    FSM2C_SYMBOL(host_fsm),
+    FSM2C_SYMBOL(userinfo_fsm),
+    FSM2C_SYMBOL(authority_fsm_1),
+    FSM2C_SYMBOL(authority_fsm_2),
+    FSM2C_SYMBOL(authority_fsm),
+    FSM2C_SYMBOL(scheme_fsm),
+    FSM2C_SYMBOL(relative_part_fsm),
+    FSM2C_SYMBOL(relative_ref_fsm_1),
+    FSM2C_SYMBOL(relative_ref_fsm_2),
+    FSM2C_SYMBOL(relative_ref_fsm),
+    FSM2C_SYMBOL(hier_part_fsm),
+    FSM2C_SYMBOL(absolute_uri_fsm_1),
+    FSM2C_SYMBOL(absolute_uri_fsm),
+    FSM2C_SYMBOL(uri_fsm_1),
+    FSM2C_SYMBOL(uri_fsm_2),
+    FSM2C_SYMBOL(uri_fsm),
+    {NULL}
+  };
 
-static void set_host(char **uri_string, int host_len, void *global_context, void *local_context)
+int main(int argc, char **argv)
 {
-  uri *u = (uri*)global_context;
-  u->host = malloc(host_len+1);
-  if(u->host == NULL) {
-    /* could not allocate space to store the host - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the host string\n");
-    exit(1);
-  }
-  memcpy(u->host, *uri_string, host_len);
-  u->host[host_len] = '\0';
+  /* built with FSM2C, this example writes its machine out as C code
+     instead of running it - which is how uri-rfc3986-fsm.c is made for the
+     FSM_GENERATED build */
+  return (fsm2c(stdout, uri_reference_fsm, "uri_reference_parse", uri_symbols) < 0) ? 1 : 0;
 }
 
-static void set_host_is_ip(char **uri_string, int not_used, void *global_context, void *local_context)
-{
-  uri *u = (uri*)global_context;
-  u->host_is_ip = 1;
-}
+#elif defined(FSM_BENCH)
+#include <bench/grammar.h>
 
-static void check_host_is_ip(char **uri_string, int ip_length, void *global_context, void *local_context)
-{
-  int ret;
- 
-  ret = run_fsm(ipv4address_fsm, uri_string, NULL, NULL, NULL);
-  if(ret == ip_length) {
-    set_host_is_ip(uri_string, ip_length, global_context, local_context);
-  }
-}
+/* built with FSM_BENCH, the example runs its machine for the grammar
+   benchmark (see bench/grammar.c), the same way main does */
+static fsm *bench_parser;
 
-static void set_port(char **uri_string, int port_len, void *global_context, void *local_context)
+static int bench_setup(void)
 {
-  uri *u = (uri*)global_context;
-  char *port_tmp;
-  port_tmp = malloc(port_len+1);
-  if(port_tmp == NULL) {
-    /* could not allocate space to store the port - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the port string\n");
-    exit(1);
+  bench_parser = fsm_prepare(uri_reference_fsm);
+  if(bench_parser == NULL) {
+    return -1;
   }
-  memcpy(port_tmp, *uri_string, port_len);
-  port_tmp[port_len] = '\0';
-  u->port = atoi(port_tmp);
-  free(port_tmp);
-}
 
-static void set_path(char **uri_string, int path_len, void *global_context, void *local_context)
-{
-  uri *u = (uri*)global_context;
-  u->path = malloc(path_len+1);
-  if(u->path == NULL) {
-    /* could not allocate space to store the path - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the path string\n");
-    exit(1);
-  }
-  memcpy(u->path, *uri_string, path_len);
-  u->path[path_len] = '\0';
+  /* the records are access log URIs, with hardly any IPv6 hosts for
+     the memo to help with - and without it, a run captures the parts
+     of a URI without allocating anything at all */
+  return 0;
 }
 
-static void set_query(char **uri_string, int query_len, void *global_context, void *local_context)
+static int bench_parse(char *record, size_t length)
 {
-  uri *u = (uri*)global_context;
-  u->query = malloc(query_len+1);
-  if(u->query == NULL) {
-    /* could not allocate space to store the query - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the query string\n");
-    exit(1);
-  }
-  memcpy(u->query, *uri_string, query_len);
-  u->query[query_len] = '\0';
-}
+  uri parsed_uri;
+  char *data = record;
+  int ret;
 
-static void set_fragment(char **uri_string, int fragment_len, void *global_context, void *local_context)
-{
-  uri *u = (uri*)global_context;
-  u->fragment = malloc(fragment_len+1);
-  if(u->fragment == NULL) {
-    /* could not allocate space to store the fragment - print an error and abort */
-    fprintf(stderr, "Could not malloc the space to store the fragment string\n");
-    exit(1);
+  ret = run_prepared_fsm_captures(bench_parser, &record, length, parsed_uri.parts, URI_PARTS, NULL, NULL, NULL);
+  if(ret >= 0) {
+    finish_uri(&parsed_uri, data);
   }
-  memcpy(u->fragment, *uri_string, fragment_len);
-  u->fragment[fragment_len] = '\0';
+  return ret;
 }
 
-static char *xstrdup(char *in) {
-  char *out;
-  size_t len;
-  if(in == NULL) {
-    return NULL;
-  }
-  len = strlen(in);
-  
-  out = malloc(len+1);
-  if(out == NULL) {
-    return NULL;
-  }
-  memcpy(out, in, len);
-  out[len] = '\0';
-
-  return out;
+static void bench_teardown(void)
+{
+  fsm_free(bench_parser);
 }
 
-void* duplicate_uri(void *uri_in)
+static int bench_reorder(fsm_profile *profile)
 {
-  uri *old_uri = (uri*)uri_in;
-  uri *new_uri;
-
-  if(old_uri == NULL) {
-    return NULL;
-  }
+  return fsm_reorder(bench_parser, profile);
+}
 
-  new_uri = malloc(sizeof(uri));
-  if(new_uri == NULL) {
-    return NULL;
-  }
+bench_grammar bench_example = {"uri-rfc3986", bench_setup, bench_parse, bench_teardown, bench_reorder};
 
-  new_uri->host_is_ip = old_uri->host_is_ip;
-  new_uri->port = old_uri->port;
-  new_uri->scheme = xstrdup(old_uri->scheme);
-  new_uri->userinfo = xstrdup(old_uri->userinfo);
-  new_uri->host = xstrdup(old_uri->host);
-  new_uri->path = xstrdup(old_uri->path);
-  new_uri->query = xstrdup(old_uri->query);
-  new_uri->fragment = xstrdup(old_uri->fragment);
+#else
 
-  return new_uri;
-}
+#ifdef FSM_GENERATED
+/* built with FSM_GENERATED, the example runs the code fsm2c wrote for
+   its machine, rather than the tables themselves */
+#include "uri-rfc3986-fsm.c"
+#endif
 
-void free_uri(void *uri_in)
+static void print_part(char *name, uri *u, enum uri_part part)
 {
-  uri *to_free = (uri*)uri_in;
-  if(to_free == NULL) {
-    return;
-  }
+  /* print a part of the URI, or (null) if it has none */
+  fsm_span *span = &u->parts[part];
 
-  free(to_free->scheme);
-  free(to_free->userinfo);
-  free(to_free->host);
-  free(to_free->path);
-  free(to_free->query);
-  free(to_free->fragment);
-  free(to_free);
+  if(span->length < 0) {
+    printf("%s: (null)\n", name);
+  } else {
+    printf("%s: %.*s\n", name, span->length, u->data + span->offset);
+  }
 }
 
 int main(int argc, char **argv)
 {
   char *str, *ostr;
   int ret;
-  uri *parsed_uri;
- 
-  /* initialize the URI structure - this needs pointers set to NULL to
-     be correct! */
-  parsed_uri = malloc(sizeof(uri));
-  if(parsed_uri == NULL) {
-    fprintf(stderr, "Unable to allocate space on the heap for a URI\n");
-  }
-
-  parsed_uri->host_is_ip = 0;
-  parsed_uri->port = -1;
-  parsed_uri->scheme = NULL;
-  parsed_uri->userinfo = NULL;
-  parsed_uri->host = NULL;
-  parsed_uri->path = NULL;
-  parsed_uri->query = NULL;
-  parsed_uri->fragment = NULL;
+  uri parsed_uri;
+#ifndef FSM_GENERATED
+  fsm *uri_parser;
+#endif
 
   /* read a string from the user */
   str = ostr = calloc(MAX_INPUT+1, 1);
@@ -941,25 +937,45 @@ int main(int argc, char **argv)
 
   printf("Processing %d byte string...\n", (int)strlen(str));
 
-  ret = run_fsm(uri_reference_fsm, &str, (void**)&parsed_uri, duplicate_uri, free_uri);
+  /* the parts of the URI are captured as the machine runs, rather
+     than copied out by transfns - so there is no context to copy for
+     each sub-FSM, and failed alternatives have their spans put back
+     by the run itself */
+#ifdef FSM_GENERATED
+  ret = uri_reference_parse_captures(&str, str + strlen(str), parsed_uri.parts, URI_PARTS, NULL, NULL, NULL, NULL);
+#else
+  /* the URI grammar is large, so index it once up front */
+  uri_parser = fsm_prepare(uri_reference_fsm);
+  if(uri_parser == NULL) {
+    printf("Unable to prepare the URI FSM.\n");
+    return 1;
+  }
+
+  /* the IPv6 alternatives all read the same h16s and ls32s over and
+     over - remember how those went instead. the memo keeps the spans
+     the sub-FSMs captured along with how they did, so this is safe */
+  fsm_memoize(uri_parser, 64 * 1024);
+
+  ret = run_prepared_fsm_captures(uri_parser, &str, strlen(str), parsed_uri.parts, URI_PARTS, NULL, NULL, NULL);
+  fsm_free(uri_parser);
+#endif
   if(ret < 0) {
     printf("Unable to execute FSM on string: %s\n", str);
   } else {  
-    printf("URI scheme: %s\n", parsed_uri->scheme);
-    printf("URI userinfo: %s\n", parsed_uri->userinfo);
-    printf("URI host: %s\n", parsed_uri->host);
-    printf("  Is host an IP address?: %s\n", (parsed_uri->host_is_ip) ? "yes" : "no");
-    printf("URI port: %d\n", parsed_uri->port);
-    printf("URI path: %s\n", parsed_uri->path);
-    printf("URI query: %s\n", parsed_uri->query);
-    printf("URI fragment: %s\n", parsed_uri->fragment); 
+    finish_uri(&parsed_uri, ostr);
+    print_part("URI scheme", &parsed_uri, URI_SCHEME);
+    print_part("URI userinfo", &parsed_uri, URI_USERINFO);
+    print_part("URI host", &parsed_uri, URI_HOST);
+    printf("  Is host an IP address?: %s\n", (parsed_uri.host_is_ip) ? "yes" : "no");
+    printf("URI port: %d\n", parsed_uri.port);
+    print_part("URI path", &parsed_uri, URI_PATH);
+    print_part("URI query", &parsed_uri, URI_QUERY);
+    print_part("URI fragment", &parsed_uri, URI_FRAGMENT);
     printf("\nFSM Done - processed %d characters: \"%.*s\".\n", ret, ret, ostr);
   }
  
-  free_uri(parsed_uri);
   free(ostr);
   return 0;
 }
 
-
-
+#endif /* FSM2C */
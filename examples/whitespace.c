@@ -6,7 +6,8 @@
  * @brief An example of how to use the FSM code. This demonstration
  * takes input from the user and replaces all instances of whitespace
  * characters - spaces, tabs, newlines, and carriage returns, with the
- * word "WHITESPACE".
+ * word "WHITESPACE". The input is run through the FSM as it is read,
+ * a few characters at a time.
  * 
  * 
  */
@@ -21,8 +22,13 @@ void print_whitespace(char **data, int data_used, void *notused, void *notused2)
   printf(" WHITESPACE ");
 }
 
-int print_char(char **data, void *notused, void *notused2)
+int print_char(char **data, char *end, void *notused, void *notused2)
 {
+  if(*data == end) {
+    /* we are out of data for now - there may be more on the way */
+    return FSM_MORE;
+  }
+
   if(**data == '\0') {
     /* we hit the null character, we are done */
     return -1;
@@ -32,35 +38,76 @@ int print_char(char **data, void *notused, void *notused2)
   return 1;
 }
 
-int main(int argc, char **argv)
+transition whitespace_fsm[] = {
+  {0, SINGLE_CHARACTER("\n\r \t"),      0, -1, ACCEPT, print_whitespace},
+  {0, FUNCTION_N(print_char),           0, -1, ACCEPT                  },
+  {-1}
+};
+
+#ifdef FSM_BENCH
+#include <bench/grammar.h>
+
+/* built with FSM_BENCH, the example runs its machine for the grammar
+   benchmark (see bench/grammar.c), the same way main does - though
+   the record is fed to the stream all at once */
+static int bench_setup(void)
+{
+  return 0;
+}
+
+static int bench_parse(char *record, size_t length)
 {
-  transition whitespace_fsm[] = {
-    {0, SINGLE_CHARACTER("\n\r \t"),      0, -1, ACCEPT, print_whitespace},
-    {0, FUNCTION(print_char),             0, -1, ACCEPT                  },
-    {-1}
-  };
-  char *str;
-  char *ostr;
+  fsm_stream *stream;
   int ret;
 
-  /* read a string from the user */
-  str = calloc(256, 1);
-  if(str == NULL) {
-    printf("Unable to allocate string storage space.\n");
+  stream = fsm_stream_new(whitespace_fsm, NULL, NULL, NULL);
+  if(stream == NULL) {
+    return -1;
+  }
+  fsm_stream_feed(stream, record, length);
+  ret = fsm_stream_finish(stream);
+  fsm_stream_free(stream);
+  return ret;
+}
+
+static void bench_teardown(void)
+{
+}
+
+bench_grammar bench_example = {"whitespace", bench_setup, bench_parse, bench_teardown};
+
+#else
+
+int main(int argc, char **argv)
+{
+  char piece[8];
+  size_t len;
+  fsm_stream *stream;
+  int ret = FSM_MORE;
+
+  stream = fsm_stream_new(whitespace_fsm, NULL, NULL, NULL);
+  if(stream == NULL) {
+    printf("Unable to allocate the stream.\n");
     return 1;
   }
-  ostr = str;
+
+  /* process the input through the FSM a few characters at a time,
+     as it is read */
   printf("Please enter a string containing whitespace:\n");
-  fgets(str, 255, stdin);
+  while((ret == FSM_MORE) &&
+	((len = fread(piece, 1, sizeof(piece), stdin)) > 0)) {
+    ret = fsm_stream_feed(stream, piece, len);
+  }
+  ret = fsm_stream_finish(stream);
 
-  /* process string through FSM */
-  ret = run_fsm(whitespace_fsm, &str, NULL, NULL, NULL);
   if(ret < 0) {
-    printf("Unable to execute FSM on string: %s\n", str);
+    printf("Unable to execute FSM on the input\n");
   } else {
     printf("\nFSM Done - processed %d characters.\n", ret);
   }
 
-  free(ostr);
+  fsm_stream_free(stream);
   return 0;
 }
+
+#endif /* FSM_BENCH */
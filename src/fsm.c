@@ -9,72 +9,544 @@
  */
 
 
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
 
-#ifdef FSM_DEBUG
-#include <stdio.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
 #endif
 
 #include "fsm.h"
 
-int depth = 0;
+/* a set of characters, one bit per possible byte value */
+typedef unsigned char charset[32];
+#define CHARSET_ADD(set, c) ((set)[(unsigned char)(c) >> 3] |= 1 << ((unsigned char)(c) & 7))
+#define CHARSET_HAS(set, c) ((set)[(unsigned char)(c) >> 3] & (1 << ((unsigned char)(c) & 7)))
+
+/* the most ranges of bytes a skipped class can be made of for the
+   vector code to check it - classes with more are checked a byte at
+   a time */
+#define FSM_SKIP_RANGES 8
+
+/* how many bytes into the data fsm_reorder looks to tell the
+   transitions of a state apart */
+#define FSM_LOOKAHEAD 8
+
+/* the most transitions fsm_reorder puts in one group */
+#define FSM_REORDER_GROUP 32
+
+/* a state that loops back to itself on a class of single bytes, with
+   nothing to do for each byte - a run of bytes in the class can be
+   skipped over in one go, instead of a transition at a time. row is
+   the looping row, or -1 if the state does not loop like this, and
+   chars are the bytes that take it, which are also given as ranges
+   lo[i] to hi[i] for the vector code */
+typedef struct fsm_skip_s fsm_skip;
+struct fsm_skip_s {
+  int row;
+  charset chars;
+  int nranges;
+  unsigned char lo[FSM_SKIP_RANGES];
+  unsigned char hi[FSM_SKIP_RANGES];
+};
+
+/* the part of a transition a step needs to try it and move on, packed
+   into 16 bytes - a transition is five times that, mostly pointers,
+   so a state with a handful of rows would span several cache lines.
+   match is INVALID for a row that has nothing to match with. for an
+   EXACT_STR row, arg is the length of the string and first is its
+   first byte, so most rows that do not match are turned down without
+   looking at the string; for a SINGLE_CHR row arg is the index of its
+   set in the table's sets, and for a SUBFSM row the index of its
+   prepared table in the table's subs. everything else - names,
+   functions, local contexts - stays in the transition, which is only
+   looked at once a row has matched */
+typedef struct fsm_row_s fsm_row;
+struct fsm_row_s {
+  unsigned char match;
+  unsigned char type;
+  unsigned char flags;
+  unsigned char first;
+  int pass;
+  int fail;
+  unsigned int arg;
+};
+
+/* the row has a transfn */
+#define FSM_ROW_TRANSFN 1
+
+/* the row records its bytes in a capture slot */
+#define FSM_ROW_CAPTURE 2
+
+/* the row is a FUNC row whose transition says which bytes it can
+   start with - they are in the table's sets, at arg */
+#define FSM_ROW_STARTS 4
+
+/* what fsm_reorder knows about a table, or a row of one: bytes[i] has
+   every byte the i'th byte it reads can be, and it reads at least
+   least bytes, and at most most, when it matches - FSM_LOOKAHEAD
+   standing for that many or more */
+typedef struct fsm_lookahead_s fsm_lookahead;
+struct fsm_lookahead_s {
+  charset bytes[FSM_LOOKAHEAD];
+  int least;
+  int most;
+};
+
+/* a prepared table - the transitions of one table indexed by state,
+   so that a step only has to look at the transitions leaving the
+   current state */
+typedef struct fsm_table_s fsm_table;
+struct fsm_table_s {
+  /* the table this index was built from */
+  transition *table;
+
+  /* one more than the largest state number used in the table */
+  int nstates;
+
+  /* the transitions leaving state s are rows[first[s]] up to (but not
+     including) rows[first[s+1]], in table order - and hot[i] is the
+     hot part of the transition rows[i], so the rows of a state are
+     next to each other in hot as well */
+  int *first;
+  int *rows;
+  fsm_row *hot;
+
+  /* the characters of the SINGLE_CHR rows, and the prepared tables of
+     the SUBFSM rows, in the order of the rows in hot */
+  charset *sets;
+  fsm_table **subs;
+
+  /* if the table does nothing but match one byte of a class (and
+     then accept), is_class is set and the class is in class_chars, so
+     that tables using it can treat it like a SINGLE_CHR row */
+  int is_class;
+  charset class_chars;
+
+  /* the bytes the table can start with - the first byte of the data
+     has to be one of starts for it to accept, unless nullable is set,
+     which it is if the table can accept, or do anything at all,
+     without reading a byte. a SUBFSM row for a table that is not
+     nullable is turned down, without copying the context or running
+     the table, when the byte is not in starts */
+  charset starts;
+  int nullable;
+
+  /* the states that can skip runs of bytes, indexed by state */
+  fsm_skip *skip;
+};
+
+struct fsm_s {
+  /* the prepared version of the table passed to fsm_prepare */
+  fsm_table *root;
+
+  /* every table reachable from the root, each prepared exactly once */
+  fsm_table **tables;
+  int ntables;
+
+  /* the most memory a run may use to memoize sub-FSMs, or 0 if runs
+     should not memoize - see fsm_memoize */
+  size_t memo_limit;
+
+  /* when runs call transfn functions - see fsm_defer_calls */
+  enum fsm_calls calls;
+
+  /* the most tables a run may be in at once, or 0 for FSM_MAX_DEPTH -
+     see fsm_max_depth */
+  int max_depth;
+};
+
+/* what a transition did, that the memo has to do again */
+enum fsm_effect_kind {
+  FSM_EFFECT_TRANSFN = 0, /* called its transfn */
+  FSM_EFFECT_ACTION,      /* called the action of its FUNC row */
+  FSM_EFFECT_CAPTURE      /* recorded its bytes in its capture slot */
+};
+
+/* something a transition did - to the context, or to the spans - on
+   the nbytes bytes at offset */
+typedef struct fsm_effect_s fsm_effect;
+struct fsm_effect_s {
+  transition *trans;
+  int kind;
+  size_t offset;
+  int nbytes;
+};
+
+/* a block of memory the memo hands out effects from */
+typedef struct fsm_chunk_s fsm_chunk;
+struct fsm_chunk_s {
+  fsm_chunk *next;
+  int used;
+  int size;
+  fsm_effect effects[1];
+};
+
+/* what a table returned when it was run from offset, and the effects
+   of its transitions, in order, if it accepted */
+typedef struct fsm_memo_entry_s fsm_memo_entry;
+struct fsm_memo_entry_s {
+  fsm_table *table;
+  size_t offset;
+  int nbytes_processed;
+  int neffects;
+  fsm_effect *effects;
+};
+
+/* the packrat memo of a run. entries is an open addressed hash table
+   that doubles when it is half full, and the effects live in chunks
+   that are all freed together at the end of the run. once the memo
+   has used limit bytes, nothing more is added to it */
+typedef struct fsm_memo_s fsm_memo;
+struct fsm_memo_s {
+  fsm_memo_entry *entries;
+  int size;
+  int count;
+  fsm_chunk *chunks;
+  size_t bytes;
+  size_t limit;
+};
+
+
+/* the journal of a run - the old contents of everything callbacks
+   wrote to, so it can be put back. each entry is the old bytes,
+   followed by a header saying where they came from, so the journal
+   can be read backwards */
+struct fsm_journal_s {
+  unsigned char *log;
+  size_t used;
+  size_t size;
+};
+
+typedef struct fsm_journal_entry_s fsm_journal_entry;
+struct fsm_journal_entry_s {
+  void *address;
+  size_t size;
+};
+
+/* a table that is running. run_fsm used to run sub-FSMs by calling
+   itself, but a machine that has to stop when it runs out of data
+   (see fsm_stream) and carry on later can not keep its place on the
+   C stack, so the engine keeps a stack of these instead - one for
+   each table being run, the outermost first */
+typedef struct fsm_profile_entry_s fsm_profile_entry;
+typedef struct fsm_frame_s fsm_frame;
+struct fsm_frame_s {
+  transition *table;
+  fsm_table *pt;
+
+  /* the state the table is in, and the transition being tried (-1
+     when the first transition of the state has not been found yet) */
+  int current_state;
+  int row;
+  int cursor;
+
+  int in_accept;
+  int nbytes_processed;
+
+  /* where the data of the table is up to - the transition being
+     tried starts here */
+  char *data;
+
+  /* how much of an EXACT_STR transition's string is known to match
+     already, when the data ran out part way through it */
+  size_t matched;
+
+  /* the copy of the context that the sub-FSM in the frame above this
+     one works on */
+  void *context_copy;
+
+  /* the effects of the table's transitions start here in the run's
+     list of effects, and the spans they changed in the run's log of
+     captures */
+  int effects_start;
+  int captures_start;
+
+  /* where the journal was when the sub-FSM in the frame above this
+     one was started */
+  size_t savepoint;
+
+  /* the profile's counts for the table, if the run is being
+     profiled - along with when the table started, and the cycles
+     spent in the sub-FSMs it has started so far */
+  fsm_profile_entry *prof;
+  unsigned long long started;
+  unsigned long long child_cycles;
+};
+
+/* the number of frames run_fsm keeps on the C stack - deeper
+   machines move the frames to the heap */
+#define FSM_FRAMES 16
+
+/* what a span was before a sub-FSM changed it, so that it can be put
+   back if the sub-FSM fails */
+typedef struct fsm_capture_s fsm_capture;
+struct fsm_capture_s {
+  int slot;
+  fsm_span old;
+};
+
+/* the number of old spans a run keeps on the C stack */
+#define FSM_CAPTURES 16
+
+/* a run of a machine */
+typedef struct fsm_run_s fsm_run;
+struct fsm_run_s {
+  fsm_frame *frames;
+  int nframes;
+  int maxframes;
+  int max_depth;
+  fsm_frame stack[FSM_FRAMES];
+
+  /* where the data stops, or NULL if it is NUL terminated - and if
+     more is set, the data does not really stop there, there just is
+     no more of it yet */
+  char *end;
+  int more;
+
+  void **context;
+  dup_fn dup_context;
+  free_fn free_context;
+
+  /* the journal of a journaled run, and where it was when the run
+     started */
+  fsm_journal *journal;
+  size_t journal_base;
+
+  /* offsets into the data are measured from origin, which is dropped
+     bytes into the data */
+  char *origin;
+  size_t dropped;
+
+  /* when transfn functions are called, and whether the run has
+     failed to note down a deferred call or gone too deep - either of
+     which stops it */
+  enum fsm_calls calls;
+  int error;
+
+  /* when memoizing, the effects of the transitions made by the
+     sub-FSMs being run, so that the memo can replay them - and when
+     calls are deferred, the effects of every transition made, which
+     become the calls made once the machine accepts */
+  fsm_memo memo;
+  fsm_effect *effects;
+  int neffects;
+  int maxeffects;
+
+  /* the spans a capturing run records in, or NULL - and the old
+     spans the sub-FSMs being run have changed, each slot logged at
+     most once for each sub-FSM */
+  fsm_span *spans;
+  int nspans;
+  fsm_capture *captures;
+  int ncaptures;
+  int maxcaptures;
+  fsm_capture capture_stack[FSM_CAPTURES];
+
+  /* the trace the run writes its events to, or NULL if it is not
+     being traced */
+  fsm_trace *trace;
+
+  /* the profile the run counts into, or NULL if it is not being
+     profiled */
+  fsm_profile *profile;
+};
+
+struct fsm_stream_s {
+  fsm_run run;
+
+  /* the data fed to the stream that the machine may still need, kept
+     NUL terminated for the benefit of FUNCTION transitions */
+  char *buffer;
+  size_t length;
+  size_t size;
+
+  /* the number of bytes dropped from the front of buffer so far */
+  size_t dropped;
+
+  /* FSM_MORE until the machine has finished */
+  int result;
+};
+
+/* what run_transition returns when it has started a sub-FSM */
+#define FSM_CALLED -3
+
+/* a ring of trace events, written by one thread at a time. next
+   counts every event ever written, so the newest event is at (next -
+   1) & mask - a reader can tell from next which of the events it
+   copied were written over while it was copying them */
+struct fsm_trace_s {
+  fsm_trace_event *events;
+  size_t mask;
+  size_t next;
+};
+
+/* the trace the runs the thread starts write to, if any */
+static __thread fsm_trace *thread_trace;
+
+/* what a profile counts for each row of a table */
+typedef struct fsm_profile_counts_s fsm_profile_counts;
+struct fsm_profile_counts_s {
+  unsigned long attempts;
+  unsigned long matches;
+  unsigned long long bytes;
+};
+
+/* what a profile knows about one table, and its rows */
+struct fsm_profile_entry_s {
+  transition *table;
+  int nrows;
+  unsigned long runs;
+  unsigned long long inclusive;
+  unsigned long long exclusive;
+  fsm_profile_counts *rows;
+};
+
+/* a profile is a hash of the tables it has seen, keyed by where the
+   table is - mask + 1 buckets, a power of two, kept at most half
+   full */
+struct fsm_profile_s {
+  fsm_profile_entry **entries;
+  size_t mask;
+  size_t count;
+};
+
+/* the profile the runs the thread starts count into, if any */
+static __thread fsm_profile *thread_profile;
+
+#if defined(__GNUC__)
+#define FSM_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define FSM_COLD __attribute__((noinline, cold))
+#else
+#define FSM_UNLIKELY(x) (x)
+#define FSM_COLD
+#endif
+
+/* note an event of frame f in the run's trace - when the run is not
+   being traced, this costs one test of a pointer that is always
+   NULL */
+#define FSM_TRACE(r, f, kind, nbytes) \
+  do { \
+    if(FSM_UNLIKELY((r)->trace != NULL)) { \
+      trace_event((r), (f), (kind), (nbytes)); \
+    } \
+  } while(0)
 
 
 /* Private Functions */
-static int run_transition(transition *trans, char **data, void **context, dup_fn dup_context, free_fn free_context);
+static int run_transition(fsm_run *r, fsm_frame *f);
+static int run_table(fsm_run *r);
+static void start_run(fsm_run *r, transition action_table[], fsm *f, char *data, char *end, void **context, dup_fn dup_context, free_fn free_context);
+static fsm_frame *push_frame(fsm_run *r, transition action_table[], fsm_table *pt, char *data);
+static void **frame_context(fsm_run *r, int frame);
+static int end_transition(fsm_run *r, fsm_frame *f, int nbytes_used_transing);
+static int finish_fsm(fsm_run *r, fsm_frame *f, int ret);
+static int run_once(transition action_table[], fsm *f, char **data, char *end, void **context, dup_fn dup_context, free_fn free_context, fsm_journal *journal, fsm_span *spans, int nspans);
+static void rollback(fsm_journal *j, size_t savepoint);
+static int commit_run(fsm_run *r, int ret);
+static void end_run(fsm_run *r);
+static fsm_stream *new_stream(transition action_table[], fsm *f, void **context, dup_fn dup_context, free_fn free_context);
+static void add_effect(fsm_run *r, transition *trans, int kind, char *data, int nbytes);
+static void set_capture(fsm_run *r, transition *trans, char *data, int nbytes);
+static fsm_memo_entry *find_memo(fsm_memo *m, fsm_table *pt, size_t offset);
+static void add_memo(fsm_run *r, fsm_table *pt, size_t offset, int nbytes_processed, int effects_start);
+static void replay_memo(fsm_run *r, fsm_memo_entry *e, void *context);
+static int find_row(transition action_table[], fsm_table *pt, int state, int after, int *cursor);
+static int next_row(transition action_table[], fsm_table *pt, int state, int row, int *cursor);
+static const fsm_row *frame_row(fsm_frame *f, fsm_row *scratch);
+static void compact_row(transition *trans, fsm_row *row);
+static fsm_table *prepare_table(fsm *f, transition action_table[]);
+static int row_class(fsm_table *pt, int slot, charset chars);
+static void prepare_skips(fsm_table *pt, int nrows);
+static int prepare_starts(fsm *f);
+static int cannot_start(fsm_run *r, fsm_frame *f, charset starts);
+static int table_number(fsm *f, fsm_table *pt);
+static void row_lookahead(fsm *f, fsm_table *pt, int slot, fsm_lookahead *tables, fsm_lookahead *row);
+static void table_lookahead(fsm *f, fsm_table *pt, fsm_lookahead *tables, int *reached, fsm_lookahead *out);
+static int disjoint(fsm_lookahead *a, fsm_lookahead *b);
+static int reorder_table(fsm *f, fsm_table *pt, fsm_lookahead *tables, fsm_profile_entry *counts);
+static fsm_profile_entry *find_profile(fsm_profile *p, transition *table);
+static size_t skip_run(fsm_skip *skip, char *data, char *end);
+static void free_table(fsm_table *pt);
+static void trace_event(fsm_run *r, fsm_frame *f, int kind, int nbytes) FSM_COLD;
+static void profile_enter(fsm_run *r, fsm_frame *f) FSM_COLD;
+static void profile_leave(fsm_run *r, fsm_frame *f) FSM_COLD;
+static fsm_profile_entry *profile_entry(fsm_profile *p, transition *table);
+static unsigned long long profile_clock(void);
 
-static int run_transition(transition *trans, char **data, void **context, dup_fn dup_context, free_fn free_context)
+static int run_transition(fsm_run *r, fsm_frame *f)
 {
-  /* printf("run_transition\n"); */
+  /* try the transition in the frame's current row on the frame's
+     data. returns the number of bytes used transitioning, -1 if the
+     transition can not be made, FSM_MORE if the data ran out before
+     that could be known, or FSM_CALLED if a sub-FSM was started in a
+     new frame, which will be finished by finish_fsm */
+  transition *trans = &f->table[f->row];
+  fsm_row scratch;
+  const fsm_row *hot = frame_row(f, &scratch);
+  void **context = frame_context(r, r->nframes - 1);
+  dup_fn dup_context = r->dup_context;
+  free_fn free_context = r->free_context;
+  char **data = &f->data;
+  char *end = r->end;
 
-  if((trans == NULL) ||
-     (data == NULL)) {
-    /* we need to be provided a valid transition and data in order to
-       run a transition */
-    /* printf("run_transition error\n"); */
-    return -1;
-  }
+  /* printf("run_transition\n"); */
 
-#ifdef FSM_DEBUG
-  depth++;
-  if(trans->transition_name != NULL) {
-    int i; for(i = 0; i < depth; i++) printf(" ");
-    printf("attempting transition %s\n", trans->transition_name);
-  }
-#endif
+  FSM_TRACE(r, f, FSM_TRACE_ATTEMPT, 0);
 
   /* switch on the transition type - are we trying to do a string
      match, a single character match, a function execution, or a whole
      seperate FSM? */
 
-  switch(trans->match_type) {
+  switch(hot->match) {
 
   case EXACT_STR: {
     /* check to see if the string stored in the transition matches the
        string at the beginning of the data - if so, return the length
-       of the matched string, if not, then return -1 */
+       of the matched string, if not, then return -1. when the data
+       has an end, the string has to fit before it - unless more data
+       is on its way, in which case what there is of it has to
+       match, and the rest is checked when it arrives */
     /* printf("run_transition on an exact string\n"); */
-    
-    if(trans->str == NULL) {
-      /* if there is no string to match, it is an error */
+    size_t length;
+    int fits = 1;
+
+    length = (f->pt != NULL) ? hot->arg : strlen(trans->str);
+    if((length > 0) &&
+       (f->matched == 0) &&
+       ((end == NULL) || (*data < end)) &&
+       ((unsigned char)**data != hot->first)) {
+      /* the first byte is enough to tell */
       return -1;
     }
-    if(memcmp(*data, trans->str, strlen(trans->str)) == 0) {
+    if((end != NULL) &&
+       ((size_t)(end - *data) < length)) {
+      size_t have = end - *data;
+      if(r->more &&
+	 (memcmp(*data + f->matched, trans->str + f->matched, have - f->matched) == 0)) {
+	/* so far so good, wait for the rest */
+	f->matched = have;
+	return FSM_MORE;
+      }
+      fits = 0;
+    }
+    if(fits &&
+       (memcmp(*data + f->matched, trans->str + f->matched, length - f->matched) == 0)) {
       /* the string matched, return the length of the matched
 	 string */
-#ifdef FSM_DEBUG
-      if(trans->transition_name != NULL) {
-	int i; for(i = 0; i < depth; i++) printf(" ");
-	printf("made transition %s with string %s\n", trans->transition_name, trans->str);
-      }
-      depth--;
-#endif
-      return strlen(trans->str);
+      return length;
     } else {
       /* no matching string, return -1 for no transition made */
-#ifdef FSM_DEBUG
-      depth--;
-#endif
       return -1;
     }
   } break;
@@ -82,31 +554,30 @@ static int run_transition(transition *trans, char **data, void **context, dup_fn
   case SINGLE_CHR: {
     /* check to see if any of the single characters in trans->str
        match the first character of *data - if so, return the number 1
-       for one character matched, else, -1 for no transition made */
-    int i;
+       for one character matched, else, -1 for no transition made. a
+       prepared table already has the characters as a bitmap, so that
+       is a single bit test, otherwise search the string */
+    int matched;
     /* printf("run_transition trans on single char\n"); */
-    if(trans->str == NULL) {
-      /* unable to transition on NULL! */
-      return -1;
-    }
 
-    for(i = 0; i < strlen(trans->str); i++) {
-      if(*data[0] == trans->str[i]) {
-#ifdef FSM_DEBUG
-	if(trans->transition_name != NULL) {
-	  int j; for(j = 0; j < depth; j++) printf(" ");
-	  printf("made transition %s with character %c\n", trans->transition_name, trans->str[i]);
-	}
-	depth--;
-#endif
-	return 1;
+    if((end != NULL) && (*data >= end)) {
+      if(r->more) {
+	/* wait for the character to arrive */
+	return FSM_MORE;
       }
+      /* no data left */
+      matched = 0;
+    } else if(f->pt != NULL) {
+      matched = CHARSET_HAS(f->pt->sets[hot->arg], **data);
+    } else {
+      matched = (**data != '\0') && (strchr(trans->str, **data) != NULL);
+    }
+
+    if(matched) {
+      return 1;
     }
 
     /* no single character match made, return -1 */
-#ifdef FSM_DEBUG
-    depth--;
-#endif
     return -1;
   } break;
 
@@ -119,17 +590,32 @@ static int run_transition(transition *trans, char **data, void **context, dup_fn
        problem */
     /* printf("transitioning to another FSM\n"); */
     void *context_copy;
-    int ret;
+    fsm_table *sub = (f->pt == NULL) ? NULL : f->pt->subs[hot->arg];
+    fsm_memo_entry *memo = NULL;
 
-    if(trans->transition_table == NULL) {
-      /* unable to transition on an empty transition table */
+    if((sub != NULL) &&
+       !sub->nullable &&
+       (r->nframes < r->max_depth) &&
+       cannot_start(r, f, sub->starts)) {
+      /* the sub-FSM can not start with the byte, so running it would
+	 only fail - turn it down now, without a copy of the context,
+	 or a frame */
       return -1;
     }
 
+    if(r->memo.limit > 0) {
+      /* the sub-FSM may already have been run from here */
+      memo = find_memo(&r->memo, sub, (f->data - r->origin) + r->dropped);
+      if((memo != NULL) &&
+	 (memo->nbytes_processed < 0)) {
+	return -1;
+      }
+    }
+
     /* make a copy of the context so that if the sub-FSM succeeds,
        then we keep the new copy, and if it fails, we keep the old
        one */
-    if((dup_context != NULL) && 
+    if((dup_context != NULL) &&
        (context != NULL)) {
       context_copy = dup_context(*context);
       if(context_copy == NULL) {
@@ -144,37 +630,49 @@ static int run_transition(transition *trans, char **data, void **context, dup_fn
 	context_copy = NULL;
       }
     }
+    f->context_copy = context_copy;
+    if(r->journal != NULL) {
+      /* the sub-FSM works on the context itself - if it fails, the
+	 journal puts it back */
+      f->savepoint = r->journal->used;
+    }
 
-    /* run the sub FSM on the copy of the context */
-    ret = run_fsm(trans->transition_table, data, &context_copy, dup_context, free_context);    
-
-    if(ret >= 0) {
-      /* successful sub FSM  - keep the new context and free the old one */
+    if(memo != NULL) {
+      /* it has, and it accepted - do to the copy of the context what
+	 running it did, and keep the copy */
+      replay_memo(r, memo, context_copy);
       if(context != NULL) {
 	if(free_context != NULL) {
 	  free_context(*context);
 	}
 	*context = context_copy;
       }
+      f->context_copy = NULL;
+      return memo->nbytes_processed;
+    }
 
-#ifdef FSM_DEBUG
-      if(trans->transition_name != NULL) {
-	int i; for(i = 0; i < depth; i++) printf(" ");
-	printf("made transition %s with FSM\n", trans->transition_name);
-      }
-      depth--;
-#endif
-    } else {
-      /* sub FSM failed, free the duplicated context */
+    if(r->nframes >= r->max_depth) {
+      /* the data is nested too deep - the whole run stops */
+      r->error = 1;
+    }
+
+    /* run the sub FSM on the copy of the context, in a frame of its
+       own - finish_fsm picks up from here when it is done */
+    if(r->error ||
+       (push_frame(r, trans->transition_table, sub, f->data) == NULL)) {
       if(free_context != NULL) {
 	free_context(context_copy);
       }
+      f->context_copy = NULL;
+      return -1;
     }
+    /* (pushing the frame may have moved the frames) */
+    FSM_TRACE(r, &r->frames[r->nframes - 2], FSM_TRACE_ENTER, 0);
+
+    return FSM_CALLED;
 
-    return ret;
-    
   } break;
-    
+
   case FUNC: {
     /* here, we run a function, and use its output to determine if we
        are going to transition or not. The function should act just
@@ -182,11 +680,15 @@ static int run_transition(transition *trans, char **data, void **context, dup_fn
        0 or more on transition */
     int ret;
     void *context_copy;
+    char *data_copy = *data;
+    size_t savepoint = (r->journal != NULL) ? r->journal->used : 0;
 
-    if(trans->action == NULL) {
+    if((hot->flags & FSM_ROW_STARTS) &&
+       cannot_start(r, f, f->pt->sets[hot->arg])) {
+      /* the transition says the function would turn the byte down */
       return -1;
     }
-    
+
     if(context != NULL) {
       if(dup_context != NULL) {
 	context_copy = dup_context(*context);
@@ -196,36 +698,68 @@ static int run_transition(transition *trans, char **data, void **context, dup_fn
 	}
       } else {
       /* there was no context-copy function, so just set the copy to the original */
- 	context_copy = *context;
+	context_copy = *context;
       }
     } else {
       /* there was no context, so set the copy to NULL as well */
       context_copy = NULL;
     }
-    
-    ret = trans->action(data, context_copy, trans->local_context);
+
+    if(trans->action_n != NULL) {
+      ret = trans->action_n(&data_copy, end, context_copy, trans->local_context);
+    } else {
+      ret = trans->action(&data_copy, context_copy, trans->local_context);
+    }
+
+    if((ret == FSM_MORE) &&
+       r->more) {
+      /* the function needs more data to decide - throw away its
+	 copy of the context and run it again when there is more */
+      if((dup_context != NULL) &&
+	 (free_context != NULL)) {
+	free_context(context_copy);
+      }
+      if(r->journal != NULL) {
+	rollback(r->journal, savepoint);
+      }
+      return FSM_MORE;
+    }
+
+    if((ret >= 0) &&
+       (end != NULL) &&
+       (ret > end - *data)) {
+      /* the function claims more data than there is */
+      ret = -1;
+    }
+
     if(ret >= 0) {
       /* good transition, keep the new context, free the old one */
+      add_effect(r, trans, FSM_EFFECT_ACTION, *data, ret);
       if(context != NULL) {
 	if(free_context != NULL) {
 	  free_context(*context);
 	}
 	*context = context_copy;
-      }      
+      }
     } else {
       /* transition failed, free the new context */
       if(free_context != NULL) {
 	free_context(context_copy);
       }
+      if(r->journal != NULL) {
+	rollback(r->journal, savepoint);
+      }
+      ret = -1;
     }
-    
+
 
     return ret;
-  } break; 
+  } break;
 
   case INVALID: {
     /* this should never really happen in code, its absolutely an
-       error on the programmers part */
+       error on the programmers part - as is a row with nothing to
+       match with, which is left INVALID too */
     return -1;
   } break;
 
@@ -234,101 +768,2344 @@ static int run_transition(transition *trans, char **data, void **context, dup_fn
     /* printf("run_transition error\n"); */
     return -1;
   }
-  
+
 
   return -1;
 }
 
 int run_fsm(transition action_table[], char **data, void **context, dup_fn dup_context, free_fn free_context)
 {
-  int current_state = 0;
-  int nbytes_processed = 0;
-  int in_accept = 0;
-  
-  /* all possible states are numbered positively */
-  while(current_state >= 0) {
-    transition *current_trans;
-    int nbytes_used_transing;
-    int successful_trans = 0;
-
-    /* walk the action table, looking for the first transition where
-       both the current_state matches, and the character / string
-       matching or the FSM execution succeeds */
-    for(current_trans = action_table; 
-	current_trans->current_state != -1;
-	current_trans++) {
-
-      /* printf("attempting to transition from %s at state %d\n", *data, current_state); */
-
-      /* check to see if the current state is right, and the
-	 transition condition succeeds */
-      if(current_state == current_trans->current_state) {
-	/* we need a copy of the data pointer because, if a failing
-	   transition happens where some of the data is processed in
-	   another FSM, we can not have that sub-FSM moving our data
-	   pointer, so we give it a copy, and only let ourselves move it
-	   based on the returned amount of processed bytes */
-	char *data_copy = *data;
-	
-
-	/* if we are in a transition moving from our current state.. */
-	if((nbytes_used_transing = run_transition(current_trans, &data_copy, context, dup_context, free_context)) >= 0) {
-	  /* successful transition! run the function to be executed on
-	     transition (if there is one), then move forward the number
-	     of bytes processed in the input stream */
-	  /* printf("run_transition success\n"); */
-	  if(current_trans->transfn != NULL) {
-	    current_trans->transfn(data, nbytes_used_transing, (context == NULL) ? NULL : *context, current_trans->local_context);
-	  }
+  return run_once(action_table, NULL, data, NULL, context, dup_context, free_context, NULL, NULL, 0);
+}
 
-	  /* move forward the number of bytes used transitioning */
-	  nbytes_processed += nbytes_used_transing;
-	  *data += nbytes_used_transing;
-	  
-	  /* change the state to the success state */
-	  current_state = current_trans->state_pass;
-	  
-	  /* if the target of this transition was an accept state,
-	     mark that, otherwise, clear the in_accept variable */
-	  in_accept = 0;
-	  if(current_trans->type == ACCEPT) {
-	    in_accept = 1;
-	  } else if (current_trans->type == REJECT) {
-	    /* if we are in a reject state, then we immediately abort */
-	    return -1;
-	  } else {
-	    /* our target was a normal state, nothing special to do */
-	  }
+int run_fsm_n(transition action_table[], char **data, size_t length, void **context, dup_fn dup_context, free_fn free_context)
+{
+  if((data == NULL) ||
+     (*data == NULL)) {
+    return -1;
+  }
+
+  return run_once(action_table, NULL, data, *data + length, context, dup_context, free_context, NULL, NULL, 0);
+}
 
+int run_prepared_fsm(fsm *f, char **data, void **context, dup_fn dup_context, free_fn free_context)
+{
+  if(f == NULL) {
+    return -1;
+  }
 
-	  /* printf("transition done, data aligned at %s\n", *data); */
+  return run_once(f->root->table, f, data, NULL, context, dup_context, free_context, NULL, NULL, 0);
+}
 
-	  /* finally, mark this as a successful transition, and break
-	     from the transition-hunting for loop */
-	  successful_trans = 1;
-	  break;
-	} else {
-	  /* the transition failed. check to see if the state_fail is
-	     positive indicating that there is a state to move to if
-	     this transition fails. if the state_fail is negative, it
-	     just gets ignored */
-	  if(current_trans->state_fail >= 0) {
-	    current_state = current_trans->state_fail;
-	  }
+int run_prepared_fsm_n(fsm *f, char **data, size_t length, void **context, dup_fn dup_context, free_fn free_context)
+{
+  if((f == NULL) ||
+     (data == NULL) ||
+     (*data == NULL)) {
+    return -1;
+  }
+
+  return run_once(f->root->table, f, data, *data + length, context, dup_context, free_context, NULL, NULL, 0);
+}
+
+int run_fsm_captures(transition action_table[], char **data, size_t length, fsm_span spans[], int nspans, void **context, dup_fn dup_context, free_fn free_context)
+{
+  if((data == NULL) ||
+     (*data == NULL) ||
+     ((spans == NULL) && (nspans > 0))) {
+    return -1;
+  }
+
+  return run_once(action_table, NULL, data, *data + length, context, dup_context, free_context, NULL, spans, nspans);
+}
+
+int run_prepared_fsm_captures(fsm *f, char **data, size_t length, fsm_span spans[], int nspans, void **context, dup_fn dup_context, free_fn free_context)
+{
+  if((f == NULL) ||
+     (data == NULL) ||
+     (*data == NULL) ||
+     ((spans == NULL) && (nspans > 0))) {
+    return -1;
+  }
+
+  return run_once(f->root->table, f, data, *data + length, context, dup_context, free_context, NULL, spans, nspans);
+}
+
+int run_fsm_journaled(transition action_table[], char **data, void *context, fsm_journal *journal)
+{
+  if(journal == NULL) {
+    return -1;
+  }
+
+  return run_once(action_table, NULL, data, NULL, &context, NULL, NULL, journal, NULL, 0);
+}
+
+int run_prepared_fsm_journaled(fsm *f, char **data, void *context, fsm_journal *journal)
+{
+  if((f == NULL) ||
+     (journal == NULL)) {
+    return -1;
+  }
+
+  return run_once(f->root->table, f, data, NULL, &context, NULL, NULL, journal, NULL, 0);
+}
+
+static int run_once(transition action_table[], fsm *f, char **data, char *end, void **context, dup_fn dup_context, free_fn free_context, fsm_journal *journal, fsm_span *spans, int nspans)
+{
+  /* run a machine on all of its data at once */
+  fsm_run r;
+  int ret;
+  int i;
+
+  if((action_table == NULL) ||
+     (data == NULL)) {
+    return -1;
+  }
+
+  start_run(&r, action_table, f, *data, end, context, dup_context, free_context);
+  if(journal != NULL) {
+    r.journal = journal;
+    r.journal_base = journal->used;
+  }
+  if(nspans > 0) {
+    for(i = 0; i < nspans; i++) {
+      spans[i].offset = 0;
+      spans[i].length = -1;
+    }
+    r.spans = spans;
+    r.nspans = nspans;
+  }
+  ret = commit_run(&r, run_table(&r));
+
+  /* leave the data where the outermost table got up to */
+  *data = r.frames[0].data;
+
+  if(journal != NULL) {
+    journal->used = r.journal_base;
+  }
+
+  end_run(&r);
+  return ret;
+}
+
+static int commit_run(fsm_run *r, int ret)
+{
+  /* the machine finished, and returned ret - if it accepted, this is
+     when deferred calls are made, in the order their transitions were
+     made */
+  int i;
+
+  if(r->error) {
+    return -1;
+  }
+
+  if((r->calls != FSM_CALLS_DEFERRED) ||
+     (ret < 0)) {
+    return ret;
+  }
+
+  for(i = 0; i < r->neffects; i++) {
+    fsm_effect *effect = &r->effects[i];
+    char *data = r->origin + (effect->offset - r->dropped);
+
+    if(effect->kind == FSM_EFFECT_TRANSFN) {
+      effect->trans->transfn(&data, effect->nbytes, (r->context == NULL) ? NULL : *r->context, effect->trans->local_context);
+    }
+  }
+  r->neffects = 0;
+
+  return ret;
+}
+
+static void end_run(fsm_run *r)
+{
+  /* free what the run allocated along the way */
+  fsm_chunk *chunk;
+
+  if(r->frames != r->stack) {
+    free(r->frames);
+  }
+
+  while(r->memo.chunks != NULL) {
+    chunk = r->memo.chunks;
+    r->memo.chunks = chunk->next;
+    free(chunk);
+  }
+  free(r->memo.entries);
+  free(r->effects);
+  if(r->captures != r->capture_stack) {
+    free(r->captures);
+  }
+}
+
+static void start_run(fsm_run *r, transition action_table[], fsm *f, char *data, char *end, void **context, dup_fn dup_context, free_fn free_context)
+{
+  /* set up a run of action_table (or of the prepared machine f, if it
+     is not NULL) on data - the first frame always fits on the run's
+     own stack */
+  memset(&r->memo, 0, sizeof(fsm_memo));
+  r->calls = FSM_CALLS_NOW;
+  r->error = 0;
+  r->max_depth = FSM_MAX_DEPTH;
+  if(f != NULL) {
+    r->memo.limit = f->memo_limit;
+    r->calls = f->calls;
+    if(f->max_depth > 0) {
+      r->max_depth = f->max_depth;
+    }
+  }
+  r->effects = NULL;
+  r->neffects = 0;
+  r->maxeffects = 0;
+  r->origin = data;
+  r->dropped = 0;
+  r->journal = NULL;
+  r->journal_base = 0;
+  r->spans = NULL;
+  r->nspans = 0;
+  r->captures = r->capture_stack;
+  r->ncaptures = 0;
+  r->maxcaptures = FSM_CAPTURES;
+
+  r->frames = r->stack;
+  r->nframes = 0;
+  r->maxframes = FSM_FRAMES;
+  r->end = end;
+  r->more = 0;
+  r->context = context;
+  r->dup_context = dup_context;
+  r->free_context = free_context;
+  r->trace = thread_trace;
+  r->profile = thread_profile;
+
+  push_frame(r, action_table, (f == NULL) ? NULL : f->root, data);
+}
+
+static fsm_frame *push_frame(fsm_run *r, transition action_table[], fsm_table *pt, char *data)
+{
+  /* start running a table on data, in a new frame */
+  fsm_frame *f;
+
+  if(r->nframes == r->maxframes) {
+    int maxframes = r->maxframes * 2;
+    fsm_frame *frames;
+
+    if(r->frames == r->stack) {
+      frames = malloc(maxframes * sizeof(fsm_frame));
+      if(frames != NULL) {
+	memcpy(frames, r->stack, sizeof(r->stack));
+      }
+    } else {
+      frames = realloc(r->frames, maxframes * sizeof(fsm_frame));
+    }
+    if(frames == NULL) {
+      return NULL;
+    }
+    r->frames = frames;
+    r->maxframes = maxframes;
+  }
+
+  f = &r->frames[r->nframes++];
+  f->table = action_table;
+  f->pt = pt;
+  f->current_state = 0;
+  f->row = -1;
+  f->cursor = 0;
+  f->in_accept = 0;
+  f->nbytes_processed = 0;
+  f->data = data;
+  f->matched = 0;
+  f->context_copy = NULL;
+  f->effects_start = r->neffects;
+  f->captures_start = r->ncaptures;
+  f->prof = NULL;
+  if(FSM_UNLIKELY(r->profile != NULL)) {
+    profile_enter(r, f);
+  }
+
+  return f;
+}
+
+static void **frame_context(fsm_run *r, int frame)
+{
+  /* the context a frame works on - the outermost table works on the
+     caller's context, each sub-FSM on the copy made for it by the
+     frame below */
+  return (frame == 0) ? r->context : &r->frames[frame - 1].context_copy;
+}
+
+static int run_table(fsm_run *r)
+{
+  /* run the machine until the outermost table is finished, returning
+     what it returned, or until the data runs out, returning
+     FSM_MORE. called again once there is more data, it carries on
+     from where it stopped */
+  for(;;) {
+    fsm_frame *f = &r->frames[r->nframes - 1];
+    int nbytes_used_transing;
+
+    /* all possible states are numbered positively */
+    if(f->row < 0) {
+      /* walk the transitions leaving the current state in table
+	 order, looking for the first one where the character / string
+	 matching or the FSM execution succeeds */
+      if((f->pt != NULL) &&
+	 (f->current_state >= 0) &&
+	 (f->current_state < f->pt->nstates) &&
+	 (f->pt->skip[f->current_state].row >= 0) &&
+	 (r->trace == NULL) &&
+	 (r->profile == NULL)) {
+	/* the state loops on a class of bytes, so take the loop over
+	   the whole run of them at once - exactly as many times as
+	   stepping would have, with nothing else to do each time. a
+	   traced or profiled run steps, so that every transition is in
+	   the trace, and counted */
+	fsm_skip *skip = &f->pt->skip[f->current_state];
+	size_t n = skip_run(skip, f->data, r->end);
+	if(n > 0) {
+	  f->data += n;
+	  f->nbytes_processed += n;
+	  f->in_accept = (f->table[skip->row].type == ACCEPT);
+	}
+      }
+      if(f->current_state >= 0) {
+	f->row = find_row(f->table, f->pt, f->current_state, -1, &f->cursor);
+      }
+      if(f->row < 0) {
+	/* there was NOT a successful transition (or we got to a
+	   negative state) - this table is done. return 0 or more if we
+	   landed in an ACCEPT state, and -1 if we were unable to use
+	   the FSM to parse the input */
+	if(finish_fsm(r, f, (f->in_accept == 1) ? f->nbytes_processed : -1)) {
+	  return r->frames[0].nbytes_processed;
 	}
+	continue;
       }
     }
 
-    /* if we are done with the for loop, and there was NOT a
-       successful transition, then move to the error state, -1 */
-    if(successful_trans == 0) {
-      current_state = -1;
+    /* printf("attempting to transition from %s at state %d\n", f->data, f->current_state); */
+
+    nbytes_used_transing = run_transition(r, f);
+    if(nbytes_used_transing == FSM_MORE) {
+      return FSM_MORE;
+    }
+    if(nbytes_used_transing == FSM_CALLED) {
+      /* carry on in the sub-FSM's frame */
+      continue;
+    }
+
+    if(end_transition(r, f, nbytes_used_transing) ||
+       FSM_UNLIKELY(r->error)) {
+      /* a REJECT transition, the table is done - or the run can not go
+	 on, and every table is */
+      if(finish_fsm(r, f, -1)) {
+	return r->frames[0].nbytes_processed;
+      }
     }
+  }
+}
+
+static int end_transition(fsm_run *r, fsm_frame *f, int nbytes_used_transing)
+{
+  /* the transition in the frame's current row was tried, and used
+     nbytes_used_transing bytes, or failed if that is negative. move
+     the frame on accordingly. returns 1 if the table has to stop
+     right away, because it made a REJECT transition */
+  transition *current_trans = &f->table[f->row];
+  fsm_row scratch;
+  const fsm_row *hot = frame_row(f, &scratch);
+  void **context = frame_context(r, f - r->frames);
 
- 
+  FSM_TRACE(r, f, (nbytes_used_transing >= 0) ? FSM_TRACE_MATCH : FSM_TRACE_FAIL, nbytes_used_transing);
+  if(FSM_UNLIKELY(f->prof != NULL)) {
+    /* counted here rather than when the transition is started, so
+       that one waiting for more data counts once */
+    fsm_profile_counts *c = &f->prof->rows[f->row];
+    c->attempts++;
+    if(nbytes_used_transing >= 0) {
+      c->matches++;
+      c->bytes += nbytes_used_transing;
+    }
   }
+  f->matched = 0;
+
+  if(nbytes_used_transing >= 0) {
+    /* successful transition! run the function to be executed on
+       transition (if there is one), then move forward the number
+       of bytes processed in the input stream */
+    /* printf("run_transition success\n"); */
+    if(hot->flags & FSM_ROW_TRANSFN) {
+      add_effect(r, current_trans, FSM_EFFECT_TRANSFN, f->data, nbytes_used_transing);
+      if(r->calls == FSM_CALLS_NOW) {
+	current_trans->transfn(&f->data, nbytes_used_transing, (context == NULL) ? NULL : *context, current_trans->local_context);
+      }
+    }
+    if(FSM_UNLIKELY(hot->flags & FSM_ROW_CAPTURE) &&
+       (r->spans != NULL)) {
+      add_effect(r, current_trans, FSM_EFFECT_CAPTURE, f->data, nbytes_used_transing);
+      set_capture(r, current_trans, f->data, nbytes_used_transing);
+    }
+
+    if((r->journal != NULL) &&
+       (r->nframes == 1)) {
+      /* a transition of the outermost table is never undone, so
+	 nothing the journal holds is needed any more */
+      r->journal->used = r->journal_base;
+    }
 
-  /* return 0 or more if we landed in an ACCEPT state, and -1 if we
-     were unable to use the FSM to parse the input */
-  return (in_accept == 1) ? nbytes_processed : -1;
+    /* move forward the number of bytes used transitioning */
+    f->nbytes_processed += nbytes_used_transing;
+    f->data += nbytes_used_transing;
+
+    /* change the state to the success state, and start again at
+       its first transition */
+    f->current_state = hot->pass;
+    f->row = -1;
+
+    /* if the target of this transition was an accept state,
+       mark that, otherwise, clear the in_accept variable */
+    f->in_accept = 0;
+    if(hot->type == ACCEPT) {
+      f->in_accept = 1;
+    } else if (hot->type == REJECT) {
+      /* if we are in a reject state, then we immediately abort */
+      return 1;
+    } else {
+      /* our target was a normal state, nothing special to do */
+    }
+
+    /* printf("transition done, data aligned at %s\n", f->data); */
+  } else {
+    /* the transition failed. check to see if the state_fail is
+       positive indicating that there is a state to move to if this
+       transition fails. if the state_fail is negative, it just gets
+       ignored. either way, the hunt carries on with the transitions
+       that come after this one in the table */
+    if(hot->fail >= 0) {
+      f->current_state = hot->fail;
+      f->row = find_row(f->table, f->pt, f->current_state, f->row, &f->cursor);
+    } else {
+      f->row = next_row(f->table, f->pt, f->current_state, f->row, &f->cursor);
+    }
+
+    if(f->row < 0) {
+      /* nothing left to try, so the table is done */
+      f->current_state = -1;
+    }
+  }
+
+  return 0;
+}
+
+static int finish_fsm(fsm_run *r, fsm_frame *f, int ret)
+{
+  /* the table in frame f is done, and returned ret. hand the result
+     to the FSM transition that started it, in the frame below -
+     which may finish that table too, and so on down. returns 1 once
+     the outermost table is done, with its result left in its
+     nbytes_processed */
+  for(;;) {
+    void **context;
+
+    if(FSM_UNLIKELY(f->prof != NULL)) {
+      profile_leave(r, f);
+    }
+
+    if(f == r->frames) {
+      f->nbytes_processed = ret;
+      return 1;
+    }
+
+    if(r->memo.limit > 0) {
+      /* remember how the table did */
+      add_memo(r, f->pt, ((f - 1)->data - r->origin) + r->dropped, ret, f->effects_start);
+    }
+    if(ret < 0) {
+      /* the effects of the table's transitions are undone along with
+	 its context - and deferred calls are never made */
+      r->neffects = f->effects_start;
+
+      /* and so are the spans it recorded, newest first */
+      while(r->ncaptures > f->captures_start) {
+	fsm_capture *c = &r->captures[--r->ncaptures];
+	r->spans[c->slot] = c->old;
+      }
+    }
+
+    r->nframes--;
+    f--;
+
+    if((r->nframes == 1) &&
+       (r->calls != FSM_CALLS_DEFERRED)) {
+      /* the outermost table is never memoized, so the effects of its
+	 own transitions do not need to be kept */
+      r->neffects = 0;
+    }
+    if(r->nframes == 1) {
+      /* nor are the spans of the outermost table ever put back */
+      r->ncaptures = 0;
+    }
+    context = frame_context(r, r->nframes - 1);
+    FSM_TRACE(r, f, FSM_TRACE_EXIT, ret);
+
+    if(ret >= 0) {
+      /* successful sub FSM  - keep the new context and free the old one */
+      if(context != NULL) {
+	if(r->free_context != NULL) {
+	  r->free_context(*context);
+	}
+	*context = f->context_copy;
+      }
+    } else {
+      /* sub FSM failed, free the duplicated context - or undo what
+	 it did to the context, for a journaled run */
+      if(r->free_context != NULL) {
+	r->free_context(f->context_copy);
+      }
+      if(r->journal != NULL) {
+	rollback(r->journal, f->savepoint);
+      }
+    }
+    f->context_copy = NULL;
+
+    if(FSM_UNLIKELY(r->error)) {
+      /* the run can not go on, so the table below is done too,
+	 without trying anything else */
+      ret = -1;
+      continue;
+    }
+
+    if(end_transition(r, f, ret) == 0) {
+      return 0;
+    }
+
+    /* the FSM transition was a REJECT, so this table is done too */
+    ret = -1;
+  }
+}
+
+static int find_row(transition action_table[], fsm_table *pt, int state, int after, int *cursor)
+{
+  /* find the first transition leaving state that comes after row
+     number after in the table - the first candidate of a state is
+     found with after set to -1, and after a failed transition moves
+     us to its state_fail, the search continues after the failed
+     row, exactly as a walk of the whole table would */
+  int i;
+
+  if(pt == NULL) {
+    /* no index, walk the table itself */
+    for(i = after + 1; action_table[i].current_state != -1; i++) {
+      if(action_table[i].current_state == state) {
+	return i;
+      }
+    }
+    return -1;
+  }
+
+  if(state >= pt->nstates) {
+    return -1;
+  }
+
+  for(i = pt->first[state]; i < pt->first[state+1]; i++) {
+    if(pt->rows[i] > after) {
+      *cursor = i;
+      return pt->rows[i];
+    }
+  }
+
+  return -1;
+}
+
+static int next_row(transition action_table[], fsm_table *pt, int state, int row, int *cursor)
+{
+  /* find the transition leaving state after row, where row was the
+     last one returned by find_row or next_row */
+  if(pt == NULL) {
+    return find_row(action_table, pt, state, row, cursor);
+  }
+
+  (*cursor)++;
+  if(*cursor < pt->first[state+1]) {
+    return pt->rows[*cursor];
+  }
+
+  return -1;
+}
+
+static const fsm_row *frame_row(fsm_frame *f, fsm_row *scratch)
+{
+  /* the hot part of the frame's current row - a table that was not
+     prepared has it made on the spot, in scratch */
+  if(f->pt != NULL) {
+    return &f->pt->hot[f->cursor];
+  }
+
+  compact_row(&f->table[f->row], scratch);
+  return scratch;
+}
+
+static void compact_row(transition *trans, fsm_row *row)
+{
+  /* fill in the hot part of a transition, apart from the arg of its
+     match, which only a prepared table has */
+  row->match = INVALID;
+  row->type = trans->type;
+  row->flags = (trans->transfn != NULL) ? FSM_ROW_TRANSFN : 0;
+  if(trans->capture > 0) {
+    row->flags |= FSM_ROW_CAPTURE;
+  }
+  row->first = 0;
+  row->pass = trans->state_pass;
+  row->fail = trans->state_fail;
+  row->arg = 0;
+
+  switch(trans->match_type) {
+  case EXACT_STR:
+    if(trans->str != NULL) {
+      row->match = EXACT_STR;
+      row->first = trans->str[0];
+    }
+    break;
+
+  case SINGLE_CHR:
+    if(trans->str != NULL) {
+      row->match = SINGLE_CHR;
+    }
+    break;
+
+  case SUBFSM:
+    if(trans->transition_table != NULL) {
+      row->match = SUBFSM;
+    }
+    break;
+
+  case FUNC:
+    if((trans->action != NULL) ||
+       (trans->action_n != NULL)) {
+      row->match = FUNC;
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void add_effect(fsm_run *r, transition *trans, int kind, char *data, int nbytes)
+{
+  /* note something a transition is doing to the context or the
+     spans, so that the
+     memo entries of the sub-FSMs it is in can do it again, or so that
+     it can be done later if calls are deferred */
+  fsm_effect *effect;
+
+  if((r->calls != FSM_CALLS_DEFERRED) &&
+     ((r->memo.limit == 0) ||
+      (r->nframes == 1))) {
+    return;
+  }
+
+  if(r->neffects == r->maxeffects) {
+    int maxeffects = (r->maxeffects == 0) ? 64 : r->maxeffects * 2;
+    fsm_effect *effects = realloc(r->effects, maxeffects * sizeof(fsm_effect));
+    if(effects == NULL) {
+      /* without the effects, the memo would be wrong - stop using it,
+	 and deferred calls would go missing - fail the run */
+      r->memo.limit = 0;
+      if(r->calls == FSM_CALLS_DEFERRED) {
+	r->error = 1;
+      }
+      return;
+    }
+    r->effects = effects;
+    r->maxeffects = maxeffects;
+  }
+
+  effect = &r->effects[r->neffects++];
+  effect->trans = trans;
+  effect->kind = kind;
+  effect->offset = (data - r->origin) + r->dropped;
+  effect->nbytes = nbytes;
+}
+
+static void set_capture(fsm_run *r, transition *trans, char *data, int nbytes)
+{
+  /* record the nbytes bytes at data in the capture slot of trans -
+     noting down what the slot held first, the first time a sub-FSM
+     changes it, so that it can be put back if the sub-FSM fails */
+  int slot = trans->capture - 1;
+  fsm_span *span;
+  int i;
+
+  if(slot >= r->nspans) {
+    return;
+  }
+  span = &r->spans[slot];
+
+  if(r->nframes > 1) {
+    for(i = r->frames[r->nframes - 1].captures_start; i < r->ncaptures; i++) {
+      if(r->captures[i].slot == slot) {
+	break;
+      }
+    }
+    if(i == r->ncaptures) {
+      if(r->ncaptures == r->maxcaptures) {
+	int maxcaptures = r->maxcaptures * 2;
+	fsm_capture *captures;
+
+	if(r->captures == r->capture_stack) {
+	  captures = malloc(maxcaptures * sizeof(fsm_capture));
+	  if(captures != NULL) {
+	    memcpy(captures, r->capture_stack, sizeof(r->capture_stack));
+	  }
+	} else {
+	  captures = realloc(r->captures, maxcaptures * sizeof(fsm_capture));
+	}
+	if(captures == NULL) {
+	  /* the span could not be put back, so the run can not go on */
+	  r->error = 1;
+	  return;
+	}
+	r->captures = captures;
+	r->maxcaptures = maxcaptures;
+      }
+      r->captures[r->ncaptures].slot = slot;
+      r->captures[r->ncaptures].old = *span;
+      r->ncaptures++;
+    }
+  }
+
+  span->offset = (data - r->origin) + r->dropped;
+  span->length = nbytes;
+}
+
+#define MEMO_HASH(pt, offset) ((((size_t)(pt) >> 4) * 31) ^ ((offset) * 2654435761u))
+
+static fsm_memo_entry *find_memo(fsm_memo *m, fsm_table *pt, size_t offset)
+{
+  /* find what the table did when it was run from offset, or NULL if
+     it has not been run from there */
+  size_t i;
+
+  if(m->entries == NULL) {
+    return NULL;
+  }
+
+  for(i = MEMO_HASH(pt, offset) & (m->size - 1);
+      m->entries[i].table != NULL;
+      i = (i + 1) & (m->size - 1)) {
+    if((m->entries[i].table == pt) &&
+       (m->entries[i].offset == offset)) {
+      return &m->entries[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void add_memo(fsm_run *r, fsm_table *pt, size_t offset, int nbytes_processed, int effects_start)
+{
+  /* remember that the table returned nbytes_processed when it was run
+     from offset - along with the effects of its transitions, which
+     are the run's effects from effects_start on. nothing is
+     remembered once the memo is full */
+  fsm_memo *m = &r->memo;
+  fsm_memo_entry *e;
+  fsm_effect *effects = NULL;
+  int neffects = (nbytes_processed >= 0) ? r->neffects - effects_start : 0;
+  size_t i;
+
+  if(m->count * 2 >= m->size) {
+    /* make the hash table bigger first */
+    int size = (m->size == 0) ? 64 : m->size * 2;
+    fsm_memo_entry *entries;
+    int j;
+
+    if(m->bytes + size * sizeof(fsm_memo_entry) > m->limit) {
+      return;
+    }
+    entries = calloc(size, sizeof(fsm_memo_entry));
+    if(entries == NULL) {
+      return;
+    }
+    for(j = 0; j < m->size; j++) {
+      if(m->entries[j].table != NULL) {
+	for(i = MEMO_HASH(m->entries[j].table, m->entries[j].offset) & (size - 1);
+	    entries[i].table != NULL;
+	    i = (i + 1) & (size - 1)) {
+	}
+	entries[i] = m->entries[j];
+      }
+    }
+    free(m->entries);
+    m->bytes += (size - m->size) * sizeof(fsm_memo_entry);
+    m->entries = entries;
+    m->size = size;
+  }
+
+  if(neffects > 0) {
+    /* the effects are copied into the arena */
+    fsm_chunk *chunk = m->chunks;
+
+    if((chunk == NULL) ||
+       (chunk->used + neffects > chunk->size)) {
+      int size = (neffects > 1024) ? neffects : 1024;
+      size_t bytes = sizeof(fsm_chunk) + (size - 1) * sizeof(fsm_effect);
+
+      if(m->bytes + bytes > m->limit) {
+	return;
+      }
+      chunk = malloc(bytes);
+      if(chunk == NULL) {
+	return;
+      }
+      chunk->next = m->chunks;
+      chunk->used = 0;
+      chunk->size = size;
+      m->chunks = chunk;
+      m->bytes += bytes;
+    }
+
+    effects = &chunk->effects[chunk->used];
+    chunk->used += neffects;
+    memcpy(effects, &r->effects[effects_start], neffects * sizeof(fsm_effect));
+  }
+
+  for(i = MEMO_HASH(pt, offset) & (m->size - 1);
+      m->entries[i].table != NULL;
+      i = (i + 1) & (m->size - 1)) {
+    if((m->entries[i].table == pt) &&
+       (m->entries[i].offset == offset)) {
+      break;
+    }
+  }
+
+  e = &m->entries[i];
+  if(e->table == NULL) {
+    m->count++;
+  }
+  e->table = pt;
+  e->offset = offset;
+  e->nbytes_processed = nbytes_processed;
+  e->neffects = neffects;
+  e->effects = effects;
+}
+
+static void replay_memo(fsm_run *r, fsm_memo_entry *e, void *context)
+{
+  /* do to context what running the table of e did to its copy of the
+     context - call the same functions, in the same order, on the
+     same data */
+  int i;
+
+  for(i = 0; i < e->neffects; i++) {
+    fsm_effect *effect = &e->effects[i];
+    transition *trans = effect->trans;
+    char *data = r->origin + (effect->offset - r->dropped);
+
+    add_effect(r, trans, effect->kind, data, effect->nbytes);
+
+    if(effect->kind == FSM_EFFECT_TRANSFN) {
+      if(r->calls == FSM_CALLS_NOW) {
+	trans->transfn(&data, effect->nbytes, context, trans->local_context);
+      }
+    } else if(effect->kind == FSM_EFFECT_CAPTURE) {
+      set_capture(r, trans, data, effect->nbytes);
+    } else if(trans->action_n != NULL) {
+      trans->action_n(&data, r->end, context, trans->local_context);
+    } else {
+      trans->action(&data, context, trans->local_context);
+    }
+  }
+}
+
+fsm_journal *fsm_journal_new(void)
+{
+  return calloc(1, sizeof(fsm_journal));
+}
+
+void fsm_journal_free(fsm_journal *j)
+{
+  if(j == NULL) {
+    return;
+  }
+
+  free(j->log);
+  free(j);
+}
+
+int fsm_journal_save(fsm_journal *j, void *address, size_t size)
+{
+  fsm_journal_entry entry;
+  size_t need = size + sizeof(fsm_journal_entry);
+
+  if(j == NULL) {
+    /* not a journaled run, nothing to do */
+    return 0;
+  }
+
+  if(j->used + need > j->size) {
+    size_t grown = (j->size == 0) ? 256 : j->size;
+    unsigned char *log;
+
+    while(j->used + need > grown) {
+      grown *= 2;
+    }
+    log = realloc(j->log, grown);
+    if(log == NULL) {
+      return -1;
+    }
+    j->log = log;
+    j->size = grown;
+  }
+
+  entry.address = address;
+  entry.size = size;
+  memcpy(j->log + j->used, address, size);
+  memcpy(j->log + j->used + size, &entry, sizeof(fsm_journal_entry));
+  j->used += need;
+
+  return 0;
+}
+
+size_t fsm_journal_mark(fsm_journal *j)
+{
+  return (j == NULL) ? 0 : j->used;
+}
+
+void fsm_journal_rollback(fsm_journal *j, size_t mark)
+{
+  if(j != NULL) {
+    rollback(j, mark);
+  }
+}
+
+void fsm_journal_commit(fsm_journal *j, size_t mark)
+{
+  if((j != NULL) &&
+     (j->used > mark)) {
+    j->used = mark;
+  }
+}
+
+static void rollback(fsm_journal *j, size_t savepoint)
+{
+  /* put back everything saved since savepoint, newest first */
+  fsm_journal_entry entry;
+
+  while(j->used > savepoint) {
+    memcpy(&entry, j->log + j->used - sizeof(fsm_journal_entry), sizeof(fsm_journal_entry));
+    j->used -= sizeof(fsm_journal_entry) + entry.size;
+    memcpy(entry.address, j->log + j->used, entry.size);
+  }
+}
+
+fsm_stream *fsm_stream_new(transition action_table[], void **context, dup_fn dup_context, free_fn free_context)
+{
+  return new_stream(action_table, NULL, context, dup_context, free_context);
+}
+
+fsm_stream *fsm_stream_new_prepared(fsm *f, void **context, dup_fn dup_context, free_fn free_context)
+{
+  if(f == NULL) {
+    return NULL;
+  }
+
+  return new_stream(f->root->table, f, context, dup_context, free_context);
+}
+
+static fsm_stream *new_stream(transition action_table[], fsm *f, void **context, dup_fn dup_context, free_fn free_context)
+{
+  fsm_stream *s;
+
+  if(action_table == NULL) {
+    return NULL;
+  }
+
+  s = calloc(1, sizeof(fsm_stream));
+  if(s == NULL) {
+    return NULL;
+  }
+
+  s->size = 256;
+  s->buffer = malloc(s->size);
+  if(s->buffer == NULL) {
+    free(s);
+    return NULL;
+  }
+  s->buffer[0] = '\0';
+  s->result = FSM_MORE;
+
+  start_run(&s->run, action_table, f, s->buffer, s->buffer, context, dup_context, free_context);
+  s->run.more = 1;
+
+  return s;
+}
+
+int fsm_stream_feed(fsm_stream *s, char *data, size_t length)
+{
+  size_t keep;
+  size_t used;
+  int i;
+
+  if((s == NULL) ||
+     ((data == NULL) && (length > 0))) {
+    return -1;
+  }
+
+  if(s->result != FSM_MORE) {
+    /* the machine has already finished */
+    return s->result;
+  }
+
+  /* the outermost table never goes back before where it is up to, so
+     the bytes before that can go - everything from there on may
+     still be needed, by a transition that is not finished yet or by
+     an alternative if it fails */
+  keep = s->run.frames[0].data - s->buffer;
+  if(s->run.neffects > 0) {
+    /* deferred calls still to be made need their data too */
+    size_t first = s->run.effects[0].offset - s->dropped;
+    if(first < keep) {
+      keep = first;
+    }
+  }
+  used = s->length - keep;
+
+  if(used + length + 1 > s->size) {
+    size_t size = s->size;
+    char *buffer;
+
+    while(used + length + 1 > size) {
+      size *= 2;
+    }
+    buffer = malloc(size);
+    if(buffer == NULL) {
+      return -1;
+    }
+    memcpy(buffer, s->buffer + keep, used);
+    for(i = 0; i < s->run.nframes; i++) {
+      s->run.frames[i].data = buffer + (s->run.frames[i].data - (s->buffer + keep));
+    }
+    free(s->buffer);
+    s->buffer = buffer;
+    s->size = size;
+  } else if(keep > 0) {
+    memmove(s->buffer, s->buffer + keep, used);
+    for(i = 0; i < s->run.nframes; i++) {
+      s->run.frames[i].data -= keep;
+    }
+  }
+
+  s->dropped += keep;
+  s->run.origin = s->buffer;
+  s->run.dropped = s->dropped;
+  memcpy(s->buffer + used, data, length);
+  s->length = used + length;
+  s->buffer[s->length] = '\0';
+  s->run.end = s->buffer + s->length;
+  s->run.trace = thread_trace;
+  s->run.profile = thread_profile;
+
+  s->result = run_table(&s->run);
+  if(s->result != FSM_MORE) {
+    s->result = commit_run(&s->run, s->result);
+  }
+  return s->result;
+}
+
+int fsm_stream_finish(fsm_stream *s)
+{
+  if(s == NULL) {
+    return -1;
+  }
+
+  if(s->result == FSM_MORE) {
+    /* no more data is coming, so whatever was waiting for it fails */
+    s->run.more = 0;
+    s->run.trace = thread_trace;
+    s->run.profile = thread_profile;
+    s->result = commit_run(&s->run, run_table(&s->run));
+  }
+
+  return s->result;
+}
+
+void fsm_stream_free(fsm_stream *s)
+{
+  int i;
+
+  if(s == NULL) {
+    return;
+  }
+
+  /* a machine stopped part way through still holds the copies of the
+     context made for the sub-FSMs it was in */
+  if((s->result == FSM_MORE) &&
+     (s->run.dup_context != NULL) &&
+     (s->run.free_context != NULL)) {
+    for(i = 0; i < s->run.nframes - 1; i++) {
+      if(s->run.frames[i].context_copy != NULL) {
+	s->run.free_context(s->run.frames[i].context_copy);
+      }
+    }
+  }
+
+  end_run(&s->run);
+  free(s->buffer);
+  free(s);
+}
+
+fsm_trace *fsm_trace_new(size_t nevents)
+{
+  fsm_trace *t;
+  size_t size = 1;
+
+  while(size < nevents) {
+    size *= 2;
+  }
+
+  t = malloc(sizeof(fsm_trace));
+  if(t == NULL) {
+    return NULL;
+  }
+  t->events = malloc(size * sizeof(fsm_trace_event));
+  if(t->events == NULL) {
+    free(t);
+    return NULL;
+  }
+  t->mask = size - 1;
+  t->next = 0;
+
+  return t;
+}
+
+void fsm_trace_free(fsm_trace *t)
+{
+  if(t == NULL) {
+    return;
+  }
+
+  if(thread_trace == t) {
+    thread_trace = NULL;
+  }
+  free(t->events);
+  free(t);
+}
+
+void fsm_trace_start(fsm_trace *t)
+{
+  thread_trace = t;
+}
+
+void fsm_trace_stop(void)
+{
+  thread_trace = NULL;
+}
+
+size_t fsm_trace_read(fsm_trace *t, fsm_trace_event events[], size_t max)
+{
+  /* copy the newest events out of the ring - without stopping the
+     thread writing them, which may write over some of them while
+     they are being copied. those are the oldest ones copied, and
+     next says how many of them there are */
+  size_t next, first, n, i;
+
+  if((t == NULL) ||
+     (events == NULL)) {
+    return 0;
+  }
+
+  next = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE);
+  n = (next > t->mask + 1) ? t->mask + 1 : next;
+  if(n > max) {
+    n = max;
+  }
+  first = next - n;
+
+  for(i = 0; i < n; i++) {
+    events[i] = t->events[(first + i) & t->mask];
+  }
+
+  /* an event is gone once the writer has started on the event a
+     whole ring after it */
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  next = __atomic_load_n(&t->next, __ATOMIC_RELAXED);
+  if(next - first > t->mask) {
+    size_t lost = next - first - t->mask;
+    if(lost >= n) {
+      return 0;
+    }
+    memmove(events, events + lost, (n - lost) * sizeof(fsm_trace_event));
+    n -= lost;
+  }
+
+  return n;
+}
+
+fsm_profile *fsm_profile_new(void)
+{
+  fsm_profile *p;
+
+  p = malloc(sizeof(fsm_profile));
+  if(p == NULL) {
+    return NULL;
+  }
+  p->mask = 15;
+  p->count = 0;
+  p->entries = calloc(p->mask + 1, sizeof(fsm_profile_entry*));
+  if(p->entries == NULL) {
+    free(p);
+    return NULL;
+  }
+
+  return p;
+}
+
+void fsm_profile_free(fsm_profile *p)
+{
+  size_t i;
+
+  if(p == NULL) {
+    return;
+  }
+
+  if(thread_profile == p) {
+    thread_profile = NULL;
+  }
+  for(i = 0; i <= p->mask; i++) {
+    if(p->entries[i] != NULL) {
+      free(p->entries[i]->rows);
+      free(p->entries[i]);
+    }
+  }
+  free(p->entries);
+  free(p);
+}
+
+void fsm_profile_start(fsm_profile *p)
+{
+  thread_profile = p;
+}
+
+void fsm_profile_stop(void)
+{
+  thread_profile = NULL;
+}
+
+int fsm_profile_merge(fsm_profile *into, fsm_profile *from)
+{
+  size_t i;
+  int j;
+
+  if((into == NULL) ||
+     (from == NULL)) {
+    return -1;
+  }
+
+  for(i = 0; i <= from->mask; i++) {
+    fsm_profile_entry *src = from->entries[i];
+    fsm_profile_entry *dst;
+
+    if(src == NULL) {
+      continue;
+    }
+    dst = profile_entry(into, src->table);
+    if(dst == NULL) {
+      return -1;
+    }
+    dst->runs += src->runs;
+    dst->inclusive += src->inclusive;
+    dst->exclusive += src->exclusive;
+    for(j = 0; j < src->nrows; j++) {
+      dst->rows[j].attempts += src->rows[j].attempts;
+      dst->rows[j].matches += src->rows[j].matches;
+      dst->rows[j].bytes += src->rows[j].bytes;
+    }
+  }
+
+  return 0;
+}
+
+size_t fsm_profile_rows(fsm_profile *p, fsm_profile_row rows[], size_t max)
+{
+  size_t i, n = 0;
+  int j;
+
+  if(p == NULL) {
+    return 0;
+  }
+
+  for(i = 0; i <= p->mask; i++) {
+    fsm_profile_entry *e = p->entries[i];
+
+    if(e == NULL) {
+      continue;
+    }
+    for(j = 0; j < e->nrows; j++) {
+      if(e->rows[j].attempts == 0) {
+	continue;
+      }
+      if((rows != NULL) &&
+	 (n < max)) {
+	rows[n].table = e->table;
+	rows[n].row = j;
+	rows[n].attempts = e->rows[j].attempts;
+	rows[n].matches = e->rows[j].matches;
+	rows[n].bytes = e->rows[j].bytes;
+      }
+      n++;
+    }
+  }
+
+  return n;
+}
+
+size_t fsm_profile_tables(fsm_profile *p, fsm_profile_table tables[], size_t max)
+{
+  size_t i, n = 0;
+
+  if(p == NULL) {
+    return 0;
+  }
+
+  for(i = 0; i <= p->mask; i++) {
+    fsm_profile_entry *e = p->entries[i];
+
+    if((e == NULL) ||
+       (e->runs == 0)) {
+      continue;
+    }
+    if((tables != NULL) &&
+       (n < max)) {
+      tables[n].table = e->table;
+      tables[n].runs = e->runs;
+      tables[n].inclusive = e->inclusive;
+      tables[n].exclusive = e->exclusive;
+    }
+    n++;
+  }
+
+  return n;
+}
+
+fsm *fsm_prepare(transition action_table[])
+{
+  fsm *f;
+
+  if(action_table == NULL) {
+    return NULL;
+  }
+
+  f = calloc(1, sizeof(fsm));
+  if(f == NULL) {
+    return NULL;
+  }
+
+  f->root = prepare_table(f, action_table);
+  if((f->root == NULL) ||
+     (prepare_starts(f) != 0)) {
+    /* part of the machine could not be prepared - throw away
+       whatever was */
+    fsm_free(f);
+    return NULL;
+  }
+
+  return f;
+}
+
+void fsm_free(fsm *f)
+{
+  int i;
+
+  if(f == NULL) {
+    return;
+  }
+
+  for(i = 0; i < f->ntables; i++) {
+    free_table(f->tables[i]);
+  }
+  free(f->tables);
+  free(f);
+}
+
+void fsm_memoize(fsm *f, size_t max_bytes)
+{
+  if(f != NULL) {
+    f->memo_limit = max_bytes;
+  }
+}
+
+void fsm_defer_calls(fsm *f, enum fsm_calls calls)
+{
+  if(f != NULL) {
+    f->calls = calls;
+  }
+}
+
+void fsm_max_depth(fsm *f, int max_depth)
+{
+  if((f != NULL) &&
+     (max_depth >= 0)) {
+    f->max_depth = max_depth;
+  }
+}
+
+int fsm_reorder(fsm *f, fsm_profile *p)
+{
+  fsm_lookahead *tables;
+  int *reached;
+  int most = 1;
+  int changed = 1;
+  int reordered = 0;
+  int t;
+
+  if((f == NULL) ||
+     (p == NULL)) {
+    return -1;
+  }
+
+  for(t = 0; t < f->ntables; t++) {
+    if(f->tables[t]->nstates > most) {
+      most = f->tables[t]->nstates;
+    }
+  }
+  tables = malloc(f->ntables * sizeof(fsm_lookahead));
+  reached = malloc(most * sizeof(int));
+  if((tables == NULL) ||
+     (reached == NULL)) {
+    free(tables);
+    free(reached);
+    return -1;
+  }
+
+  /* work out what each table reads first. tables use each other, and
+     themselves, so start by assuming each could read anything, and
+     narrow that down until nothing changes, as prepare_starts does */
+  for(t = 0; t < f->ntables; t++) {
+    memset(tables[t].bytes, 0xff, sizeof(tables[t].bytes));
+    tables[t].least = 0;
+    tables[t].most = FSM_LOOKAHEAD;
+  }
+  while(changed) {
+    changed = 0;
+    for(t = 0; t < f->ntables; t++) {
+      fsm_lookahead table;
+      table_lookahead(f, f->tables[t], tables, reached, &table);
+      if(memcmp(&table, &tables[t], sizeof(fsm_lookahead)) != 0) {
+	tables[t] = table;
+	changed = 1;
+      }
+    }
+  }
+
+  for(t = 0; t < f->ntables; t++) {
+    fsm_table *pt = f->tables[t];
+    int n = reorder_table(f, pt, tables, find_profile(p, pt->table));
+    if(n > 0) {
+      /* which rows come first has changed, and so may the runs of
+	 bytes that can be skipped */
+      memset(pt->skip, 0, pt->nstates * sizeof(fsm_skip));
+      prepare_skips(pt, 0);
+      reordered += n;
+    }
+  }
+
+  free(tables);
+  free(reached);
+  return reordered;
+}
+
+static fsm_table *prepare_table(fsm *f, transition action_table[])
+{
+  fsm_table *pt;
+  fsm_table **tables;
+  int nrows, nslots, nsets, nsubs;
+  int i;
+
+  /* a table used from several places (or from itself) is only
+     prepared once */
+  for(i = 0; i < f->ntables; i++) {
+    if(f->tables[i]->table == action_table) {
+      return f->tables[i];
+    }
+  }
+
+  pt = calloc(1, sizeof(fsm_table));
+  if(pt == NULL) {
+    return NULL;
+  }
+  pt->table = action_table;
+
+  /* keep track of the table before preparing its sub-FSMs, so that a
+     table which refers to itself finds its own entry */
+  tables = realloc(f->tables, (f->ntables + 1) * sizeof(fsm_table*));
+  if(tables == NULL) {
+    free(pt);
+    return NULL;
+  }
+  f->tables = tables;
+  f->tables[f->ntables++] = pt;
+
+  for(nrows = 0; action_table[nrows].current_state != -1; nrows++) {
+    if(action_table[nrows].current_state >= pt->nstates) {
+      pt->nstates = action_table[nrows].current_state + 1;
+    }
+  }
+
+  pt->first = calloc(pt->nstates + 1, sizeof(int));
+  pt->rows = malloc((nrows + 1) * sizeof(int));
+  pt->hot = calloc(nrows + 1, sizeof(fsm_row));
+  if((pt->first == NULL) ||
+     (pt->rows == NULL) ||
+     (pt->hot == NULL)) {
+    return NULL;
+  }
+
+  /* count the transitions leaving each state, turn the counts into
+     offsets, then drop every row into its state's slot - walking the
+     table in order keeps the transitions of a state in table order,
+     which is the order they have to be tried in */
+  for(i = 0; i < nrows; i++) {
+    if(action_table[i].current_state >= 0) {
+      pt->first[action_table[i].current_state + 1]++;
+    }
+  }
+  for(i = 0; i < pt->nstates; i++) {
+    pt->first[i+1] += pt->first[i];
+  }
+  {
+    int *fill = calloc(pt->nstates + 1, sizeof(int));
+    if(fill == NULL) {
+      return NULL;
+    }
+    for(i = 0; i < nrows; i++) {
+      int state = action_table[i].current_state;
+      if(state >= 0) {
+	pt->rows[pt->first[state] + fill[state]++] = i;
+      }
+    }
+    free(fill);
+  }
+  nslots = pt->first[pt->nstates];
+
+  /* fill in the hot part of every row, in state order. the sets of
+     SINGLE_CHR rows and the prepared tables of SUBFSM rows go into
+     arrays of their own, and the strings of EXACT_STR rows are
+     measured, so that running the table does not have to look at
+     the strings character by character */
+  nsets = 0;
+  nsubs = 0;
+  for(i = 0; i < nslots; i++) {
+    compact_row(&action_table[pt->rows[i]], &pt->hot[i]);
+    if(pt->hot[i].match == SINGLE_CHR) {
+      pt->hot[i].arg = nsets++;
+    } else if(pt->hot[i].match == SUBFSM) {
+      pt->hot[i].arg = nsubs++;
+    } else if(pt->hot[i].match == EXACT_STR) {
+      pt->hot[i].arg = strlen(action_table[pt->rows[i]].str);
+    } else if((pt->hot[i].match == FUNC) &&
+	      (action_table[pt->rows[i]].starts != NULL)) {
+      pt->hot[i].flags |= FSM_ROW_STARTS;
+      pt->hot[i].arg = nsets++;
+    }
+  }
+
+  pt->sets = calloc(nsets + 1, sizeof(charset));
+  pt->subs = calloc(nsubs + 1, sizeof(fsm_table*));
+  if((pt->sets == NULL) ||
+     (pt->subs == NULL)) {
+    return NULL;
+  }
+
+  for(i = 0; i < nslots; i++) {
+    char *c = NULL;
+    if(pt->hot[i].match == SINGLE_CHR) {
+      c = action_table[pt->rows[i]].str;
+    } else if(pt->hot[i].flags & FSM_ROW_STARTS) {
+      c = action_table[pt->rows[i]].starts;
+    }
+    for(; (c != NULL) && (*c != '\0'); c++) {
+      CHARSET_ADD(pt->sets[pt->hot[i].arg], *c);
+    }
+  }
+
+  /* and prepare every table this one can transition into */
+  for(i = 0; i < nslots; i++) {
+    if(pt->hot[i].match == SUBFSM) {
+      fsm_table *sub = prepare_table(f, action_table[pt->rows[i]].transition_table);
+      if(sub == NULL) {
+	return NULL;
+      }
+      pt->subs[pt->hot[i].arg] = sub;
+    }
+  }
+
+  /* a table that only ever matches one byte of a class can stand in
+     for the class wherever it is used. the rows have to be tried in
+     state 0, all end the table in an ACCEPT state, and do nothing
+     else - then whichever row matches, the table accepts that one
+     byte, and if none does it fails. a table still being prepared
+     (because it refers back to this one) is never a class, which
+     keeps this from going round in circles */
+  pt->is_class = (nrows > 0) && (nslots == nrows) && (pt->nstates == 1);
+  for(i = 0; (i < nslots) && pt->is_class; i++) {
+    charset chars;
+    int c;
+    if((pt->hot[i].pass >= 0) ||
+       (pt->hot[i].fail >= 0) ||
+       (pt->hot[i].type != ACCEPT) ||
+       (pt->hot[i].flags & (FSM_ROW_TRANSFN | FSM_ROW_CAPTURE)) ||
+       !row_class(pt, i, chars)) {
+      pt->is_class = 0;
+      break;
+    }
+    for(c = 0; c < 32; c++) {
+      pt->class_chars[c] |= chars[c];
+    }
+  }
+
+  pt->skip = calloc(pt->nstates, sizeof(fsm_skip));
+  if((pt->skip == NULL) &&
+     (pt->nstates > 0)) {
+    return NULL;
+  }
+  prepare_skips(pt, nrows);
+
+  return pt;
+}
+
+static int row_class(fsm_table *pt, int slot, charset chars)
+{
+  /* if the row in hot[slot] matches exactly one byte, and which byte
+     it is only depends on the byte, put the bytes it matches in chars
+     and return 1, otherwise return 0 */
+  fsm_row *row = &pt->hot[slot];
+
+  memset(chars, 0, sizeof(charset));
+  switch(row->match) {
+  case SINGLE_CHR:
+    memcpy(chars, pt->sets[row->arg], sizeof(charset));
+    return 1;
+
+  case EXACT_STR:
+    if(row->arg != 1) {
+      return 0;
+    }
+    CHARSET_ADD(chars, row->first);
+    return 1;
+
+  case SUBFSM:
+    if(!pt->subs[row->arg]->is_class) {
+      return 0;
+    }
+    memcpy(chars, pt->subs[row->arg]->class_chars, sizeof(charset));
+    return 1;
+
+  default:
+    return 0;
+  }
+}
+
+static void prepare_skips(fsm_table *pt, int nrows)
+{
+  /* find the states that can skip runs of bytes. the rows of a state
+     are tried in order, so a byte takes the looping row only if no
+     row before it takes the byte - and every row before it has to be
+     a class too, and must not move to another state when it fails,
+     or what happens to the byte would depend on more than the byte */
+  int state, i, c;
+
+  for(state = 0; state < pt->nstates; state++) {
+    fsm_skip *skip = &pt->skip[state];
+    charset taken;
+
+    skip->row = -1;
+    memset(taken, 0, sizeof(charset));
+
+    for(i = pt->first[state]; i < pt->first[state+1]; i++) {
+      fsm_row *row = &pt->hot[i];
+      charset chars;
+
+      if((row->fail >= 0) ||
+	 !row_class(pt, i, chars)) {
+	break;
+      }
+
+      if((row->pass == state) &&
+	 (row->type != REJECT) &&
+	 !(row->flags & (FSM_ROW_TRANSFN | FSM_ROW_CAPTURE))) {
+	int empty = 1;
+	for(c = 0; c < 32; c++) {
+	  skip->chars[c] = chars[c] & ~taken[c];
+	  empty = empty && (skip->chars[c] == 0);
+	}
+	if(!empty) {
+	  skip->row = pt->rows[i];
+	}
+	break;
+      }
+
+      for(c = 0; c < 32; c++) {
+	taken[c] |= chars[c];
+      }
+    }
+
+    if(skip->row < 0) {
+      continue;
+    }
+
+    /* and the class as ranges, if there are few enough of them */
+    skip->nranges = 0;
+    for(c = 0; c < 256; c++) {
+      if(CHARSET_HAS(skip->chars, c) &&
+	 ((c == 0) || !CHARSET_HAS(skip->chars, c - 1))) {
+	int hi = c;
+	while((hi < 255) && CHARSET_HAS(skip->chars, hi + 1)) {
+	  hi++;
+	}
+	if(skip->nranges == FSM_SKIP_RANGES) {
+	  skip->nranges = 0;
+	  break;
+	}
+	skip->lo[skip->nranges] = c;
+	skip->hi[skip->nranges] = hi;
+	skip->nranges++;
+      }
+    }
+  }
+}
+
+#if defined(__GNUC__)
+__attribute__((no_sanitize_address))
+#endif
+static int prepare_starts(fsm *f)
+{
+  /* work out the bytes each table can start with, and whether it is
+     nullable. tables use each other, and themselves, so start by
+     assuming each can start with anything, and narrow that down
+     until nothing changes - a table that can only get going by
+     running itself (which no data gets it past) keeps assuming the
+     worst. returns -1 if it ran out of memory */
+  int *reached = NULL;
+  int *todo = NULL;
+  int most = 1;
+  int changed = 1;
+  int t, i;
+
+  for(t = 0; t < f->ntables; t++) {
+    memset(f->tables[t]->starts, 0xff, sizeof(charset));
+    f->tables[t]->nullable = 1;
+    if(f->tables[t]->nstates > most) {
+      most = f->tables[t]->nstates;
+    }
+  }
+
+  reached = malloc(most * sizeof(int));
+  todo = malloc(most * sizeof(int));
+  if((reached == NULL) ||
+     (todo == NULL)) {
+    free(reached);
+    free(todo);
+    return -1;
+  }
+
+  while(changed) {
+    changed = 0;
+    for(t = 0; t < f->ntables; t++) {
+      fsm_table *pt = f->tables[t];
+      charset starts;
+      int nullable = 0;
+      int ntodo = 0;
+      int c;
+
+      memset(starts, 0, sizeof(charset));
+      memset(reached, 0, pt->nstates * sizeof(int));
+
+      /* only the rows that can be tried before a byte is read
+	 matter - those of state 0, and of every state a row gets to
+	 by failing, or by matching without reading anything */
+      if(pt->nstates > 0) {
+	reached[0] = 1;
+	todo[ntodo++] = 0;
+      }
+      while((ntodo > 0) && !nullable) {
+	int state = todo[--ntodo];
+
+	for(i = pt->first[state]; i < pt->first[state+1]; i++) {
+	  fsm_row *row = &pt->hot[i];
+	  int empty = 0;
+
+	  switch(row->match) {
+	  case EXACT_STR:
+	    if(row->arg == 0) {
+	      empty = 1;
+	    } else {
+	      CHARSET_ADD(starts, row->first);
+	    }
+	    break;
+
+	  case SINGLE_CHR:
+	    for(c = 0; c < 32; c++) {
+	      starts[c] |= pt->sets[row->arg][c];
+	    }
+	    break;
+
+	  case SUBFSM:
+	    for(c = 0; c < 32; c++) {
+	      starts[c] |= pt->subs[row->arg]->starts[c];
+	    }
+	    /* whatever the sub-FSM does without reading a byte, this
+	       table does too */
+	    nullable |= pt->subs[row->arg]->nullable;
+	    break;
+
+	  case FUNC:
+	    if(row->flags & FSM_ROW_STARTS) {
+	      for(c = 0; c < 32; c++) {
+		starts[c] |= pt->sets[row->arg][c];
+	      }
+	    } else {
+	      /* the function could do anything */
+	      nullable = 1;
+	    }
+	    break;
+
+	  default:
+	    break;
+	  }
+
+	  if(empty &&
+	     ((row->type == ACCEPT) ||
+	      (row->flags & (FSM_ROW_TRANSFN | FSM_ROW_CAPTURE)))) {
+	    nullable = 1;
+	  }
+	  if(empty &&
+	     (row->pass >= 0) &&
+	     (row->pass < pt->nstates) &&
+	     !reached[row->pass]) {
+	    reached[row->pass] = 1;
+	    todo[ntodo++] = row->pass;
+	  }
+	  if((row->fail >= 0) &&
+	     (row->fail < pt->nstates) &&
+	     !reached[row->fail]) {
+	    reached[row->fail] = 1;
+	    todo[ntodo++] = row->fail;
+	  }
+	}
+      }
+
+      if(nullable) {
+	/* then what it starts with does not matter */
+	memset(starts, 0xff, sizeof(charset));
+      }
+      if((nullable != pt->nullable) ||
+	 (memcmp(starts, pt->starts, sizeof(charset)) != 0)) {
+	memcpy(pt->starts, starts, sizeof(charset));
+	pt->nullable = nullable;
+	changed = 1;
+      }
+    }
+  }
+
+  free(reached);
+  free(todo);
+  return 0;
+}
+
+static int cannot_start(fsm_run *r, fsm_frame *f, charset starts)
+{
+  /* whether a row that has to start with one of starts can be turned
+     down without trying it. a traced or profiled run tries it, so
+     that every transition is in the trace, and counted */
+  if((r->trace != NULL) ||
+     (r->profile != NULL)) {
+    return 0;
+  }
+
+  if((r->end != NULL) &&
+     (f->data >= r->end)) {
+    /* there is no byte - but there may be more on its way */
+    return !r->more;
+  }
+
+  return !CHARSET_HAS(starts, *f->data);
+}
+
+static int table_number(fsm *f, fsm_table *pt)
+{
+  /* where pt is in the machine's tables */
+  int t;
+
+  for(t = 0; f->tables[t] != pt; t++) {
+  }
+  return t;
+}
+
+static void row_lookahead(fsm *f, fsm_table *pt, int slot, fsm_lookahead *tables, fsm_lookahead *row)
+{
+  /* what the row in hot[slot] reads when it matches, going by what
+     is known so far of the tables it runs */
+  fsm_row *hot = &pt->hot[slot];
+  int i;
+
+  memset(row, 0, sizeof(fsm_lookahead));
+  switch(hot->match) {
+  case EXACT_STR: {
+    char *str = pt->table[pt->rows[slot]].str;
+    for(i = 0; (i < FSM_LOOKAHEAD) && (str[i] != '\0'); i++) {
+      CHARSET_ADD(row->bytes[i], str[i]);
+    }
+    row->least = row->most = i;
+  } break;
+
+  case SINGLE_CHR:
+    memcpy(row->bytes[0], pt->sets[hot->arg], sizeof(charset));
+    row->least = row->most = 1;
+    break;
+
+  case SUBFSM:
+    *row = tables[table_number(f, pt->subs[hot->arg])];
+    break;
+
+  case FUNC:
+    /* the function could read anything, and any amount of it */
+    memset(row->bytes, 0xff, sizeof(row->bytes));
+    if(hot->flags & FSM_ROW_STARTS) {
+      memcpy(row->bytes[0], pt->sets[hot->arg], sizeof(charset));
+    }
+    row->most = FSM_LOOKAHEAD;
+    break;
+
+  default:
+    break;
+  }
+}
+
+static void table_lookahead(fsm *f, fsm_table *pt, fsm_lookahead *tables, int *reached, fsm_lookahead *out)
+{
+  /* what the table reads when it accepts. reached[state] has a bit
+     for each number of bytes (up to FSM_LOOKAHEAD) the table can have
+     read by the time it is in state - each row of the state is tried
+     there, and moves on to its state_pass having read as much again
+     as the row does, or to its state_fail having read nothing */
+  int changed = 1;
+  int state, i, o, c;
+
+  memset(out, 0, sizeof(fsm_lookahead));
+  out->least = FSM_LOOKAHEAD;
+  out->most = FSM_LOOKAHEAD;
+  if(pt->nstates == 0) {
+    return;
+  }
+  memset(reached, 0, pt->nstates * sizeof(int));
+  reached[0] = 1;
+
+  while(changed) {
+    changed = 0;
+    for(state = 0; state < pt->nstates; state++) {
+      for(i = pt->first[state]; (i < pt->first[state+1]) && (reached[state] != 0); i++) {
+	fsm_row *hot = &pt->hot[i];
+	fsm_lookahead row;
+	int pass = 0;
+
+	if((hot->fail >= 0) &&
+	   (hot->fail < pt->nstates) &&
+	   ((reached[hot->fail] | reached[state]) != reached[hot->fail])) {
+	  reached[hot->fail] |= reached[state];
+	  changed = 1;
+	}
+
+	if(hot->match == INVALID) {
+	  continue;
+	}
+	row_lookahead(f, pt, i, tables, &row);
+
+	for(o = 0; o <= FSM_LOOKAHEAD; o++) {
+	  int least, most;
+
+	  if(!(reached[state] & (1 << o))) {
+	    continue;
+	  }
+	  for(c = 0; o + c < FSM_LOOKAHEAD; c++) {
+	    int k;
+	    for(k = 0; k < 32; k++) {
+	      out->bytes[o + c][k] |= row.bytes[c][k];
+	    }
+	  }
+
+	  least = (o + row.least < FSM_LOOKAHEAD) ? o + row.least : FSM_LOOKAHEAD;
+	  most = (o + row.most < FSM_LOOKAHEAD) ? o + row.most : FSM_LOOKAHEAD;
+	  for(c = least; c <= most; c++) {
+	    pass |= 1 << c;
+	  }
+	  if((hot->type == ACCEPT) &&
+	     (least < out->least)) {
+	    out->least = least;
+	  }
+	}
+
+	if((hot->pass >= 0) &&
+	   (hot->pass < pt->nstates) &&
+	   ((reached[hot->pass] | pass) != reached[hot->pass])) {
+	  reached[hot->pass] |= pass;
+	  changed = 1;
+	}
+      }
+    }
+  }
+}
+
+static int disjoint(fsm_lookahead *a, fsm_lookahead *b)
+{
+  /* whether no data can match both a and b - which is so if there is
+     a byte both read that can not be the same for both */
+  int i, k;
+
+  for(i = 0; (i < a->least) && (i < b->least); i++) {
+    for(k = 0; k < 32; k++) {
+      if(a->bytes[i][k] & b->bytes[i][k]) {
+	break;
+      }
+    }
+    if(k == 32) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int reorder_table(fsm *f, fsm_table *pt, fsm_lookahead *tables, fsm_profile_entry *counts)
+{
+  /* put the rows of each group of a state that no data can match
+     more than one of in the order of how often they matched, the
+     most often first. returns the number of groups whose order
+     changed */
+  int reordered = 0;
+  int state;
+
+  if(counts == NULL) {
+    /* never run, so there is nothing to go by */
+    return 0;
+  }
+
+  for(state = 0; state < pt->nstates; state++) {
+    int end = pt->first[state+1];
+    int i = pt->first[state];
+
+    while(i < end) {
+      fsm_lookahead rows[FSM_REORDER_GROUP];
+      int lowest = pt->rows[i], highest = pt->rows[i];
+      int j, k, moved = 0;
+
+      /* a group is rows one after the other that go nowhere else
+	 when they fail, each of which reads something, and no two of
+	 which can match the same data */
+      for(j = i; (j < end) && (j - i < FSM_REORDER_GROUP); j++) {
+	row_lookahead(f, pt, j, tables, &rows[j - i]);
+	if((pt->hot[j].fail >= 0) ||
+	   (pt->hot[j].match == INVALID) ||
+	   (rows[j - i].least == 0)) {
+	  break;
+	}
+	for(k = i; k < j; k++) {
+	  if(!disjoint(&rows[k - i], &rows[j - i])) {
+	    break;
+	  }
+	}
+	if(k < j) {
+	  break;
+	}
+	if(pt->rows[j] < lowest) {
+	  lowest = pt->rows[j];
+	}
+	if(pt->rows[j] > highest) {
+	  highest = pt->rows[j];
+	}
+      }
+
+      /* a row that fails into this state carries on with the rows
+	 that come after it in the table, which must be all of the
+	 group or none of it */
+      for(k = 0; k < pt->first[pt->nstates]; k++) {
+	if((pt->hot[k].fail == state) &&
+	   (pt->rows[k] >= lowest) &&
+	   (pt->rows[k] < highest)) {
+	  j = i;
+	  break;
+	}
+      }
+
+      /* then sort the group by how often each row matched, keeping
+	 the table order of rows that matched as often */
+      for(k = i + 1; k < j; k++) {
+	int row = pt->rows[k];
+	fsm_row hot = pt->hot[k];
+	unsigned long matches = (row < counts->nrows) ? counts->rows[row].matches : 0;
+	int m;
+
+	for(m = k; m > i; m--) {
+	  int before = pt->rows[m - 1];
+	  if(((before < counts->nrows) ? counts->rows[before].matches : 0) >= matches) {
+	    break;
+	  }
+	  pt->rows[m] = pt->rows[m - 1];
+	  pt->hot[m] = pt->hot[m - 1];
+	  moved = 1;
+	}
+	pt->rows[m] = row;
+	pt->hot[m] = hot;
+      }
+      reordered += moved;
+
+      i = (j > i) ? j : i + 1;
+    }
+  }
+
+  return reordered;
+}
+
+static size_t skip_run(fsm_skip *skip, char *data, char *end)
+{
+  /* count the bytes from data that are in the skipped class, stopping
+     at end (if it is not NULL). NUL is never in a class, so a NUL
+     terminated string stops at its NUL. the vector code loads whole
+     aligned blocks, which can reach past the end of the data, but
+     never past the end of the page it is in - only bytes before the
+     end are counted */
+  unsigned char *p = (unsigned char*)data;
+  unsigned char *stop = (unsigned char*)end;
+
+#if defined(__AVX2__)
+#define SKIP_BLOCK 32
+#define SKIP_VEC __m256i
+#define SKIP_SET1(x) _mm256_set1_epi8(x)
+#define SKIP_LOAD(p) _mm256_load_si256((__m256i*)(p))
+#define SKIP_IN(x, lo, span) _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(x, lo), span), _mm256_sub_epi8(x, lo))
+#define SKIP_OR(a, b) _mm256_or_si256(a, b)
+#define SKIP_ZERO() _mm256_setzero_si256()
+#define SKIP_MASK(x) ((unsigned int)_mm256_movemask_epi8(x))
+#elif defined(__SSE2__)
+#define SKIP_BLOCK 16
+#define SKIP_VEC __m128i
+#define SKIP_SET1(x) _mm_set1_epi8(x)
+#define SKIP_LOAD(p) _mm_load_si128((__m128i*)(p))
+#define SKIP_IN(x, lo, span) _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(x, lo), span), _mm_sub_epi8(x, lo))
+#define SKIP_OR(a, b) _mm_or_si128(a, b)
+#define SKIP_ZERO() _mm_setzero_si128()
+#define SKIP_MASK(x) ((unsigned int)_mm_movemask_epi8(x) | 0xffff0000u)
+#endif
+
+#ifdef SKIP_BLOCK
+  if(skip->nranges > 0) {
+    /* a byte x is in the range lo to hi when x - lo, wrapping around,
+       is no more than hi - lo */
+    SKIP_VEC lo[FSM_SKIP_RANGES], span[FSM_SKIP_RANGES];
+    int i;
+
+    for(i = 0; i < skip->nranges; i++) {
+      lo[i] = SKIP_SET1((char)skip->lo[i]);
+      span[i] = SKIP_SET1((char)(skip->hi[i] - skip->lo[i]));
+    }
+
+    /* a byte at a time up to the first aligned block */
+    while(((uintptr_t)p % SKIP_BLOCK) != 0) {
+      if(((stop != NULL) && (p >= stop)) ||
+	 !CHARSET_HAS(skip->chars, *p)) {
+	return p - (unsigned char*)data;
+      }
+      p++;
+    }
+
+    for(;;) {
+      SKIP_VEC x, in;
+      unsigned int out;
+
+      if((stop != NULL) && (p >= stop)) {
+	break;
+      }
+      x = SKIP_LOAD(p);
+      in = SKIP_ZERO();
+      for(i = 0; i < skip->nranges; i++) {
+	in = SKIP_OR(in, SKIP_IN(x, lo[i], span[i]));
+      }
+      out = ~SKIP_MASK(in);
+      if(out != 0) {
+	p += __builtin_ctz(out);
+	break;
+      }
+      p += SKIP_BLOCK;
+    }
+
+    if((stop != NULL) && (p > stop)) {
+      p = stop;
+    }
+    return p - (unsigned char*)data;
+  }
+#endif
+
+  while(((stop == NULL) || (p < stop)) &&
+	CHARSET_HAS(skip->chars, *p)) {
+    p++;
+  }
+  return p - (unsigned char*)data;
+}
+
+static void free_table(fsm_table *pt)
+{
+  if(pt == NULL) {
+    return;
+  }
+
+  free(pt->first);
+  free(pt->rows);
+  free(pt->hot);
+  free(pt->sets);
+  free(pt->subs);
+  free(pt->skip);
+  free(pt);
+}
+
+static void trace_event(fsm_run *r, fsm_frame *f, int kind, int nbytes)
+{
+  /* write an event into the run's ring, over the oldest one if it is
+     full. only this thread writes to the ring, so the event is filled
+     in first, and then published by moving next on */
+  fsm_trace *t = r->trace;
+  size_t next = t->next;
+  fsm_trace_event *e = &t->events[next & t->mask];
+  int depth = f - r->frames;
+
+  e->table = f->table;
+  e->offset = (f->data - r->origin) + r->dropped;
+  e->row = f->row;
+  e->nbytes = nbytes;
+  e->depth = (depth > USHRT_MAX) ? USHRT_MAX : depth;
+  e->kind = kind;
+
+  __atomic_store_n(&t->next, next + 1, __ATOMIC_RELEASE);
+}
+
+static void profile_enter(fsm_run *r, fsm_frame *f)
+{
+  /* a table has started in frame f - count it, and note when */
+  f->prof = profile_entry(r->profile, f->table);
+  if(f->prof == NULL) {
+    /* the table goes uncounted */
+    return;
+  }
+  f->prof->runs++;
+  f->child_cycles = 0;
+  f->started = profile_clock();
+}
+
+static void profile_leave(fsm_run *r, fsm_frame *f)
+{
+  /* the table in frame f is done - the time it took, less the time
+     its sub-FSMs took, is its own, and all of it is time the table
+     below spent in a sub-FSM */
+  unsigned long long elapsed = profile_clock() - f->started;
+
+  f->prof->inclusive += elapsed;
+  f->prof->exclusive += elapsed - f->child_cycles;
+  if(f != r->frames) {
+    (f - 1)->child_cycles += elapsed;
+  }
+  f->prof = NULL;
+}
+
+static fsm_profile_entry *find_profile(fsm_profile *p, transition *table)
+{
+  /* find the counts a profile has for a table, or NULL if it has
+     none */
+  size_t i;
+
+  i = ((uintptr_t)table >> 4) & p->mask;
+  while(p->entries[i] != NULL) {
+    if(p->entries[i]->table == table) {
+      return p->entries[i];
+    }
+    i = (i + 1) & p->mask;
+  }
+
+  return NULL;
+}
+
+static fsm_profile_entry *profile_entry(fsm_profile *p, transition *table)
+{
+  /* find the counts a profile has for a table, adding them if it has
+     none yet. returns NULL if they could not be added */
+  fsm_profile_entry *e;
+  size_t i;
+
+  i = ((uintptr_t)table >> 4) & p->mask;
+  while(p->entries[i] != NULL) {
+    if(p->entries[i]->table == table) {
+      return p->entries[i];
+    }
+    i = (i + 1) & p->mask;
+  }
+
+  if((p->count + 1) * 2 > p->mask + 1) {
+    /* too full - rehash everything into twice as many buckets */
+    size_t mask = p->mask * 2 + 1;
+    fsm_profile_entry **entries = calloc(mask + 1, sizeof(fsm_profile_entry*));
+    size_t j;
+
+    if(entries == NULL) {
+      return NULL;
+    }
+    for(j = 0; j <= p->mask; j++) {
+      if(p->entries[j] != NULL) {
+	i = ((uintptr_t)p->entries[j]->table >> 4) & mask;
+	while(entries[i] != NULL) {
+	  i = (i + 1) & mask;
+	}
+	entries[i] = p->entries[j];
+      }
+    }
+    free(p->entries);
+    p->entries = entries;
+    p->mask = mask;
+
+    i = ((uintptr_t)table >> 4) & p->mask;
+    while(p->entries[i] != NULL) {
+      i = (i + 1) & p->mask;
+    }
+  }
+
+  e = malloc(sizeof(fsm_profile_entry));
+  if(e == NULL) {
+    return NULL;
+  }
+  e->table = table;
+  for(e->nrows = 0; table[e->nrows].current_state != -1; e->nrows++);
+  e->runs = 0;
+  e->inclusive = 0;
+  e->exclusive = 0;
+  e->rows = calloc((e->nrows > 0) ? e->nrows : 1, sizeof(fsm_profile_counts));
+  if(e->rows == NULL) {
+    free(e);
+    return NULL;
+  }
+  p->entries[i] = e;
+  p->count++;
+
+  return e;
+}
+
+static unsigned long long profile_clock(void)
+{
+  /* the time, in cycles where the machine can count them cheaply */
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
 }
@@ -7,6 +7,20 @@
  * code. It provides the data structures for the FSM action tables, as
  * well as the public API declaration for the run_fsm function that
  * executes an FSM on programmer provided input.
+ *
+ * The engine keeps no global state, apart from the trace and the
+ * profile each thread is writing to (see fsm_trace_start and
+ * fsm_profile_start). Everything a run needs - its
+ * stack of tables, its memo, the effects it has noted down - lives
+ * in the run itself, which is on the caller's stack for run_fsm and
+ * friends, or in the fsm_stream for a stream. Runs never write to the transition tables,
+ * or to a prepared machine, so any number of threads can run the
+ * same tables or the same prepared machine at once, as long as each
+ * run has its own context (and journal), and the transfn and FUNCTION
+ * functions are themselves safe to call from several threads. A
+ * stream belongs to one thread at a time. Preparing and configuring a
+ * machine (fsm_memoize, fsm_defer_calls, fsm_max_depth, fsm_reorder) has to be finished before
+ * it is shared, and fsm_free has to wait until every run is over.
  * 
  * 
  */
@@ -17,6 +31,12 @@
 
 #define FSM_VERSION "0.3"
 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum match_type {
   INVALID,
   EXACT_STR,
@@ -31,6 +51,23 @@ enum state_type {
   REJECT
 };
 
+/* returned by fsm_stream_feed while the machine is waiting for more
+   data - and by a FUNCTION_N function that can not tell whether it
+   matches until it sees more data than it has been given */
+#define FSM_MORE -2
+
+/* the most tables a run may have started and not yet finished - the
+   outermost table and the sub-FSMs it is in the middle of. the
+   engine keeps them on a stack of its own rather than on the C
+   stack, so recursive tables nested this deep cost memory, not
+   stack - but a run that would go deeper fails, so that data nested
+   without end can not use up all of the memory either. code written
+   by fsm2c, which does call itself, stops at the same depth. see
+   fsm_max_depth to change it for a prepared machine */
+#ifndef FSM_MAX_DEPTH
+#define FSM_MAX_DEPTH 4096
+#endif
+
 typedef void*(*dup_fn)(void*);
 typedef void(*free_fn)(void*);
 
@@ -42,11 +79,12 @@ struct transition_s {
      transition, and the data needed to make that match. A macro is
      used so there arent ugly NULLs too much in the table (also makes
      it easier to read) */
-#define EXACT_STRING(x)     EXACT_STR,     x,    NULL, NULL
-#define SINGLE_CHARACTER(x) SINGLE_CHR,    x,    NULL, NULL
-#define FSM(x)              SUBFSM,     NULL,       x, NULL
-#define FUNCTION(x)         FUNC,       NULL,    NULL, x
-#define NOTHING             EXACT_STR,    "",    NULL, NULL
+#define EXACT_STRING(x)     EXACT_STR,     x,    NULL, NULL, NULL
+#define SINGLE_CHARACTER(x) SINGLE_CHR,    x,    NULL, NULL, NULL
+#define FSM(x)              SUBFSM,     NULL,       x, NULL, NULL
+#define FUNCTION(x)         FUNC,       NULL,    NULL,    x, NULL
+#define FUNCTION_N(x)       FUNC,       NULL,    NULL, NULL,    x
+#define NOTHING             EXACT_STR,    "",    NULL, NULL, NULL
 
   /* an internal variable, used for storing this transitions match
      type */
@@ -64,6 +102,15 @@ struct transition_s {
      return the number of bytes used to transition */
   int (*action)(char **data, void *global_context, void *local_context);
 
+  /* the same, for a function that needs to know where the data ends -
+     end points just past the last byte of data, or is NULL when the
+     data is NUL terminated (the machine was started with run_fsm
+     rather than run_fsm_n). the function must not use more than end -
+     *data bytes. when the machine is being fed a stream, and more
+     data may be on its way, it can return FSM_MORE (having changed
+     nothing) to be called again once there is more */
+  int (*action_n)(char **data, char *end, void *global_context, void *local_context);
+
   int state_pass;
   int state_fail;
 
@@ -81,6 +128,31 @@ struct transition_s {
 
   char *transition_name;
 
+  /* the capture slot the bytes this transition uses are recorded in,
+     as a span, by the runs that capture - see run_fsm_captures. 0
+     (the default) records nothing, and CAPTURE(n) records into slot
+     n */
+#define CAPTURE(n) ((n) + 1)
+  int capture;
+
+  /* the bytes the function of a FUNCTION transition can start with -
+     a promise that it returns -1, having done nothing, unless the
+     data starts with one of them. NULL (the default) promises
+     nothing. a prepared machine turns the transition down without
+     calling the function when the byte is not one of them, and
+     without running a sub-FSM that could only start with such a
+     transition */
+  char *starts;
+
+};
+
+/* where a capture slot's bytes are in the data - offset bytes from
+   the start of the run, length bytes long. a slot nothing was
+   recorded in has a length of -1 */
+typedef struct fsm_span_s fsm_span;
+struct fsm_span_s {
+  size_t offset;
+  int length;
 };
 
 /** 
@@ -98,5 +170,635 @@ struct transition_s {
  */
 int run_fsm(transition action_table[], char **data, void **context, dup_fn dup_context, free_fn free_context);
 
+/** 
+ * Run a finite state machine on length bytes of data, which do not
+ * have to be NUL terminated and may contain NUL bytes. The machine
+ * never looks at data past the end - strings only match if they fit,
+ * FUNCTION_N transitions are told where the data ends, and a
+ * FUNCTION transition that claims more bytes than are left fails.
+ * NUL bytes in the data are never matched by EXACT_STRING or
+ * SINGLE_CHARACTER transitions, but can be used by functions.
+ * 
+ * @param action_table the actual finite state machine main table
+ * @param data the data to use while running the FSM
+ * @param length the number of bytes of data
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int run_fsm_n(transition action_table[], char **data, size_t length, void **context, dup_fn dup_context, free_fn free_context);
+
+/* a prepared finite state machine - the tables of a machine, indexed
+   so that each step only looks at the transitions leaving the current
+   state instead of walking the whole table */
+typedef struct fsm_s fsm;
+
+/** 
+ * Prepare a finite state machine for running. Every table reachable
+ * from action_table (through FSM transitions) is indexed by state,
+ * keeping the transitions of each state in table order, so a prepared
+ * machine makes exactly the same transitions as run_fsm would on the
+ * same table. What a step needs of each transition is packed into a
+ * compact array, in state order, and the rest of the transition is
+ * only looked at once it has matched. The bytes each table can start
+ * with are worked out too, so that an FSM transition whose table can
+ * not start with the next byte is turned down without running it
+ * (see the starts of a transition for FUNCTION transitions). The tables must not be changed while the prepared
+ * machine is in use. A prepared machine is only read by its runs, so
+ * it can be shared between threads.
+ * 
+ * @param action_table the actual finite state machine main table
+ * 
+ * @return the prepared machine, or NULL if it could not be built
+ */
+fsm *fsm_prepare(transition action_table[]);
+
+/** 
+ * Free a machine created by fsm_prepare. The tables it was prepared
+ * from are left alone.
+ * 
+ * @param f the prepared machine
+ */
+void fsm_free(fsm *f);
+
+/** 
+ * Make the runs of a prepared machine memoize their sub-FSMs. Every
+ * time a run finishes a sub-FSM, it remembers where in the data the
+ * sub-FSM started, how many bytes it used (or that it failed), and
+ * which transfn and FUNCTION functions it called along the way. When
+ * the same table is tried from the same place again, which is what
+ * happens when one alternative fails after others have already read
+ * the same sub-FSMs, the result is taken from the memo and those
+ * functions are called again in the same order instead of running
+ * the table. With a big enough memo, a run never runs the same table
+ * from the same place twice, so machines whose alternatives share
+ * sub-FSMs run in time linear in the data.
+ *
+ * This is only correct for machines whose matching does not depend
+ * on the context: whether a table matches, and how much it uses, has
+ * to depend on the data alone. Functions called from a sub-FSM that
+ * fails are not called again either, so either a dup_context
+ * function has to be given, or such calls must not matter. FUNCTION
+ * functions are called again for their effect on the context, with
+ * what they return ignored.
+ *
+ * Each run allocates its own memo, and frees it when it is done. Once
+ * it has used max_bytes, the run keeps using what it has but adds
+ * nothing more to it.
+ * 
+ * @param f the prepared machine
+ * @param max_bytes the most memory each run may use for its memo, or
+ *                  0 to stop memoizing
+ */
+void fsm_memoize(fsm *f, size_t max_bytes);
+
+/* when the transfn functions of a prepared machine are called */
+enum fsm_calls {
+  FSM_CALLS_NOW = 0,  /* as soon as their transitions are made */
+  FSM_CALLS_DEFERRED, /* once the whole machine has accepted */
+  FSM_CALLS_NEVER     /* never - the machine only validates */
+};
+
+/** 
+ * Choose when the runs of a prepared machine call the transfn
+ * functions of the transitions they make. Normally they are called
+ * as soon as each transition is made, even inside a sub-FSM that
+ * goes on to fail, which is why the context is copied for every
+ * sub-FSM. With FSM_CALLS_DEFERRED, the run only notes down each call
+ * (the transition, and the data it used), forgets the calls of
+ * sub-FSMs that fail, and makes the rest, in order, once the whole
+ * machine has accepted - so no call is ever made for an alternative
+ * that did not work out, and nothing at all is called if the machine
+ * does not accept. With FSM_CALLS_NEVER, no calls are made at all,
+ * for a run that only needs to know whether the data matches.
+ *
+ * FUNCTION transitions still have to be called as the machine runs,
+ * to decide whether they match, so machines whose FUNCTION functions
+ * depend on what transfn functions put in the context can not defer
+ * their calls. The data has to stay where it is until the run is
+ * over, since the deferred calls are given pointers into it - a
+ * stream keeps what it needs of the data for them. A machine that
+ * defers its calls, and has no FUNCTION functions that change the
+ * context, does not need its context copied, and can be run with a
+ * NULL dup_context and free_context.
+ * 
+ * @param f the prepared machine
+ * @param calls when the machine's transfn functions are called
+ */
+void fsm_defer_calls(fsm *f, enum fsm_calls calls);
+
+/** 
+ * Set how deeply the runs of a prepared machine may nest its tables
+ * in each other - the most tables, the outermost one included, that
+ * a run may be in the middle of at once. Runs start with room on
+ * their own stack for a few tables, and move to a stack on the heap
+ * that doubles as needed once they go deeper. A run that would go
+ * deeper than max_depth stops right there: every table it is in the
+ * middle of is finished with -1, undoing what it did to the context
+ * as a failed sub-FSM would, and the run returns -1. Machines that
+ * have not been prepared, and those that are not given a depth of
+ * their own, stop at FSM_MAX_DEPTH.
+ * 
+ * @param f the prepared machine
+ * @param max_depth the most tables a run may be in at once, or 0
+ *                  for FSM_MAX_DEPTH
+ */
+void fsm_max_depth(fsm *f, int max_depth);
+
+/** 
+ * Run a prepared finite state machine on some data. This behaves
+ * exactly like run_fsm on the table the machine was prepared from.
+ * 
+ * @param f the prepared machine
+ * @param data the data to use while running the FSM
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int run_prepared_fsm(fsm *f, char **data, void **context, dup_fn dup_context, free_fn free_context);
+
+/** 
+ * Run a prepared finite state machine on length bytes of data. This
+ * behaves exactly like run_fsm_n on the table the machine was
+ * prepared from.
+ * 
+ * @param f the prepared machine
+ * @param data the data to use while running the FSM
+ * @param length the number of bytes of data
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int run_prepared_fsm_n(fsm *f, char **data, size_t length, void **context, dup_fn dup_context, free_fn free_context);
+
+/** 
+ * Run a finite state machine on length bytes of data, recording
+ * where the transitions that have a capture slot matched. This is
+ * run_fsm_n, with every span first set to a length of -1; each time
+ * a transition with CAPTURE(n) is made, spans[n] is set to the bytes
+ * it used, so a slot whose transition is made more than once ends up
+ * with the last of them. A sub-FSM that fails, or a transition of
+ * one, records nothing - the spans it set are put back as they
+ * were. Nothing is allocated or copied for a capture, so a machine
+ * that only captures, with no transfn functions, can be run with a
+ * NULL context.
+ * 
+ * @param action_table the actual finite state machine main table
+ * @param data the data to use while running the FSM
+ * @param length the number of bytes of data
+ * @param spans the spans to record the capture slots in
+ * @param nspans the number of spans - slots past the last one are
+ *               not recorded
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state - in which case the spans mean
+ *         nothing
+ */
+int run_fsm_captures(transition action_table[], char **data, size_t length, fsm_span spans[], int nspans, void **context, dup_fn dup_context, free_fn free_context);
+
+/** 
+ * Run a prepared finite state machine on length bytes of data,
+ * recording capture slots. This behaves exactly like
+ * run_fsm_captures on the table the machine was prepared from - the
+ * memo of a memoizing machine remembers the spans of its sub-FSMs
+ * too, and deferred or never made calls do not change what is
+ * recorded.
+ * 
+ * @param f the prepared machine
+ * @param data the data to use while running the FSM
+ * @param length the number of bytes of data
+ * @param spans the spans to record the capture slots in
+ * @param nspans the number of spans
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int run_prepared_fsm_captures(fsm *f, char **data, size_t length, fsm_span spans[], int nspans, void **context, dup_fn dup_context, free_fn free_context);
+
+/* a journal of the changes callbacks make to a context, so that the
+   changes made by an alternative that fails can be undone */
+typedef struct fsm_journal_s fsm_journal;
+
+/* set lvalue to value, saving its old value in journal j first */
+#define FSM_JOURNAL_SET(j, lvalue, value) \
+  (fsm_journal_save((j), &(lvalue), sizeof(lvalue)), (lvalue) = (value))
+
+/** 
+ * Create a journal, for journaled runs.
+ * 
+ * @return the journal, or NULL if it could not be allocated
+ */
+fsm_journal *fsm_journal_new(void);
+
+/** 
+ * Free a journal created by fsm_journal_new
+ * 
+ * @param j the journal
+ */
+void fsm_journal_free(fsm_journal *j);
+
+/** 
+ * Save the contents of some memory in a journal before changing
+ * it. Callbacks of journaled runs call this (or FSM_JOURNAL_SET)
+ * before every change they make to the context, so that it can be
+ * put back the way it was if the change is undone. A journal of NULL
+ * saves nothing, so the same callbacks can be used by runs that are
+ * not journaled.
+ * 
+ * @param j the journal of the run
+ * @param address the memory about to be changed
+ * @param size the number of bytes about to be changed
+ * 
+ * @return 0, or -1 if there was no memory to save the old contents in
+ *         - the change should not be made then, since it could not be
+ *         undone
+ */
+int fsm_journal_save(fsm_journal *j, void *address, size_t size);
+
+/** 
+ * Find out how much a journal holds, so that the changes saved in it
+ * after this point can later be undone with fsm_journal_rollback, or
+ * kept with fsm_journal_commit. The runs of the engine do this
+ * themselves - these are for code that runs machines its own way,
+ * like the code fsm2c writes.
+ * 
+ * @param j the journal, or NULL
+ * 
+ * @return the point to roll back to, or commit from (0 for NULL)
+ */
+size_t fsm_journal_mark(fsm_journal *j);
+
+/** 
+ * Undo every change saved in a journal since mark, newest first
+ * 
+ * @param j the journal, or NULL
+ * @param mark what fsm_journal_mark returned
+ */
+void fsm_journal_rollback(fsm_journal *j, size_t mark);
+
+/** 
+ * Keep every change saved in a journal since mark, forgetting how to
+ * undo them
+ * 
+ * @param j the journal, or NULL
+ * @param mark what fsm_journal_mark returned
+ */
+void fsm_journal_commit(fsm_journal *j, size_t mark);
+
+/** 
+ * Run a finite state machine on some data, journaling the changes to
+ * the context. This is run_fsm, except that the context is never
+ * duplicated: every FSM and FUNCTION transition works on the context
+ * itself, and if it fails, everything saved in the journal since it
+ * was started is put back. Callbacks have to find the journal
+ * through the context, and save everything they change with
+ * fsm_journal_save - memory they free can not be brought back, so
+ * they should not free anything they did not allocate themselves in
+ * the same transition. Once the run is over, the journal is left as
+ * it was found, and can be used for the next run.
+ * 
+ * @param action_table the actual finite state machine main table
+ * @param data the data to use while running the FSM
+ * @param context the context, which is handed to callbacks
+ * @param journal the journal the callbacks save their changes in
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int run_fsm_journaled(transition action_table[], char **data, void *context, fsm_journal *journal);
+
+/** 
+ * Run a prepared finite state machine on some data, journaling the
+ * changes to the context. This behaves exactly like
+ * run_fsm_journaled on the table the machine was prepared from.
+ * 
+ * @param f the prepared machine
+ * @param data the data to use while running the FSM
+ * @param context the context, which is handed to callbacks
+ * @param journal the journal the callbacks save their changes in
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int run_prepared_fsm_journaled(fsm *f, char **data, void *context, fsm_journal *journal);
+
+/* a machine that is given its data a piece at a time, as it arrives,
+   rather than all at once */
+typedef struct fsm_stream_s fsm_stream;
+
+/** 
+ * Start running a finite state machine on data that will be fed to
+ * it in pieces. The machine works through each piece as it is fed,
+ * making exactly the transitions run_fsm_n would make on all of the
+ * data, and calling the same functions in the same order. When it
+ * runs out of data part way through a transition - a string, a
+ * character or a sub-FSM - it stops, and carries on from that point
+ * when it is fed more, without going over the data it has already
+ * used again.
+ *
+ * The stream keeps the data fed to it from the start of the
+ * outermost table's current transition, since a transition that is
+ * still running may fail and the next one will need that data again.
+ * Every byte before that has been used for good and is thrown
+ * away. A table that makes one transition per message only holds one
+ * message at a time.
+ *
+ * FUNCTION transitions are given the data the stream has so far, NUL
+ * terminated, and FUNCTION_N transitions are told where it ends and
+ * may return FSM_MORE to wait for more.
+ * 
+ * @param action_table the actual finite state machine main table
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the stream, or NULL if it could not be created
+ */
+fsm_stream *fsm_stream_new(transition action_table[], void **context, dup_fn dup_context, free_fn free_context);
+
+/** 
+ * Start running a prepared finite state machine on data that will be
+ * fed to it in pieces, as fsm_stream_new does.
+ * 
+ * @param f the prepared machine
+ * @param context a context, as for run_fsm
+ * @param dup_context a function which will duplicate the context
+ * @param free_context a function which will free the memory
+ *                     associated with a context
+ * 
+ * @return the stream, or NULL if it could not be created
+ */
+fsm_stream *fsm_stream_new_prepared(fsm *f, void **context, dup_fn dup_context, free_fn free_context);
+
+/** 
+ * Feed the next piece of data to a stream. The data is copied where
+ * the machine may still need it, so it can be reused as soon as this
+ * returns.
+ * 
+ * @param s the stream
+ * @param data the next piece of data
+ * @param length the number of bytes of data
+ * 
+ * @return FSM_MORE if the machine needs more data, otherwise the
+ *         machine has finished, and this is what run_fsm_n would have
+ *         returned: the number of bytes processed, or -1. Any data
+ *         past the bytes processed was not used. Once the machine has
+ *         finished, feeding it more data just returns the same
+ *         again.
+ */
+int fsm_stream_feed(fsm_stream *s, char *data, size_t length);
+
+/** 
+ * Tell a stream that there is no more data. Whatever the machine was
+ * waiting for can now no longer arrive, so it finishes as run_fsm_n
+ * would at the end of the data.
+ * 
+ * @param s the stream
+ * 
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         end in an ACCEPT state
+ */
+int fsm_stream_finish(fsm_stream *s);
+
+/** 
+ * Free a stream. A machine that had not finished is abandoned, and
+ * the copies of the context made for the sub-FSMs it was in are
+ * freed.
+ * 
+ * @param s the stream
+ */
+void fsm_stream_free(fsm_stream *s);
+
+/* what a traced run did */
+enum fsm_trace_kind {
+  FSM_TRACE_ATTEMPT, /* started trying a transition */
+  FSM_TRACE_MATCH,   /* made the transition, using nbytes bytes */
+  FSM_TRACE_FAIL,    /* could not make the transition */
+  FSM_TRACE_ENTER,   /* started the transition's sub-FSM */
+  FSM_TRACE_EXIT     /* finished the sub-FSM, which returned nbytes */
+};
+
+/* one event of a trace. every event is the same size, and is about
+   the transition in row row of table, tried offset bytes into the
+   data of the run (or of the whole stream), depth sub-FSMs deep */
+typedef struct fsm_trace_event_s fsm_trace_event;
+struct fsm_trace_event_s {
+  transition *table;
+  size_t offset;
+  int row;
+  int nbytes;
+  unsigned short depth;
+  unsigned char kind;
+};
+
+/* a ring buffer of trace events, which keeps the newest of them */
+typedef struct fsm_trace_s fsm_trace;
+
+/** 
+ * Make a trace, to hold the nevents newest events of the runs that
+ * write to it.
+ * 
+ * @param nevents the number of events to keep, which is rounded up
+ *                to a power of two
+ * 
+ * @return the trace, or NULL if it could not be allocated
+ */
+fsm_trace *fsm_trace_new(size_t nevents);
+
+/** 
+ * Free a trace. No run may still be writing to it.
+ * 
+ * @param t the trace
+ */
+void fsm_trace_free(fsm_trace *t);
+
+/** 
+ * Trace the runs of the calling thread into t. Tracing is turned on
+ * and off for each thread, and a trace must only be written by one
+ * thread at a time - so each thread traces into a trace of its own,
+ * without any locking. The runs the thread starts from now on, and
+ * the streams it feeds, write an event into t for every transition
+ * they try, make, or fail to make, and for every sub-FSM they start
+ * and finish. The events are written as they happen, with nothing
+ * formatted - see fsm_trace_print in fsm_trace.h for that. While a
+ * thread is not tracing, the trace costs its runs one test of a
+ * pointer at each of those points.
+ * 
+ * @param t the trace to write to
+ */
+void fsm_trace_start(fsm_trace *t);
+
+/** 
+ * Stop tracing the runs of the calling thread.
+ */
+void fsm_trace_stop(void);
+
+/** 
+ * Copy the newest events of a trace out of it, oldest first. This
+ * can be done from any thread, even while the trace is being written
+ * to - events that are written over while they are being copied are
+ * left out.
+ * 
+ * @param t the trace
+ * @param events where to copy the events
+ * @param max the most events to copy
+ * 
+ * @return the number of events copied
+ */
+size_t fsm_trace_read(fsm_trace *t, fsm_trace_event events[], size_t max);
+
+/* counts of how runs got on with the tables they ran, kept for each
+   thread by the runs it starts */
+typedef struct fsm_profile_s fsm_profile;
+
+/* what a profile knows about row row of table - how often the
+   transition in it was tried, how often it was made, and the bytes
+   it used when it was */
+typedef struct fsm_profile_row_s fsm_profile_row;
+struct fsm_profile_row_s {
+  transition *table;
+  int row;
+  unsigned long attempts;
+  unsigned long matches;
+  unsigned long long bytes;
+};
+
+/* what a profile knows about a table - the number of times it was
+   run, and the cycles spent in it, with (inclusive) and without
+   (exclusive) the sub-FSMs it started. cycles are read from the
+   time stamp counter where there is one, and are nanoseconds
+   elsewhere */
+typedef struct fsm_profile_table_s fsm_profile_table;
+struct fsm_profile_table_s {
+  transition *table;
+  unsigned long runs;
+  unsigned long long inclusive;
+  unsigned long long exclusive;
+};
+
+/** 
+ * Make an empty profile.
+ * 
+ * @return the profile, or NULL if it could not be allocated
+ */
+fsm_profile *fsm_profile_new(void);
+
+/** 
+ * Free a profile. No run may still be writing to it.
+ * 
+ * @param p the profile
+ */
+void fsm_profile_free(fsm_profile *p);
+
+/** 
+ * Profile the runs of the calling thread into p. Like tracing,
+ * profiling is turned on and off for each thread, and a profile must
+ * only be written by one thread at a time - each thread profiles
+ * into a profile of its own, without any locking, and the profiles
+ * are merged with fsm_profile_merge once the threads are done. The
+ * runs the thread starts from now on, and the streams it feeds,
+ * count every transition they try and make, and time every table
+ * they run. A stream's tables are timed from when they start to when
+ * they finish, so the time between feeds counts too. Profiled runs
+ * step through the runs of bytes they would otherwise skip over, so
+ * that every transition is counted.
+ * 
+ * @param p the profile to write to
+ */
+void fsm_profile_start(fsm_profile *p);
+
+/** 
+ * Stop profiling the runs of the calling thread.
+ */
+void fsm_profile_stop(void);
+
+/** 
+ * Add the counts of one profile to another. Neither profile may be
+ * being written to.
+ * 
+ * @param into the profile to add to
+ * @param from the profile to add
+ * 
+ * @return 0 on success, -1 if into could not be grown to hold the
+ *         tables of from
+ */
+int fsm_profile_merge(fsm_profile *into, fsm_profile *from);
+
+/** 
+ * Copy the counts of the rows of a profile that were tried out of
+ * it, in no particular order.
+ * 
+ * @param p the profile
+ * @param rows where to copy the counts, or NULL to only count them
+ * @param max the most rows to copy
+ * 
+ * @return the number of rows that were tried, which may be more
+ *         than max
+ */
+size_t fsm_profile_rows(fsm_profile *p, fsm_profile_row rows[], size_t max);
+
+/** 
+ * Copy the counts of the tables of a profile out of it, in no
+ * particular order.
+ * 
+ * @param p the profile
+ * @param tables where to copy the counts, or NULL to only count them
+ * @param max the most tables to copy
+ * 
+ * @return the number of tables that were run, which may be more
+ *         than max
+ */
+size_t fsm_profile_tables(fsm_profile *p, fsm_profile_table tables[], size_t max);
+
+/** 
+ * Reorder the transitions of a prepared machine by how often they
+ * matched in a profile of it - run the machine on some typical data
+ * while profiling, then reorder it, so the alternatives the data
+ * usually takes are tried first. Only the transitions of a state
+ * that no data can match more than one of are reordered: one after
+ * the other in the table, going nowhere else when they fail, and
+ * each reading at least one byte, with some byte among the first
+ * few they read telling each of them apart from the others (as "Mon"
+ * and "Tue" are, but "http" and "https" are not). Whichever of them
+ * is tried first, the same one matches, so the machine still makes
+ * exactly the same transitions, and returns the same - only the
+ * alternatives it tries and turns down on the way change. A machine
+ * that runs without a dup_context, and calls its transfns as it goes,
+ * can be left with the calls of a different set of sub-FSMs that
+ * failed in its context.
+ * 
+ * @param f the prepared machine
+ * @param p the profile, of runs of f or of its tables
+ * 
+ * @return the number of groups of transitions whose order changed,
+ *         or -1 if the machine could not be reordered
+ */
+int fsm_reorder(fsm *f, fsm_profile *p);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* FSM_H */
 
@@ -0,0 +1,544 @@
+/**
+ * @file   fsm.hpp
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the header-only C++ front end for writing finite
+ * state machines. A machine is a constexpr table of rows, just like a
+ * transition array, but it is built and checked by the compiler - a
+ * row that moves to a state no row leaves from, or a state that can
+ * never be reached, is a static_assert failure rather than a machine
+ * that quietly does the wrong thing. A table knows how many rows it
+ * has, so there is no {-1} row to forget.
+ *
+ * The tables are run by a template executor, instantiated for each
+ * table, whose strings, character sets, functions and transfns are
+ * all known to the compiler - functions and transfns are functors
+ * (or lambdas), which are called directly and can be inlined. There
+ * is nothing to prepare at run time, and nothing is allocated.
+ *
+ *   constexpr auto digits = fsm_cxx::table(
+ *     fsm_cxx::row(0, fsm_cxx::one_of("0123456789"), 0, -1, ACCEPT));
+ *   static_assert(digits.valid(), "bad digits table");
+ *
+ *   const char *p = "123abc";
+ *   int n = fsm_cxx::run(digits, p);   n is 3
+ *
+ * The rows behave just as they do for run_fsm: the rows of a state
+ * are tried in order, a row that does not match moves to its fail
+ * state (if it has one) and the hunt carries on with the rows after
+ * it, and the table accepts if its last transition was to an ACCEPT
+ * state.
+ *
+ * Like everything else in this directory, just copy this file (and
+ * fsm.h, for NORMAL, ACCEPT and REJECT) into your project. It needs
+ * C++17.
+ *
+ *
+ */
+
+
+#ifndef FSM_HPP
+#define FSM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <fsm.h>
+
+namespace fsm_cxx {
+
+/* the deepest tables may be nested in each other while a machine
+   runs - a sub-machine that would go deeper fails, rather than
+   running the thread out of stack */
+#ifndef FSM_CXX_MAX_DEPTH
+#define FSM_CXX_MAX_DEPTH 1024
+#endif
+
+/* Match types - what a row needs to see to make its transition */
+
+/* exactly this string, as EXACT_STRING. the empty string always
+   matches, using no bytes, as NOTHING */
+struct exact_t {
+  const char *str;
+  std::size_t length;
+};
+
+template <std::size_t N>
+constexpr exact_t exact(const char (&str)[N])
+{
+  return exact_t{str, N - 1};
+}
+
+/* any one of these characters, as SINGLE_CHARACTER - kept as a
+   bitmap, so matching is a single bit test */
+struct one_of_t {
+  std::uint64_t bits[4];
+
+  constexpr bool has(unsigned char c) const
+  {
+    return (bits[c >> 6] >> (c & 63)) & 1;
+  }
+};
+
+template <std::size_t N>
+constexpr one_of_t one_of(const char (&chars)[N])
+{
+  one_of_t set{{0, 0, 0, 0}};
+  for(std::size_t i = 0; i + 1 < N; i++) {
+    unsigned char c = (unsigned char)chars[i];
+    set.bits[c >> 6] |= (std::uint64_t)1 << (c & 63);
+  }
+  return set;
+}
+
+/* a function, as FUNCTION_N. it is called as
+
+     int f(const char *data, const char *end, Ctx &context);
+
+   with end NULL if the data is NUL terminated, and returns the
+   number of bytes it used, or -1 if the transition can not be
+   made. it works on a copy of the context, which is only kept if it
+   succeeds */
+template <class F>
+struct func_t {
+  F f;
+};
+
+template <class F>
+constexpr func_t<F> func(F f)
+{
+  return func_t<F>{f};
+}
+
+/* a whole table, as FSM - run on a copy of the context, which is only
+   kept if the table accepts */
+template <class Table>
+struct sub_t {
+  Table table;
+};
+
+template <class Table>
+constexpr sub_t<Table> sub(Table table)
+{
+  return sub_t<Table>{table};
+}
+
+/* the table G::table, as FSM. a table can not hold itself, so a
+   machine that nests in itself - a list of lists - names its tables
+   through types instead:
+
+     struct list_g;
+     struct list_g {
+       static constexpr auto table = fsm_cxx::table(
+	 ...
+	 fsm_cxx::row(1, fsm_cxx::rule<list_g>(), 1, -1));
+     };
+
+   a rule's table is checked by its own static_assert, not as part of
+   the tables that use it */
+template <class G>
+struct rule_t {
+};
+
+template <class G>
+constexpr rule_t<G> rule()
+{
+  return rule_t<G>{};
+}
+
+
+/* Rows */
+
+/* a transfn that does nothing */
+struct nothing_to_do {
+  template <class Ctx>
+  void operator()(const char *, int, Ctx &) const
+  {
+  }
+};
+
+/* one row of a table - as a transition, with the transfn called as
+
+     void action(const char *data, int nbytes, Ctx &context);
+
+   with the data the transition used */
+template <class Match, class Action>
+struct row_t {
+  int current_state;
+  Match match;
+  int state_pass;
+  int state_fail;
+  enum state_type type;
+  Action action;
+};
+
+template <class Match, class Action = nothing_to_do>
+constexpr row_t<Match, Action> row(int current_state, Match match, int state_pass, int state_fail, enum state_type type = NORMAL, Action action = Action())
+{
+  return row_t<Match, Action>{current_state, match, state_pass, state_fail, type, action};
+}
+
+
+/* Tables */
+
+template <class... Rows>
+struct table_t {
+  static constexpr std::size_t nrows = sizeof...(Rows);
+
+  std::tuple<Rows...> rows;
+
+  int state[nrows];
+  int pass[nrows];
+  int fail[nrows];
+  enum state_type type[nrows];
+
+  /* where the run goes from each row - the first row of the pass
+     state when the row matched, and when it did not, the next row to
+     try after it (of the fail state, if the row has one). -1 ends the
+     table. the state numbers themselves are only needed to work these
+     out */
+  int start;
+  int pass_row[nrows];
+  int fail_row[nrows];
+
+  constexpr table_t(Rows... r)
+    : rows(r...), state{r.current_state...}, pass{r.state_pass...},
+      fail{r.state_fail...}, type{r.type...}, start(-1), pass_row{},
+      fail_row{}
+  {
+    start = find_row(0, -1);
+    for(std::size_t i = 0; i < nrows; i++) {
+      pass_row[i] = find_row(pass[i], -1);
+      fail_row[i] = find_row((fail[i] >= 0) ? fail[i] : state[i], (int)i);
+    }
+  }
+
+  /* the first row of state after row after, or -1 */
+  constexpr int find_row(int s, int after) const
+  {
+    if(s < 0) {
+      return -1;
+    }
+    for(std::size_t i = after + 1; i < nrows; i++) {
+      if(state[i] == s) {
+	return (int)i;
+      }
+    }
+    return -1;
+  }
+
+  /* state 0 has a row to start with */
+  constexpr bool has_start() const
+  {
+    return start >= 0;
+  }
+
+  /* every pass and fail state is either negative, which ends the
+     table, or a state some row leaves from */
+  constexpr bool no_dangling_states() const
+  {
+    for(std::size_t i = 0; i < nrows; i++) {
+      if((state[i] < 0) ||
+	 ((pass[i] >= 0) && (find_row(pass[i], -1) < 0)) ||
+	 ((fail[i] >= 0) && (find_row(fail[i], -1) < 0))) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  /* every row can be got to from state 0 */
+  constexpr bool all_reachable() const
+  {
+    bool reached[nrows] = {};
+    bool changed = true;
+
+    for(std::size_t i = 0; i < nrows; i++) {
+      reached[i] = (state[i] == 0);
+    }
+    while(changed) {
+      changed = false;
+      for(std::size_t i = 0; i < nrows; i++) {
+	if(!reached[i]) {
+	  continue;
+	}
+	for(std::size_t j = 0; j < nrows; j++) {
+	  if(!reached[j] &&
+	     ((state[j] == pass[i]) || (state[j] == fail[i]))) {
+	    reached[j] = true;
+	    changed = true;
+	  }
+	}
+      }
+    }
+
+    for(std::size_t i = 0; i < nrows; i++) {
+      if(!reached[i]) {
+	return false;
+      }
+    }
+    return true;
+  }
+
+  /* some row moves to an ACCEPT state - otherwise the table can never
+     accept anything */
+  constexpr bool can_accept() const
+  {
+    for(std::size_t i = 0; i < nrows; i++) {
+      if(type[i] == ACCEPT) {
+	return true;
+      }
+    }
+    return false;
+  }
+
+  /* the tables nested in this one by value are valid too */
+  constexpr bool subs_valid() const
+  {
+    return subs_valid(std::index_sequence_for<Rows...>());
+  }
+
+  /* everything above */
+  constexpr bool valid() const
+  {
+    return (nrows > 0) && has_start() && no_dangling_states() &&
+      all_reachable() && can_accept() && subs_valid();
+  }
+
+private:
+  template <class M>
+  static constexpr bool match_valid(const M &)
+  {
+    return true;
+  }
+
+  template <class T>
+  static constexpr bool match_valid(const sub_t<T> &s)
+  {
+    return s.table.valid();
+  }
+
+  template <std::size_t... I>
+  constexpr bool subs_valid(std::index_sequence<I...>) const
+  {
+    return (match_valid(std::get<I>(rows).match) && ...);
+  }
+};
+
+/**
+ * Make a table out of rows. The table is meant to be constexpr, and
+ * checked with static_assert(t.valid(), ...) - or any of the checks
+ * valid() is made of, on their own.
+ *
+ * @param rows the rows of the table, as made by row()
+ *
+ * @return the table
+ */
+template <class... Rows>
+constexpr table_t<Rows...> table(Rows... rows)
+{
+  static_assert(sizeof...(Rows) > 0, "a table needs at least one row");
+  return table_t<Rows...>(rows...);
+}
+
+
+/* The executor */
+
+namespace detail {
+
+/* no context at all */
+struct no_context {
+};
+
+template <class Table, class Ctx>
+int run_table(const Table &t, const char *&data, const char *end, Ctx &ctx, int depth);
+
+inline int match(const exact_t &m, const char *data, const char *end)
+{
+  if(end != nullptr) {
+    if((std::size_t)(end - data) < m.length) {
+      return -1;
+    }
+    return (std::memcmp(data, m.str, m.length) == 0) ? (int)m.length : -1;
+  }
+
+  /* NUL terminated data - a mismatch is found at the NUL at the
+     latest, so nothing past it is read */
+  for(std::size_t i = 0; i < m.length; i++) {
+    if(data[i] != m.str[i]) {
+      return -1;
+    }
+  }
+  return (int)m.length;
+}
+
+inline int match(const one_of_t &m, const char *data, const char *end)
+{
+  if((end != nullptr) ? (data >= end) : (*data == '\0')) {
+    return -1;
+  }
+  return m.has((unsigned char)*data) ? 1 : -1;
+}
+
+template <class Ctx, class M>
+inline int match(const M &m, const char *data, const char *end, Ctx &, int)
+{
+  return match(m, data, end);
+}
+
+template <class Ctx, class F>
+inline int match(const func_t<F> &m, const char *data, const char *end, Ctx &ctx, int)
+{
+  Ctx copy = ctx;
+  int ret = m.f(data, end, copy);
+
+  if((ret >= 0) &&
+     (end != nullptr) &&
+     (ret > end - data)) {
+    /* the function claims more data than there is */
+    ret = -1;
+  }
+  if(ret < 0) {
+    return -1;
+  }
+  ctx = std::move(copy);
+  return ret;
+}
+
+template <class Ctx, class T>
+inline int match(const sub_t<T> &m, const char *data, const char *end, Ctx &ctx, int depth)
+{
+  Ctx copy = ctx;
+  int ret;
+
+  if(depth >= FSM_CXX_MAX_DEPTH) {
+    return -1;
+  }
+  ret = run_table(m.table, data, end, copy, depth + 1);
+  if(ret >= 0) {
+    ctx = std::move(copy);
+  }
+  return ret;
+}
+
+template <class Ctx, class G>
+inline int match(const rule_t<G> &, const char *data, const char *end, Ctx &ctx, int depth)
+{
+  Ctx copy = ctx;
+  int ret;
+
+  if(depth >= FSM_CXX_MAX_DEPTH) {
+    return -1;
+  }
+  ret = run_table(G::table, data, end, copy, depth + 1);
+  if(ret >= 0) {
+    ctx = std::move(copy);
+  }
+  return ret;
+}
+
+template <class Row, class Ctx>
+inline int step(const Row &r, const char *data, const char *end, Ctx &ctx, int depth)
+{
+  /* try one row, calling its transfn if it matches */
+  int ret = match<Ctx>(r.match, data, end, ctx, depth);
+
+  if constexpr (!std::is_same<decltype(r.action), nothing_to_do>::value) {
+    if(ret >= 0) {
+      r.action(data, ret, ctx);
+    }
+  }
+  return ret;
+}
+
+template <class Table, class Ctx, std::size_t... I>
+inline int step_row(const Table &t, int row, const char *data, const char *end, Ctx &ctx, int depth, std::index_sequence<I...>)
+{
+  /* try row number row - every row is a different type, so this picks
+     it out of the tuple with a test per row, which the compiler turns
+     into a jump */
+  int ret = -1;
+
+  (void)(((row == (int)I) &&
+	  ((ret = step(std::get<I>(t.rows), data, end, ctx, depth)), true)) || ...);
+  return ret;
+}
+
+template <class Table, class Ctx>
+int run_table(const Table &t, const char *&data, const char *end, Ctx &ctx, int depth)
+{
+  int row = t.start;
+  int nbytes_processed = 0;
+  bool in_accept = false;
+
+  while(row >= 0) {
+    int used = step_row(t, row, data, end, ctx, depth, std::make_index_sequence<Table::nrows>());
+
+    if(used < 0) {
+      row = t.fail_row[row];
+      continue;
+    }
+
+    data += used;
+    nbytes_processed += used;
+    in_accept = (t.type[row] == ACCEPT);
+    if(t.type[row] == REJECT) {
+      return -1;
+    }
+    row = t.pass_row[row];
+  }
+
+  return in_accept ? nbytes_processed : -1;
+}
+
+} /* namespace detail */
+
+/**
+ * Run a table on some data, as run_fsm_n does (or run_fsm, if end is
+ * NULL and the data is NUL terminated). Transfns are called as their
+ * transitions are made. Functions and sub-tables work on a copy of
+ * the context, which is kept only if they succeed - so a context that
+ * is a pointer is shared by all of them, as a C context with no
+ * dup_context is.
+ *
+ * @param t the table
+ * @param data the data, which is left where the table got up to
+ * @param end where the data ends, or NULL
+ * @param ctx the context
+ *
+ * @return the number of bytes processed, or -1 if the table did not
+ *         accept the data
+ */
+template <class Table, class Ctx>
+int run(const Table &t, const char *&data, const char *end, Ctx &ctx)
+{
+  if(data == nullptr) {
+    return -1;
+  }
+  return detail::run_table(t, data, end, ctx, 0);
+}
+
+/**
+ * Run a table with no context.
+ *
+ * @param t the table
+ * @param data the data, which is left where the table got up to
+ * @param end where the data ends, or NULL
+ *
+ * @return the number of bytes processed, or -1 if the table did not
+ *         accept the data
+ */
+template <class Table>
+int run(const Table &t, const char *&data, const char *end = nullptr)
+{
+  detail::no_context ctx;
+  return run(t, data, end, ctx);
+}
+
+} /* namespace fsm_cxx */
+
+#endif /* FSM_HPP */
@@ -0,0 +1,721 @@
+/**
+ * @file   fsm2c.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the source code for fsm2c, which writes a finite
+ * state machine out as C source code.
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fsm2c.h"
+
+/* the machine being written out */
+typedef struct fsm2c_gen_s fsm2c_gen;
+struct fsm2c_gen_s {
+  FILE *out;
+  char *name;
+  fsm2c_symbol *symbols;
+
+  /* every table reachable from the root, the root first */
+  transition **tables;
+  int ntables;
+
+  /* which tables record spans, themselves or through their sub-FSMs,
+     and one more than the largest capture slot of any of them */
+  char *captures;
+  int nslots;
+};
+
+
+/* Private Functions */
+static int add_table(fsm2c_gen *g, transition *table);
+static int table_index(fsm2c_gen *g, transition *table);
+static char *symbol_name(fsm2c_gen *g, void *address);
+static int is_identifier(char *name);
+static int check_table(fsm2c_gen *g, int k);
+static int find_captures(fsm2c_gen *g);
+static int target_row(transition *table, int state, int after);
+static void write_table_name(fsm2c_gen *g, int k);
+static void write_entry(fsm2c_gen *g, int captures);
+static void write_helpers(fsm2c_gen *g);
+static void write_table(fsm2c_gen *g, int k);
+static void write_row(fsm2c_gen *g, int k, int row);
+static void write_call(fsm2c_gen *g, int k, int row, char *field, void *function, char *args);
+static void write_local(fsm2c_gen *g, int k, int row);
+static void write_goto(fsm2c_gen *g, int row);
+static void write_string(FILE *out, char *str);
+static void write_char(FILE *out, unsigned char c);
+
+int fsm2c(FILE *out, transition action_table[], char *name, fsm2c_symbol symbols[])
+{
+  fsm2c_gen g;
+  int k, ret = 0;
+
+  if((out == NULL) ||
+     (action_table == NULL) ||
+     (name == NULL) ||
+     !is_identifier(name)) {
+    return -1;
+  }
+
+  g.out = out;
+  g.name = name;
+  g.symbols = symbols;
+  g.tables = NULL;
+  g.ntables = 0;
+  g.captures = NULL;
+  g.nslots = 0;
+
+  /* find every table, and make sure everything the code has to
+     refer to has a name, before writing anything */
+  if(add_table(&g, action_table) < 0) {
+    free(g.tables);
+    return -1;
+  }
+  for(k = 0; k < g.ntables; k++) {
+    if(check_table(&g, k) < 0) {
+      free(g.tables);
+      return -1;
+    }
+  }
+  if(find_captures(&g) < 0) {
+    free(g.tables);
+    return -1;
+  }
+
+  fprintf(out, "/* %s - written by fsm2c from the transition tables, which are the\n"
+	  "   reference. change those, and write this again, rather than\n"
+	  "   changing this */\n\n", name);
+  fprintf(out, "#include <string.h>\n#include <fsm.h>\n\n");
+  fprintf(out, "#ifndef FSM2C_TOO_DEEP\n"
+	  "/* what a table returns when the data is nested more than FSM_MAX_DEPTH\n"
+	  "   tables deep - which stops the whole machine, as it stops a run */\n"
+	  "#define FSM2C_TOO_DEEP -4\n"
+	  "#endif\n\n");
+  fprintf(out, "/* where a run records its spans - NULL when it does not */\n");
+  fprintf(out, "typedef struct %s_spans_s %s_spans;\n", name, name);
+  fprintf(out, "struct %s_spans_s {\n  fsm_span *spans;\n  int nspans;\n  char *origin;\n};\n\n", name);
+
+  for(k = 0; k < g.ntables; k++) {
+    fprintf(out, "static int ");
+    write_table_name(&g, k);
+    fprintf(out, "(char **data, char *end, void **context, dup_fn dup_context, free_fn free_context, fsm_journal *journal, %s_spans *spans, int depth);\n", name);
+  }
+  fprintf(out, "\n");
+
+  write_helpers(&g);
+
+  for(k = 0; k < g.ntables; k++) {
+    write_table(&g, k);
+  }
+
+  write_entry(&g, 0);
+  fprintf(out, "\n");
+  write_entry(&g, 1);
+
+  if(ferror(out)) {
+    ret = -1;
+  }
+
+  free(g.tables);
+  free(g.captures);
+  return ret;
+}
+
+static int add_table(fsm2c_gen *g, transition *table)
+{
+  /* add table, and every table it can transition into, to the list
+     of tables to write */
+  transition **tables;
+  int i;
+
+  if(table_index(g, table) >= 0) {
+    return 0;
+  }
+
+  tables = realloc(g->tables, (g->ntables + 1) * sizeof(transition*));
+  if(tables == NULL) {
+    return -1;
+  }
+  g->tables = tables;
+  g->tables[g->ntables++] = table;
+
+  for(i = 0; table[i].current_state != -1; i++) {
+    if((table[i].match_type == SUBFSM) &&
+       (table[i].transition_table != NULL)) {
+      if(add_table(g, table[i].transition_table) < 0) {
+	return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static int table_index(fsm2c_gen *g, transition *table)
+{
+  int k;
+
+  for(k = 0; k < g->ntables; k++) {
+    if(g->tables[k] == table) {
+      return k;
+    }
+  }
+
+  return -1;
+}
+
+static char *symbol_name(fsm2c_gen *g, void *address)
+{
+  int i;
+
+  if(g->symbols == NULL) {
+    return NULL;
+  }
+
+  for(i = 0; g->symbols[i].address != NULL; i++) {
+    if(g->symbols[i].address == address) {
+      return g->symbols[i].name;
+    }
+  }
+
+  return NULL;
+}
+
+static int is_identifier(char *name)
+{
+  if((name == NULL) ||
+     !(isalpha((unsigned char)*name) || (*name == '_'))) {
+    return 0;
+  }
+
+  for(name++; *name != '\0'; name++) {
+    if(!(isalnum((unsigned char)*name) || (*name == '_'))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static int check_table(fsm2c_gen *g, int k)
+{
+  /* a function with no name of its own is called through the table,
+     and local contexts are always found through the table, so either
+     needs the table to have a name */
+  transition *table = g->tables[k];
+  int named = (symbol_name(g, table) != NULL);
+  int i;
+
+  for(i = 0; table[i].current_state != -1; i++) {
+    if(named) {
+      continue;
+    }
+    if((table[i].local_context != NULL) ||
+       ((table[i].transfn != NULL) && (symbol_name(g, (void*)table[i].transfn) == NULL))) {
+      return -1;
+    }
+    if((table[i].match_type == FUNC) &&
+       (((table[i].action_n != NULL) && (symbol_name(g, (void*)table[i].action_n) == NULL)) ||
+	((table[i].action_n == NULL) && (table[i].action != NULL) && (symbol_name(g, (void*)table[i].action) == NULL)))) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int find_captures(fsm2c_gen *g)
+{
+  /* mark the tables that record spans - those with a capture row,
+     and those that can run one as a sub-FSM - since a sub-FSM of
+     theirs that fails has its spans put back */
+  int k, i, changed;
+
+  if(g->ntables <= 0) {
+    return -1;
+  }
+  g->captures = calloc(g->ntables, 1);
+  if(g->captures == NULL) {
+    return -1;
+  }
+
+  for(k = 0; k < g->ntables; k++) {
+    for(i = 0; g->tables[k][i].current_state != -1; i++) {
+      if(g->tables[k][i].capture > 0) {
+	g->captures[k] = 1;
+	if(g->tables[k][i].capture > g->nslots) {
+	  g->nslots = g->tables[k][i].capture;
+	}
+      }
+    }
+  }
+
+  do {
+    changed = 0;
+    for(k = 0; k < g->ntables; k++) {
+      for(i = 0; !g->captures[k] && (g->tables[k][i].current_state != -1); i++) {
+	if((g->tables[k][i].match_type == SUBFSM) &&
+	   (g->tables[k][i].transition_table != NULL) &&
+	   g->captures[table_index(g, g->tables[k][i].transition_table)]) {
+	  g->captures[k] = 1;
+	  changed = 1;
+	}
+      }
+    }
+  } while(changed);
+
+  return 0;
+}
+
+static int target_row(transition *table, int state, int after)
+{
+  /* the row the engine goes to in state after row after - the first
+     row of the state after it, or -1 if there is none and the table
+     is done */
+  int i;
+
+  if(state < 0) {
+    return -1;
+  }
+
+  for(i = after + 1; table[i].current_state != -1; i++) {
+    if(table[i].current_state == state) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static void write_table_name(fsm2c_gen *g, int k)
+{
+  char *symbol = symbol_name(g, g->tables[k]);
+
+  if(is_identifier(symbol)) {
+    fprintf(g->out, "%s_%s", g->name, symbol);
+  } else {
+    fprintf(g->out, "%s_table%d", g->name, k);
+  }
+}
+
+static void write_entry(fsm2c_gen *g, int captures)
+{
+  /* the function the machine is run with - or, with captures set,
+     the one that records spans as well, as run_fsm_captures does */
+  FILE *out = g->out;
+
+  if(captures) {
+    fprintf(out, "int %s_captures(char **data, char *end, fsm_span spans[], int nspans, void **context, dup_fn dup_context, free_fn free_context, fsm_journal *journal)\n", g->name);
+  } else {
+    fprintf(out, "int %s(char **data, char *end, void **context, dup_fn dup_context, free_fn free_context, fsm_journal *journal)\n", g->name);
+  }
+  fprintf(out, "{\n");
+  fprintf(out, "  size_t base = fsm_journal_mark(journal);\n");
+  if(captures) {
+    fprintf(out, "  %s_spans s;\n", g->name);
+    fprintf(out, "  int i;\n");
+  }
+  fprintf(out, "  int ret;\n\n");
+  fprintf(out, "  if((data == NULL) ||\n     (*data == NULL)) {\n    return -1;\n  }\n\n");
+  if(captures) {
+    fprintf(out, "  s.spans = spans;\n");
+    fprintf(out, "  s.nspans = (spans == NULL) ? 0 : nspans;\n");
+    fprintf(out, "  s.origin = *data;\n");
+    fprintf(out, "  for(i = 0; i < s.nspans; i++) {\n");
+    fprintf(out, "    spans[i].offset = 0;\n");
+    fprintf(out, "    spans[i].length = -1;\n");
+    fprintf(out, "  }\n\n");
+  }
+  fprintf(out, "  ret = ");
+  write_table_name(g, 0);
+  fprintf(out, "(data, end, context, dup_context, free_context, journal, %s, 1);\n", captures ? "&s" : "NULL");
+  fprintf(out, "  fsm_journal_commit(journal, base);\n");
+  fprintf(out, "  return (ret == FSM2C_TOO_DEEP) ? -1 : ret;\n");
+  fprintf(out, "}\n");
+}
+
+static void write_helpers(fsm2c_gen *g)
+{
+  /* the context handling around FUNCTION and FSM transitions, exactly
+     as the engine does it */
+  FILE *out = g->out;
+
+  fprintf(out, "/* copy the context for a transition that may not work out */\n");
+  fprintf(out, "static int %s_copy(void **context, dup_fn dup_context, void **copy)\n", g->name);
+  fprintf(out, "{\n");
+  fprintf(out, "  if(context == NULL) {\n    *copy = NULL;\n    return 0;\n  }\n");
+  fprintf(out, "  if(dup_context == NULL) {\n    *copy = *context;\n    return 0;\n  }\n");
+  fprintf(out, "  *copy = dup_context(*context);\n");
+  fprintf(out, "  return (*copy == NULL) ? -1 : 0;\n");
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "/* keep the copy of the context if the transition worked, otherwise\n"
+	  "   throw it away and undo what was journaled */\n");
+  fprintf(out, "static int %s_settle(int n, void **context, void *copy, free_fn free_context, fsm_journal *journal, size_t savepoint)\n", g->name);
+  fprintf(out, "{\n");
+  fprintf(out, "  if(n >= 0) {\n");
+  fprintf(out, "    if(context != NULL) {\n");
+  fprintf(out, "      if(free_context != NULL) {\n\tfree_context(*context);\n      }\n");
+  fprintf(out, "      *context = copy;\n");
+  fprintf(out, "    }\n");
+  fprintf(out, "    return n;\n");
+  fprintf(out, "  }\n\n");
+  fprintf(out, "  if(free_context != NULL) {\n    free_context(copy);\n  }\n");
+  fprintf(out, "  fsm_journal_rollback(journal, savepoint);\n");
+  fprintf(out, "  return -1;\n");
+  fprintf(out, "}\n\n");
+
+  if(g->nslots == 0) {
+    return;
+  }
+
+  fprintf(out, "/* record the n bytes at p in a capture slot */\n");
+  fprintf(out, "static void %s_capture(%s_spans *spans, int slot, char *p, int n)\n", g->name, g->name);
+  fprintf(out, "{\n");
+  fprintf(out, "  if((spans != NULL) &&\n     (slot < spans->nspans)) {\n");
+  fprintf(out, "    spans->spans[slot].offset = p - spans->origin;\n");
+  fprintf(out, "    spans->spans[slot].length = n;\n");
+  fprintf(out, "  }\n");
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "/* save the spans before a sub-FSM that may record some, or put them\n"
+	  "   back after it, when it failed */\n");
+  fprintf(out, "static void %s_keep(%s_spans *spans, fsm_span *saved, int restore)\n", g->name, g->name);
+  fprintf(out, "{\n");
+  fprintf(out, "  int n = (spans->nspans < %d) ? spans->nspans : %d;\n\n", g->nslots, g->nslots);
+  fprintf(out, "  if(restore) {\n    memcpy(spans->spans, saved, n * sizeof(fsm_span));\n");
+  fprintf(out, "  } else {\n    memcpy(saved, spans->spans, n * sizeof(fsm_span));\n  }\n");
+  fprintf(out, "}\n\n");
+}
+
+static void write_table(fsm2c_gen *g, int k)
+{
+  /* a table is a function, each row a label - only the rows that can
+     be reached are written, and only the labels that are jumped to */
+  FILE *out = g->out;
+  transition *table = g->tables[k];
+  int nrows, i, start, changed;
+  char *reached, *labelled;
+  int done = 0;
+  int saves = 0;
+
+  for(nrows = 0; table[nrows].current_state != -1; nrows++);
+
+  reached = calloc(nrows + 1, 1);
+  labelled = calloc(nrows + 1, 1);
+  if((reached == NULL) ||
+     (labelled == NULL)) {
+    free(reached);
+    free(labelled);
+    return;
+  }
+
+  start = target_row(table, 0, -1);
+  if(start >= 0) {
+    reached[start] = labelled[start] = 1;
+  } else {
+    done = 1;
+  }
+
+  do {
+    changed = 0;
+    for(i = 0; i < nrows; i++) {
+      int next[2], j;
+      if(!reached[i]) {
+	continue;
+      }
+      next[0] = (table[i].type == REJECT) ? -1 : target_row(table, table[i].state_pass, -1);
+      next[1] = target_row(table, (table[i].state_fail >= 0) ? table[i].state_fail : table[i].current_state, i);
+      for(j = 0; j < 2; j++) {
+	if(next[j] < 0) {
+	  done = 1;
+	} else if(!reached[next[j]]) {
+	  reached[next[j]] = labelled[next[j]] = 1;
+	  changed = 1;
+	} else {
+	  labelled[next[j]] = 1;
+	}
+      }
+    }
+  } while(changed);
+
+  for(i = 0; i < nrows; i++) {
+    if(reached[i] &&
+       (table[i].match_type == SUBFSM) &&
+       (table[i].transition_table != NULL) &&
+       g->captures[table_index(g, table[i].transition_table)]) {
+      saves = 1;
+    }
+  }
+
+  fprintf(out, "static int ");
+  write_table_name(g, k);
+  fprintf(out, "(char **data, char *end, void **context, dup_fn dup_context, free_fn free_context, fsm_journal *journal, %s_spans *spans, int depth)\n", g->name);
+  fprintf(out, "{\n");
+  fprintf(out, "  char *p = *data;\n");
+  fprintf(out, "  int nbytes_processed = 0;\n");
+  fprintf(out, "  int in_accept = 0;\n");
+  fprintf(out, "  int n;\n");
+  fprintf(out, "  void *copy;\n");
+  fprintf(out, "  char *q;\n");
+  fprintf(out, "  size_t savepoint;\n");
+  if(saves) {
+    fprintf(out, "  fsm_span saved[%d];\n", g->nslots);
+  }
+  fprintf(out, "\n");
+  fprintf(out, "  (void)end; (void)context; (void)dup_context; (void)free_context; (void)journal; (void)spans;\n");
+  fprintf(out, "  (void)n; (void)copy; (void)q; (void)savepoint;\n\n");
+  fprintf(out, "  if(depth > FSM_MAX_DEPTH) {\n    return FSM2C_TOO_DEEP;\n  }\n\n");
+  fprintf(out, "  goto ");
+  write_goto(g, start);
+  fprintf(out, ";\n\n");
+
+  for(i = 0; i < nrows; i++) {
+    if(!reached[i]) {
+      continue;
+    }
+    if(labelled[i]) {
+      fprintf(out, " row%d:\n", i);
+    }
+    write_row(g, k, i);
+  }
+
+  if(done) {
+    fprintf(out, " done:\n");
+  }
+  fprintf(out, "  *data = p;\n");
+  fprintf(out, "  return (in_accept == 1) ? nbytes_processed : -1;\n");
+  fprintf(out, "}\n\n");
+
+  free(reached);
+  free(labelled);
+}
+
+static void write_row(fsm2c_gen *g, int k, int row)
+{
+  FILE *out = g->out;
+  transition *trans = &g->tables[k][row];
+  int fail = target_row(g->tables[k], (trans->state_fail >= 0) ? trans->state_fail : trans->current_state, row);
+  int restore = (trans->match_type == SUBFSM) &&
+    (trans->transition_table != NULL) &&
+    g->captures[table_index(g, trans->transition_table)];
+
+  fprintf(out, "  /* state %d", trans->current_state);
+  if((trans->transition_name != NULL) &&
+     (strstr(trans->transition_name, "*/") == NULL)) {
+    fprintf(out, ", %s", trans->transition_name);
+  }
+  fprintf(out, " */\n");
+
+  switch(trans->match_type) {
+  case EXACT_STR: {
+    size_t length;
+
+    if(trans->str == NULL) {
+      fprintf(out, "  n = -1;\n");
+      break;
+    }
+
+    length = strlen(trans->str);
+    if(length == 0) {
+      fprintf(out, "  n = 0;\n");
+    } else if(length == 1) {
+      fprintf(out, "  n = (((end == NULL) || (p < end)) && (*p == ");
+      write_char(out, trans->str[0]);
+      fprintf(out, ")) ? 1 : -1;\n");
+    } else {
+      fprintf(out, "  n = (((end == NULL) || (end - p >= %lu)) && (memcmp(p, ", (unsigned long)length);
+      write_string(out, trans->str);
+      fprintf(out, ", %lu) == 0)) ? %lu : -1;\n", (unsigned long)length, (unsigned long)length);
+    }
+  } break;
+
+  case SINGLE_CHR: {
+    char seen[256];
+    unsigned char *c;
+
+    fprintf(out, "  n = -1;\n");
+    if(trans->str == NULL) {
+      break;
+    }
+
+    memset(seen, 0, sizeof(seen));
+    fprintf(out, "  if((end == NULL) || (p < end)) {\n");
+    fprintf(out, "    switch((unsigned char)*p) {\n");
+    for(c = (unsigned char*)trans->str; *c != '\0'; c++) {
+      if(!seen[*c]) {
+	seen[*c] = 1;
+	if(isprint(*c) && (*c != '\'') && (*c != '\\')) {
+	  fprintf(out, "    case '%c':\n", *c);
+	} else {
+	  fprintf(out, "    case %u:\n", *c);
+	}
+      }
+    }
+    fprintf(out, "      n = 1;\n");
+    fprintf(out, "      break;\n");
+    fprintf(out, "    default:\n");
+    fprintf(out, "      break;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "  }\n");
+  } break;
+
+  case SUBFSM:
+    if(trans->transition_table == NULL) {
+      fprintf(out, "  n = -1;\n");
+      break;
+    }
+
+    fprintf(out, "  if(%s_copy(context, dup_context, &copy) < 0) {\n", g->name);
+    fprintf(out, "    n = -1;\n");
+    fprintf(out, "  } else {\n");
+    fprintf(out, "    q = p;\n");
+    fprintf(out, "    savepoint = fsm_journal_mark(journal);\n");
+    if(restore) {
+      fprintf(out, "    if(spans != NULL) {\n      %s_keep(spans, saved, 0);\n    }\n", g->name);
+    }
+    fprintf(out, "    n = ");
+    write_table_name(g, table_index(g, trans->transition_table));
+    fprintf(out, "(&q, end, &copy, dup_context, free_context, journal, spans, depth + 1);\n");
+    fprintf(out, "    if(n == FSM2C_TOO_DEEP) {\n");
+    fprintf(out, "      %s_settle(-1, context, copy, free_context, journal, savepoint);\n", g->name);
+    fprintf(out, "      *data = p;\n");
+    fprintf(out, "      return FSM2C_TOO_DEEP;\n");
+    fprintf(out, "    }\n");
+    if(restore) {
+      fprintf(out, "    if((n < 0) &&\n       (spans != NULL)) {\n      %s_keep(spans, saved, 1);\n    }\n", g->name);
+    }
+    fprintf(out, "    n = %s_settle(n, context, copy, free_context, journal, savepoint);\n", g->name);
+    fprintf(out, "  }\n");
+    break;
+
+  case FUNC:
+    if((trans->action == NULL) &&
+       (trans->action_n == NULL)) {
+      fprintf(out, "  n = -1;\n");
+      break;
+    }
+
+    fprintf(out, "  if(%s_copy(context, dup_context, &copy) < 0) {\n", g->name);
+    fprintf(out, "    n = -1;\n");
+    fprintf(out, "  } else {\n");
+    fprintf(out, "    q = p;\n");
+    fprintf(out, "    savepoint = fsm_journal_mark(journal);\n");
+    fprintf(out, "    n = ");
+    if(trans->action_n != NULL) {
+      write_call(g, k, row, "action_n", (void*)trans->action_n, "&q, end, copy");
+    } else {
+      write_call(g, k, row, "action", (void*)trans->action, "&q, copy");
+    }
+    fprintf(out, ";\n");
+    fprintf(out, "    if((n >= 0) &&\n       (end != NULL) &&\n       (n > end - p)) {\n      n = -1;\n    }\n");
+    fprintf(out, "    n = %s_settle(n, context, copy, free_context, journal, savepoint);\n", g->name);
+    fprintf(out, "  }\n");
+    break;
+
+  default:
+    fprintf(out, "  n = -1;\n");
+    break;
+  }
+
+  fprintf(out, "  if(n >= 0) {\n");
+  if(trans->transfn != NULL) {
+    fprintf(out, "    ");
+    write_call(g, k, row, "transfn", (void*)trans->transfn, "&p, n, (context == NULL) ? NULL : *context");
+    fprintf(out, ";\n");
+  }
+  if(trans->capture > 0) {
+    fprintf(out, "    %s_capture(spans, %d, p, n);\n", g->name, trans->capture - 1);
+  }
+  fprintf(out, "    nbytes_processed += n;\n");
+  fprintf(out, "    p += n;\n");
+  if(trans->type == REJECT) {
+    fprintf(out, "    in_accept = 0;\n");
+    fprintf(out, "    goto done;\n");
+  } else {
+    fprintf(out, "    in_accept = %d;\n", (trans->type == ACCEPT) ? 1 : 0);
+    fprintf(out, "    goto ");
+    write_goto(g, target_row(g->tables[k], trans->state_pass, -1));
+    fprintf(out, ";\n");
+  }
+  fprintf(out, "  }\n");
+  fprintf(out, "  goto ");
+  write_goto(g, fail);
+  fprintf(out, ";\n\n");
+}
+
+static void write_call(fsm2c_gen *g, int k, int row, char *field, void *function, char *args)
+{
+  /* call a function of the row directly by its name, or through the
+     table if it has none */
+  char *symbol = symbol_name(g, function);
+
+  if(symbol != NULL) {
+    fprintf(g->out, "%s(%s, ", symbol, args);
+  } else {
+    fprintf(g->out, "%s[%d].%s(%s, ", symbol_name(g, g->tables[k]), row, field, args);
+  }
+  write_local(g, k, row);
+  fprintf(g->out, ")");
+}
+
+static void write_local(fsm2c_gen *g, int k, int row)
+{
+  if(g->tables[k][row].local_context == NULL) {
+    fprintf(g->out, "NULL");
+  } else {
+    fprintf(g->out, "%s[%d].local_context", symbol_name(g, g->tables[k]), row);
+  }
+}
+
+static void write_goto(fsm2c_gen *g, int row)
+{
+  if(row < 0) {
+    fprintf(g->out, "done");
+  } else {
+    fprintf(g->out, "row%d", row);
+  }
+}
+
+static void write_string(FILE *out, char *str)
+{
+  /* a C string literal - anything that is not plainly printable is
+     written as an octal escape, and a ? after a ? is escaped so it
+     can not start a trigraph */
+  char *c;
+
+  fputc('"', out);
+  for(c = str; *c != '\0'; c++) {
+    unsigned char u = (unsigned char)*c;
+    if((u == '"') || (u == '\\')) {
+      fprintf(out, "\\%c", u);
+    } else if((u == '?') && (c > str) && (c[-1] == '?')) {
+      fprintf(out, "\\?");
+    } else if((u < 0x20) || (u >= 0x7f)) {
+      fprintf(out, "\\%03o", u);
+    } else {
+      fputc(u, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void write_char(FILE *out, unsigned char c)
+{
+  /* a C character constant, with the same escapes as write_string */
+  if((c == '\'') || (c == '\\')) {
+    fprintf(out, "'\\%c'", c);
+  } else if((c < 0x20) || (c >= 0x7f)) {
+    fprintf(out, "'\\%03o'", c);
+  } else {
+    fprintf(out, "'%c'", c);
+  }
+}
@@ -0,0 +1,91 @@
+/**
+ * @file   fsm2c.h
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the header file for fsm2c, which writes out a
+ * finite state machine as C source code. Every table becomes a
+ * function whose states are labels, strings are compared in place,
+ * character sets become switch statements, and transfn and FUNCTION
+ * functions are called directly by name - so the C compiler sees the
+ * whole machine, and can optimize it like any other code. The table
+ * stays the reference: the generated function makes exactly the
+ * transitions run_fsm would make on it.
+ *
+ *
+ */
+
+
+#ifndef FSM2C_H
+#define FSM2C_H
+
+#include <stdio.h>
+#include <fsm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the name of something a machine refers to - a table, or a transfn
+   or FUNCTION function - as it should be written in the generated
+   code */
+typedef struct fsm2c_symbol_s fsm2c_symbol;
+struct fsm2c_symbol_s {
+  void *address;
+  char *name;
+};
+
+/* an entry of a symbol list, naming x as it is written */
+#define FSM2C_SYMBOL(x) {(void*)(x), #x}
+
+/**
+ * Write a finite state machine out as C source code. The code
+ * defines a function called name,
+ *
+ *   int name(char **data, char *end, void **context,
+ *            dup_fn dup_context, free_fn free_context,
+ *            fsm_journal *journal);
+ *
+ * which returns what run_fsm would (with end NULL) or run_fsm_n
+ * would (with end set length bytes into the data), and uses the
+ * context the same way - or, with a journal, what run_fsm_journaled
+ * would, given a pointer to the context and NULL dup_context and
+ * free_context. It also defines
+ *
+ *   int name_captures(char **data, char *end, fsm_span spans[],
+ *                     int nspans, void **context, dup_fn dup_context,
+ *                     free_fn free_context, fsm_journal *journal);
+ *
+ * which is the same, but records the machine's capture slots in
+ * spans, as run_fsm_captures does. Transfn functions are called as
+ * the transitions are made; the memo and the deferred calls of
+ * prepared machines do not apply to generated code. Each table is a function that calls the
+ * functions of its sub-FSMs, so the generated code does use the C
+ * stack - it stops at FSM_MAX_DEPTH, the depth a run stops at, so
+ * build it with a smaller FSM_MAX_DEPTH for threads with small
+ * stacks.
+ *
+ * The generated code refers to the functions in the machine, and to
+ * the tables themselves for local contexts, by the names in symbols,
+ * so it is meant to be included in (or appended to) the source file
+ * that defines the machine. A function with no name is called
+ * through its table, which then needs a name - if neither has one,
+ * the machine can not be written out. The other functions of the
+ * generated code are static, and start with name.
+ *
+ * @param out where to write the code
+ * @param action_table the actual finite state machine main table
+ * @param name the name of the function to write
+ * @param symbols the names of the tables and functions of the
+ *                machine, ended by an entry with a NULL address
+ *
+ * @return 0 if the code was written, or -1 if the machine could not
+ *         be written out
+ */
+int fsm2c(FILE *out, transition action_table[], char *name, fsm2c_symbol symbols[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM2C_H */
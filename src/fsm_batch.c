@@ -0,0 +1,706 @@
+/**
+ * @file   fsm_batch.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the source code for running a finite state machine
+ * on a batch of records with a pool of threads, and for running one
+ * large buffer the same way.
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "fsm_batch.h"
+
+/* the state of a batch shared by all of its workers */
+typedef struct fsm_batch_s fsm_batch;
+
+/* a worker, and the records it still has to run - records next up
+   to (but not including) end. the worker takes records from the
+   front of its range, and other workers steal from the back */
+typedef struct fsm_worker_s fsm_worker;
+struct fsm_worker_s {
+  pthread_mutex_t lock;
+  int next;
+  int end;
+
+  int id;
+  int started;
+  pthread_t thread;
+  fsm_batch *batch;
+};
+
+struct fsm_batch_s {
+  fsm *f;
+  fsm_record *records;
+  int *results;
+  fsm_batch_contexts *contexts;
+
+  fsm_worker *workers;
+  int nworkers;
+};
+
+/* a buffer is only shared between threads in pieces of at least this
+   many bytes - below that, starting a thread costs more than it
+   saves */
+#ifndef FSM_MIN_SHARE
+#define FSM_MIN_SHARE (1 << 16)
+#endif
+
+/* a thread's share of the work on one buffer - a slice of the buffer
+   to split into records, or a chunk of it to run a compiled machine
+   on */
+typedef struct fsm_share_s fsm_share;
+
+/* one run of a compiled machine through a chunk, from one of the
+   states the chunk could start in. a register holds a position in
+   the data, or -1 - n while it still holds what register n held when
+   the chunk started */
+typedef struct fsm_lane_s fsm_lane;
+struct fsm_lane_s {
+  int state;
+  int nregs;
+  long long regs[FSM_DFA_MAXREGS];
+
+  /* how the run stopped (FSM_DFA_FAIL or a match) and at which byte,
+     if stopped is set */
+  int stopped;
+  int next;
+  size_t pos;
+
+  /* the run this one merged into, or -1 */
+  int merged;
+};
+
+struct fsm_share_s {
+  unsigned char *data;
+  size_t start;
+  size_t end;
+
+  /* splitting: the delimiters in the slice, the last of them (or -1),
+     and the first record that ends in the slice */
+  char delimiter;
+  int count;
+  long long last;
+  size_t record_start;
+  int first;
+  fsm_record *records;
+
+  /* running: one lane per state the chunk could start in */
+  fsm_dfa *dfa;
+  fsm_lane *lanes;
+  int nlanes;
+  int failed;
+
+  int started;
+  pthread_t thread;
+};
+
+
+/* Private Functions */
+static void *run_worker(void *arg);
+static int take_record(fsm_worker *w);
+static int steal_records(fsm_worker *w);
+static int count_threads(int threads, size_t length);
+static void run_shares(void *(*run)(void *share), fsm_share *shares, int n);
+static void *count_delimiters(void *arg);
+static void *fill_records(void *arg);
+static void *speculate(void *arg);
+static int step_lane(fsm_dfa *dfa, fsm_lane *lane, int byte, size_t pos);
+static int same_lane(fsm_lane *a, fsm_lane *b);
+
+int run_fsm_batch(transition action_table[], fsm_record records[], int n, int results[], int threads)
+{
+  fsm *f;
+  int ret;
+
+  f = fsm_prepare(action_table);
+  if(f == NULL) {
+    return -1;
+  }
+
+  ret = run_prepared_fsm_batch(f, records, n, results, threads, NULL);
+
+  fsm_free(f);
+  return ret;
+}
+
+int run_prepared_fsm_batch(fsm *f, fsm_record records[], int n, int results[], int threads, fsm_batch_contexts *contexts)
+{
+  fsm_batch batch;
+  int i;
+
+  if((f == NULL) ||
+     (records == NULL) ||
+     (results == NULL) ||
+     (n < 0)) {
+    return -1;
+  }
+
+  if(n == 0) {
+    return 0;
+  }
+
+  if(threads <= 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (online > 0) ? (int)online : 1;
+  }
+  if(threads > n) {
+    threads = n;
+  }
+
+  batch.f = f;
+  batch.records = records;
+  batch.results = results;
+  batch.contexts = contexts;
+  batch.nworkers = threads;
+  batch.workers = malloc(threads * sizeof(fsm_worker));
+  if(batch.workers == NULL) {
+    return -1;
+  }
+
+  /* every worker starts with an even share of the records */
+  for(i = 0; i < threads; i++) {
+    fsm_worker *w = &batch.workers[i];
+    pthread_mutex_init(&w->lock, NULL);
+    w->next = (int)((long long)n * i / threads);
+    w->end = (int)((long long)n * (i + 1) / threads);
+    w->id = i;
+    w->started = 0;
+    w->batch = &batch;
+  }
+
+  /* the calling thread is worker 0 - if a thread can not be started,
+     its share is stolen by the workers that did start */
+  for(i = 1; i < threads; i++) {
+    fsm_worker *w = &batch.workers[i];
+    w->started = (pthread_create(&w->thread, NULL, run_worker, w) == 0);
+  }
+  run_worker(&batch.workers[0]);
+
+  for(i = 1; i < threads; i++) {
+    fsm_worker *w = &batch.workers[i];
+    if(w->started) {
+      pthread_join(w->thread, NULL);
+    }
+  }
+
+  for(i = 0; i < threads; i++) {
+    pthread_mutex_destroy(&batch.workers[i].lock);
+  }
+  free(batch.workers);
+
+  return 0;
+}
+
+static void *run_worker(void *arg)
+{
+  fsm_worker *w = (fsm_worker*)arg;
+  fsm_batch *b = w->batch;
+  fsm_batch_contexts *contexts = b->contexts;
+  void *context = NULL;
+  int i;
+
+  if(contexts != NULL) {
+    context = (contexts->new_context == NULL) ? NULL : contexts->new_context(w->id, contexts->arg);
+  }
+
+  for(;;) {
+    i = take_record(w);
+    if(i < 0) {
+      if(steal_records(w) < 0) {
+	/* nothing left anywhere */
+	break;
+      }
+      continue;
+    }
+
+    {
+      char *data = b->records[i].data;
+
+      if(contexts == NULL) {
+	b->results[i] = run_prepared_fsm_n(b->f, &data, b->records[i].length, NULL, NULL, NULL);
+      } else {
+	b->results[i] = run_prepared_fsm_n(b->f, &data, b->records[i].length, &context, contexts->dup_context, contexts->free_context);
+	if(contexts->record_done != NULL) {
+	  contexts->record_done(context, i, b->results[i], contexts->arg);
+	}
+      }
+    }
+  }
+
+  if((contexts != NULL) &&
+     (contexts->free_context != NULL)) {
+    contexts->free_context(context);
+  }
+
+  return NULL;
+}
+
+static int take_record(fsm_worker *w)
+{
+  /* take the next record of the worker's own range, or return -1 if
+     it has none left */
+  int i = -1;
+
+  pthread_mutex_lock(&w->lock);
+  if(w->next < w->end) {
+    i = w->next++;
+  }
+  pthread_mutex_unlock(&w->lock);
+
+  return i;
+}
+
+static int steal_records(fsm_worker *w)
+{
+  /* the worker has run out - take the back half of the records some
+     other worker has left, looking at the workers after this one in
+     turn so that thieves spread out. returns -1 if every other
+     worker has run out too. a worker only ever holds one lock at a
+     time, so workers stealing from each other can not deadlock */
+  fsm_batch *b = w->batch;
+  int k;
+
+  for(k = 1; k < b->nworkers; k++) {
+    fsm_worker *victim = &b->workers[(w->id + k) % b->nworkers];
+    int next = 0, end = 0;
+
+    pthread_mutex_lock(&victim->lock);
+    if(victim->next < victim->end) {
+      int take = (victim->end - victim->next + 1) / 2;
+      end = victim->end;
+      next = end - take;
+      victim->end = next;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if(next < end) {
+      pthread_mutex_lock(&w->lock);
+      w->next = next;
+      w->end = end;
+      pthread_mutex_unlock(&w->lock);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static int count_threads(int threads, size_t length)
+{
+  /* no more threads than there are shares of the buffer worth
+     sharing out */
+  if(threads <= 0) {
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (online > 0) ? (int)online : 1;
+  }
+  if((size_t)threads > length / FSM_MIN_SHARE) {
+    threads = (int)(length / FSM_MIN_SHARE);
+  }
+
+  return (threads < 1) ? 1 : threads;
+}
+
+static void run_shares(void *(*run)(void *share), fsm_share *shares, int n)
+{
+  /* the calling thread takes the first share - a share whose thread
+     can not be started is run by the calling thread once the rest
+     are going */
+  int i;
+
+  for(i = 1; i < n; i++) {
+    shares[i].started = (pthread_create(&shares[i].thread, NULL, run, &shares[i]) == 0);
+  }
+  run(&shares[0]);
+
+  for(i = 1; i < n; i++) {
+    if(shares[i].started) {
+      pthread_join(shares[i].thread, NULL);
+    } else {
+      run(&shares[i]);
+    }
+  }
+}
+
+int run_fsm_split(transition action_table[], char *data, size_t length, char delimiter, fsm_record **records, int **results, int threads)
+{
+  fsm *f;
+  int ret;
+
+  f = fsm_prepare(action_table);
+  if(f == NULL) {
+    return -1;
+  }
+
+  ret = run_prepared_fsm_split(f, data, length, delimiter, records, results, threads, NULL);
+
+  fsm_free(f);
+  return ret;
+}
+
+int run_prepared_fsm_split(fsm *f, char *data, size_t length, char delimiter, fsm_record **records, int **results, int threads, fsm_batch_contexts *contexts)
+{
+  fsm_share *shares;
+  fsm_record *r;
+  int *res;
+  int nshares;
+  long long n = 0;
+  long long last = -1;
+  int i;
+
+  if((f == NULL) ||
+     (data == NULL) ||
+     (records == NULL) ||
+     (results == NULL)) {
+    return -1;
+  }
+
+  nshares = count_threads(threads, length);
+  shares = malloc(nshares * sizeof(fsm_share));
+  if(shares == NULL) {
+    return -1;
+  }
+
+  /* each thread counts the delimiters in its slice of the data */
+  for(i = 0; i < nshares; i++) {
+    shares[i].data = (unsigned char*)data;
+    shares[i].start = (size_t)((unsigned long long)length * i / nshares);
+    shares[i].end = (size_t)((unsigned long long)length * (i + 1) / nshares);
+    shares[i].delimiter = delimiter;
+  }
+  run_shares(count_delimiters, shares, nshares);
+
+  /* which tells each slice the number of its first record, and where
+     the record that runs into the slice started */
+  for(i = 0; i < nshares; i++) {
+    shares[i].first = (int)n;
+    shares[i].record_start = (size_t)(last + 1);
+    n += shares[i].count;
+    if(shares[i].last >= 0) {
+      last = shares[i].last;
+    }
+  }
+  if((size_t)(last + 1) < length) {
+    n++;
+  }
+
+  if(n > INT_MAX) {
+    free(shares);
+    return -1;
+  }
+
+  r = malloc((n > 0 ? n : 1) * sizeof(fsm_record));
+  res = malloc((n > 0 ? n : 1) * sizeof(int));
+  if((r == NULL) ||
+     (res == NULL)) {
+    free(r);
+    free(res);
+    free(shares);
+    return -1;
+  }
+
+  /* then each thread fills in the records that end in its slice */
+  for(i = 0; i < nshares; i++) {
+    shares[i].records = r;
+  }
+  run_shares(fill_records, shares, nshares);
+  free(shares);
+
+  if((size_t)(last + 1) < length) {
+    r[n - 1].data = data + last + 1;
+    r[n - 1].length = length - (size_t)(last + 1);
+  }
+
+  if(run_prepared_fsm_batch(f, r, (int)n, res, threads, contexts) < 0) {
+    free(r);
+    free(res);
+    return -1;
+  }
+
+  *records = r;
+  *results = res;
+  return (int)n;
+}
+
+static void *count_delimiters(void *arg)
+{
+  fsm_share *s = (fsm_share*)arg;
+  unsigned char *p = s->data + s->start;
+  unsigned char *end = s->data + s->end;
+
+  s->count = 0;
+  s->last = -1;
+  while((p < end) &&
+	((p = memchr(p, (unsigned char)s->delimiter, end - p)) != NULL)) {
+    s->count++;
+    s->last = p - s->data;
+    p++;
+  }
+
+  return NULL;
+}
+
+static void *fill_records(void *arg)
+{
+  fsm_share *s = (fsm_share*)arg;
+  unsigned char *p = s->data + s->start;
+  unsigned char *end = s->data + s->end;
+  size_t start = s->record_start;
+  int i = s->first;
+
+  while((p < end) &&
+	((p = memchr(p, (unsigned char)s->delimiter, end - p)) != NULL)) {
+    s->records[i].data = (char*)s->data + start;
+    s->records[i].length = (p - s->data) - start;
+    start = (p - s->data) + 1;
+    i++;
+    p++;
+  }
+
+  return NULL;
+}
+
+long long run_dfa_chunked(fsm_dfa *dfa, char **data, size_t length, int threads)
+{
+  fsm_share *shares;
+  fsm_lane run;
+  size_t pos;
+  long long ret = -1;
+  int nshares;
+  int i, j;
+
+  if((dfa == NULL) ||
+     (data == NULL) ||
+     (*data == NULL)) {
+    return -1;
+  }
+
+  /* with only one chunk there is nothing to guess */
+  nshares = count_threads(threads, length);
+  if((nshares == 1) &&
+     (length <= INT_MAX)) {
+    return run_dfa_n(dfa, data, length);
+  }
+
+  shares = calloc(nshares, sizeof(fsm_share));
+  if(shares == NULL) {
+    return -1;
+  }
+
+  /* the first chunk starts in the start state, and every other chunk
+     in any of the states - each gets a lane per state it could start
+     in, whose registers hold what they held at the start */
+  for(i = 0; i < nshares; i++) {
+    fsm_share *s = &shares[i];
+    s->data = (unsigned char*)*data;
+    s->start = (size_t)((unsigned long long)length * i / nshares);
+    s->end = (size_t)((unsigned long long)length * (i + 1) / nshares);
+    s->dfa = dfa;
+    s->nlanes = (i == 0) ? 1 : dfa->nstates;
+    s->lanes = malloc(s->nlanes * sizeof(fsm_lane));
+    if(s->lanes == NULL) {
+      goto done;
+    }
+    for(j = 0; j < s->nlanes; j++) {
+      fsm_lane *lane = &s->lanes[j];
+      int k;
+      lane->state = j;
+      lane->nregs = FSM_DFA_MAXREGS;
+      for(k = 0; k < FSM_DFA_MAXREGS; k++) {
+	lane->regs[k] = -1 - k;
+      }
+      lane->stopped = 0;
+      lane->merged = -1;
+    }
+  }
+
+  run_shares(speculate, shares, nshares);
+
+  /* join the chunks in order - the lane each chunk takes is the one
+     that started in the state the chunk before it ended in */
+  memset(&run, 0, sizeof(run));
+  for(i = 0; i < nshares; i++) {
+    fsm_share *s = &shares[i];
+    fsm_lane *lane;
+    long long regs[FSM_DFA_MAXREGS];
+
+    if(s->failed) {
+      goto done;
+    }
+
+    j = (i == 0) ? 0 : run.state;
+    while(s->lanes[j].merged >= 0) {
+      j = s->lanes[j].merged;
+    }
+    lane = &s->lanes[j];
+
+    for(j = 0; j < FSM_DFA_MAXREGS; j++) {
+      regs[j] = (lane->regs[j] >= 0) ? lane->regs[j] : run.regs[-1 - lane->regs[j]];
+    }
+    memcpy(run.regs, regs, sizeof(regs));
+    run.state = lane->state;
+    run.stopped = lane->stopped;
+    run.next = lane->next;
+    run.pos = lane->pos;
+
+    if(run.stopped) {
+      break;
+    }
+  }
+
+  /* past the end of the data the machine sees NULs, as it does in
+     run_dfa_n */
+  for(pos = length; !run.stopped; pos++) {
+    step_lane(dfa, &run, 0, pos);
+  }
+
+  if(run.next != FSM_DFA_FAIL) {
+    ret = (run.next == FSM_DFA_MATCH) ? (long long)run.pos : run.regs[-3 - run.next];
+    *data += ret;
+  }
+
+ done:
+  for(i = 0; i < nshares; i++) {
+    free(shares[i].lanes);
+  }
+  free(shares);
+  return ret;
+}
+
+static void *speculate(void *arg)
+{
+  fsm_share *s = (fsm_share*)arg;
+  fsm_dfa *dfa = s->dfa;
+  fsm_lane *lanes = s->lanes;
+  int *live, *owner;
+  int nlive = s->nlanes;
+  size_t pos = s->start;
+  int i;
+
+  live = malloc(s->nlanes * sizeof(int));
+  owner = malloc(dfa->nstates * sizeof(int));
+  if((live == NULL) ||
+     (owner == NULL)) {
+    free(live);
+    free(owner);
+    s->failed = 1;
+    return NULL;
+  }
+
+  for(i = 0; i < s->nlanes; i++) {
+    live[i] = i;
+  }
+  for(i = 0; i < dfa->nstates; i++) {
+    owner[i] = -1;
+  }
+
+  /* step every lane still running through each byte. two lanes in
+     the same state with the same registers do the same from then on,
+     so the later one merges into the earlier */
+  for(; (pos < s->end) && (nlive > 1); pos++) {
+    int kept = 0;
+
+    for(i = 0; i < nlive; i++) {
+      fsm_lane *lane = &lanes[live[i]];
+      int o;
+
+      if(step_lane(dfa, lane, s->data[pos], pos)) {
+	continue;
+      }
+
+      o = owner[lane->state];
+      if((o >= 0) &&
+	 same_lane(&lanes[o], lane)) {
+	lane->merged = o;
+	continue;
+      }
+      if(o < 0) {
+	owner[lane->state] = live[i];
+      }
+      live[kept++] = live[i];
+    }
+
+    for(i = 0; i < kept; i++) {
+      owner[lanes[live[i]].state] = -1;
+    }
+    nlive = kept;
+  }
+
+  /* once one lane is left, it runs as run_dfa_n would, with the
+     state kept out of the lane until a byte moves the registers or
+     stops the lane */
+  if(nlive == 1) {
+    fsm_lane *lane = &lanes[live[0]];
+    int state = lane->state;
+
+    for(; pos < s->end; pos++) {
+      int t = state * dfa->nclasses + dfa->classes[s->data[pos]];
+
+      if((dfa->op[t] == 0) &&
+	 (dfa->next[t] >= 0)) {
+	state = dfa->next[t];
+	continue;
+      }
+
+      lane->state = state;
+      if(step_lane(dfa, lane, s->data[pos], pos)) {
+	break;
+      }
+      state = lane->state;
+    }
+    if(!lane->stopped) {
+      lane->state = state;
+    }
+  }
+
+  free(live);
+  free(owner);
+  return NULL;
+}
+
+static int step_lane(fsm_dfa *dfa, fsm_lane *lane, int byte, size_t pos)
+{
+  /* read one byte, returning 1 if the lane stopped on it */
+  int t = lane->state * dfa->nclasses + dfa->classes[byte];
+  int next;
+
+  if(dfa->op[t] != 0) {
+    /* move the registers around */
+    int *op = &dfa->ops[dfa->op[t]];
+    long long moved[FSM_DFA_MAXREGS];
+    int i;
+    for(i = 0; i < op[0]; i++) {
+      moved[i] = (op[i+1] < 0) ? (long long)pos : lane->regs[op[i+1]];
+    }
+    memcpy(lane->regs, moved, op[0] * sizeof(long long));
+    lane->nregs = op[0];
+  }
+
+  next = dfa->next[t];
+  if(next < 0) {
+    lane->stopped = 1;
+    lane->next = next;
+    lane->pos = pos;
+    return 1;
+  }
+
+  lane->state = next;
+  return 0;
+}
+
+static int same_lane(fsm_lane *a, fsm_lane *b)
+{
+  /* registers past nregs are never read again, so they do not
+     count */
+  return (a->state == b->state) &&
+    (a->nregs == b->nregs) &&
+    (memcmp(a->regs, b->regs, a->nregs * sizeof(long long)) == 0);
+}
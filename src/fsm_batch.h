@@ -0,0 +1,168 @@
+/**
+ * @file   fsm_batch.h
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the header file for running a finite state machine
+ * on a batch of independent records at once, spread over a pool of
+ * threads. Each thread starts with an even share of the records, and
+ * a thread that runs out steals half of what another thread has
+ * left, so a few long records do not leave the other threads idle.
+ * One large buffer can be run in parallel too - split into records
+ * at a delimiter, or, for a compiled machine, cut into chunks at any
+ * byte, with every chunk but the first run from every state the
+ * machine could be in when it gets there.
+ *
+ *
+ */
+
+
+#ifndef FSM_BATCH_H
+#define FSM_BATCH_H
+
+#include <fsm.h>
+#include <fsm_dfa.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* one record of a batch - length bytes of data, which do not have to
+   be NUL terminated */
+typedef struct fsm_record_s fsm_record;
+struct fsm_record_s {
+  char *data;
+  size_t length;
+};
+
+/* how the workers of a batch get their contexts. every worker makes
+   one context with new_context before its first record, and runs all
+   of its records with it - after each record, record_done (if it is
+   not NULL) is given the context, so the result can be taken out of
+   it and the context made ready for the next record. when the worker
+   is finished, the context is freed with free_context */
+typedef struct fsm_batch_contexts_s fsm_batch_contexts;
+struct fsm_batch_contexts_s {
+  void *(*new_context)(int worker, void *arg);
+  void (*record_done)(void *context, int record, int result, void *arg);
+  dup_fn dup_context;
+  free_fn free_context;
+  void *arg;
+};
+
+/**
+ * Run a finite state machine on every record of a batch, using a
+ * pool of threads. results[i] is set to what run_fsm_n would return
+ * for records[i] - the number of bytes processed, or -1 if the
+ * machine did not accept the record. The machine runs with no
+ * context.
+ *
+ * @param action_table the actual finite state machine main table
+ * @param records the records to run the machine on
+ * @param n the number of records
+ * @param results where the result of each record is put
+ * @param threads the number of threads to use, or 0 for one per
+ *                online processor
+ *
+ * @return 0 if every record was run, or -1 if the batch could not be
+ *         run at all
+ */
+int run_fsm_batch(transition action_table[], fsm_record records[], int n, int results[], int threads);
+
+/**
+ * Run a prepared finite state machine on every record of a batch,
+ * using a pool of threads, as run_fsm_batch does. If contexts is not
+ * NULL, each worker runs its records with a context of its own, made
+ * and handed back as described for fsm_batch_contexts. The functions
+ * in contexts, and the machine's transfn and FUNCTION functions, are
+ * called from several threads at once.
+ *
+ * @param f the prepared machine
+ * @param records the records to run the machine on
+ * @param n the number of records
+ * @param results where the result of each record is put
+ * @param threads the number of threads to use, or 0 for one per
+ *                online processor
+ * @param contexts how the workers get their contexts, or NULL
+ *
+ * @return 0 if every record was run, or -1 if the batch could not be
+ *         run at all
+ */
+int run_prepared_fsm_batch(fsm *f, fsm_record records[], int n, int results[], int threads, fsm_batch_contexts *contexts);
+
+/**
+ * Split length bytes of data into records, and run a finite state
+ * machine on every record with a pool of threads, as run_fsm_batch
+ * does. Each record ends at a delimiter, which is not part of it, and
+ * whatever follows the last delimiter is a record too, if it is not
+ * empty. The threads split the data as well as run the records, and
+ * the records and their results come back in the order they are in
+ * the data.
+ *
+ * @param action_table the actual finite state machine main table
+ * @param data the data to split
+ * @param length the number of bytes of data
+ * @param delimiter the byte that ends each record
+ * @param records where to put the records, allocated with malloc
+ * @param results where to put the result of each record, allocated
+ *                with malloc
+ * @param threads the number of threads to use, or 0 for one per
+ *                online processor
+ *
+ * @return the number of records, or -1 if the data could not be run
+ *         at all
+ */
+int run_fsm_split(transition action_table[], char *data, size_t length, char delimiter, fsm_record **records, int **results, int threads);
+
+/**
+ * Split length bytes of data into records, and run a prepared finite
+ * state machine on every record, as run_fsm_split does, with the
+ * contexts described for run_prepared_fsm_batch. The record numbers
+ * given to record_done count from the start of the data.
+ *
+ * @param f the prepared machine
+ * @param data the data to split
+ * @param length the number of bytes of data
+ * @param delimiter the byte that ends each record
+ * @param records where to put the records, allocated with malloc
+ * @param results where to put the result of each record, allocated
+ *                with malloc
+ * @param threads the number of threads to use, or 0 for one per
+ *                online processor
+ * @param contexts how the workers get their contexts, or NULL
+ *
+ * @return the number of records, or -1 if the data could not be run
+ *         at all
+ */
+int run_prepared_fsm_split(fsm *f, char *data, size_t length, char delimiter, fsm_record **records, int **results, int threads, fsm_batch_contexts *contexts);
+
+/**
+ * Run a compiled machine on length bytes of data with a pool of
+ * threads. The data is cut into one chunk per thread, wherever the
+ * cut falls. Only the first chunk is known to start in the start
+ * state, so every other chunk is run from all of the states at once,
+ * dropping the runs that stop and merging the runs that reach the
+ * same state with the same registers - most machines are soon down
+ * to one run. The chunks are then joined in order, each taking the
+ * state the one before it ended in. The result is what run_dfa_n
+ * would return, and the data can be longer than an int can count.
+ * A machine whose runs never merge makes every chunk but the first
+ * cost as much as its states times the bytes, so it is better run
+ * with run_dfa_n.
+ *
+ * @param dfa the compiled machine
+ * @param data the data to use while running the machine
+ * @param length the number of bytes of data
+ * @param threads the number of threads to use, or 0 for one per
+ *                online processor
+ *
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         accept the data
+ */
+long long run_dfa_chunked(fsm_dfa *dfa, char **data, size_t length, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_BATCH_H */
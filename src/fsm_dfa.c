@@ -0,0 +1,1854 @@
+/**
+ * @file   fsm_dfa.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ * 
+ * @brief This is the DFA compiler, which flattens a finite state
+ * machine and all of its sub-FSMs into a single byte indexed table,
+ * and the code to run the compiled machines.
+ * 
+ * 
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fsm_dfa.h"
+
+/* limits on what the compiler will take on - a machine that needs
+   more states than MAX_STATES, or more than MAX_RUNS different runs
+   (see below) to describe them, or a run that takes more than
+   MAX_STEPS transitions without reading a byte (which is what a
+   table that loops on NOTHING does forever) is not compiled */
+#define MAX_STATES 16384
+#define MAX_RUNS   (1 << 18)
+#define MAX_STEPS  4096
+
+/* while a compiled machine is minimized, each way it can stop -
+   FSM_DFA_FAIL, FSM_DFA_MATCH and each FSM_DFA_MATCH_REG - is
+   treated as a state of its own, numbered after the machine's n
+   states, that reads every byte and goes nowhere */
+#define STOPS (2 + FSM_DFA_MAXREGS)
+#define STOP_STATE(n, next) ((n) - 1 - (next))
+
+/* the most registers the product of several machines will have -
+   machines that need more between them are run side by side */
+#define MULTI_MAXREGS 64
+
+/* the table engine tries the transitions of a state in order, and
+   takes the first that works - but whether an FSM transition (or a
+   string longer than one byte) works can depend on bytes well past
+   the one being read. the compiler gets around that by following
+   every alternative that could still be taken side by side: when an
+   FSM transition is tried, the run splits in two, one run where the
+   sub-FSM is being read, and the alternative run where it failed and
+   the rest of the state's transitions are tried instead. each byte
+   is fed to both. when the sub-FSM finishes the alternative is
+   thrown away, and if it fails, the alternative becomes the run.
+   alternatives can have alternatives of their own. a DFA state is
+   everything that is being followed at once, and because the tables
+   are not recursive there are only so many of those.
+
+   the same alternative turns up inside many others, so runs are
+   never changed once built, and each different run is only built
+   once - which also means two runs are the same if they are at the
+   same address */
+
+enum run_kind {
+  RUNNING,  /* still running */
+  ACCEPTED, /* the machine accepted */
+  FAILED    /* the machine did not accept */
+};
+
+enum frame_mode {
+  TRY,     /* try the transitions of state that come after row */
+  CALL,    /* the FSM of row is running in the frame above this one */
+  LITERAL, /* offset characters of the string of row have matched */
+  TAKE,    /* row matches the byte being read */
+  HALT,    /* no more transitions - the table is finished */
+  ABORT    /* a REJECT transition was made - the table failed */
+};
+
+/* the register of a run that finished at the byte being read */
+#define REG_NOW -1
+
+typedef struct run_s run;
+typedef struct frame_s frame;
+
+/* one table that is running, as the table engine would have it in
+   run_fsm's local variables */
+struct frame_s {
+  int table;
+  int state;
+  int accept;
+  int mode;
+  int row;
+  int offset;
+
+  /* the run to carry on with if row fails - only CALL frames and
+     frames in the middle of a string have one */
+  run *alt;
+};
+
+/* one run of the machine - a stack of running tables, the outermost
+   first */
+struct run_s {
+  enum run_kind kind;
+
+  /* where an accepted run stopped: a register, or REG_NOW */
+  int reg;
+
+  /* what the run turns into when it meets, and then reads, a byte
+     of each class - worked out the first time they are needed */
+  run **settled;
+  run **consumed;
+
+  /* the DFA state this run is, or -1 */
+  int state;
+
+  /* the run with its registers renumbered, when stamp is the
+     compiler's current stamp */
+  int stamp;
+  run *renumbered;
+
+  unsigned int hash;
+  int nframes;
+  frame frames[1];
+};
+
+/* a run being worked on */
+typedef struct work_s work;
+struct work_s {
+  frame *frames;
+  int nframes;
+  int maxframes;
+};
+
+typedef struct dfa_table_s dfa_table;
+struct dfa_table_s {
+  transition *table;
+
+  /* the table number of each SUBFSM row */
+  int *sub;
+
+  /* 0 while being checked, 1 once checked */
+  int checked;
+
+  /* the number of the first table with the same rows as this one,
+     which is used in its place */
+  int same;
+};
+
+typedef struct compiler_s compiler;
+struct compiler_s {
+  dfa_table *tables;
+  int ntables;
+
+  /* bytes that no transition tells apart behave the same in every
+     state, so each state is only worked out for one byte of each
+     class - and the compiled machine keeps the classes, so that its
+     tables have a column for each class rather than each byte */
+  int byte_class[256];
+  int class_byte[256];
+  int nclasses;
+
+  /* every run built so far */
+  run **runs;
+  int nruns;
+  int runs_size;
+
+  /* the run that is every DFA state */
+  run **states;
+  int nstates;
+
+  /* the registers of the state being built - for each, the register
+     of the previous state it comes from, or REG_NOW */
+  int regs[FSM_DFA_MAXREGS];
+  int nregs;
+  int stamp;
+
+  /* handed out when something goes wrong, so the work in progress
+     can wind down normally */
+  run *failed;
+
+  int error;
+};
+
+
+/* a pool of lists of ints, each only kept once - the lists are one
+   after the other in ints, from ints[1] on (so that 0 can mean no
+   list), and slots is a hash table of where each one starts */
+typedef struct list_slot_s list_slot;
+struct list_slot_s {
+  int at;
+  int length;
+  unsigned int hash;
+};
+
+typedef struct list_pool_s list_pool;
+struct list_pool_s {
+  int *ints;
+  int nints;
+  int max_ints;
+
+  list_slot *slots;
+  int nslots;
+  int nlists;
+};
+
+/* the machines of an fsm_multi. the compiled machines are combined
+   into one product machine, like a compiled machine except that its
+   registers are those of every machine, one after the other, and a
+   step can stop some of the machines: event[t] is 0 if it does not,
+   otherwise an index into events, where events[e] is the number of
+   machines that stop, followed by each one and how it stopped -
+   FSM_DFA_FAIL, or a match, whose register is numbered as in the
+   product. the product stops (with FSM_DFA_FAIL) once every machine
+   has */
+struct fsm_multi_s {
+  int n;
+
+  /* each machine is compiled, or runs on the table engine */
+  fsm_dfa *dfas[FSM_MULTI_MAX];
+  fsm *fsms[FSM_MULTI_MAX];
+
+  /* the compiled machines, and the first register of each in the
+     product */
+  int compiled[FSM_MULTI_MAX];
+  int first_reg[FSM_MULTI_MAX];
+  int ncompiled;
+
+  /* the product, or NULL if it was too big to build */
+  fsm_dfa *product;
+  int *event;
+  int *events;
+};
+
+
+/* Private Functions */
+static int add_table(compiler *c, transition *table);
+static int same_table(compiler *c, int a, int b);
+static void split_classes(compiler *c, char *chars, int single);
+static int next_row(transition *table, int state, int after);
+
+static run *intern(compiler *c, enum run_kind kind, int reg, frame *frames, int nframes);
+static int load(work *w, run *r);
+static frame *push_frame(work *w, int table);
+
+static void fail_row(frame *f, transition *row, int r);
+static void succeed(frame *f, transition *row);
+static run *fork_alt(compiler *c, work *w, transition *row, int r);
+static run *settle(compiler *c, run *r, int cls);
+static run *settle_run(compiler *c, run *r, int cls);
+static run *consume(compiler *c, run *r, int cls);
+static run *renumber(compiler *c, run *r);
+static int minimize(fsm_dfa *dfa);
+static int step_to(fsm_dfa *dfa, int s, int cls);
+static void find_sources(fsm_dfa *dfa, int *first, int *sources);
+
+static int intern_list(list_pool *p, int *list, int length);
+static int build_product(fsm_multi *m);
+static void run_product(fsm_multi *m, unsigned char *in, size_t length, int results[]);
+static void run_side_by_side(fsm_multi *m, unsigned char *in, size_t length, int results[]);
+static int stopped_at(int next, size_t pos, int *regs);
+
+
+static int add_table(compiler *c, transition *table)
+{
+  /* add a table to the compiler, and every table it transitions
+     into, making sure that they only use transitions the compiler
+     understands. returns the table number, or -1 */
+  int id;
+  int nrows;
+  int i;
+  dfa_table *tables;
+
+  for(id = 0; id < c->ntables; id++) {
+    if(c->tables[id].table == table) {
+      if(c->tables[id].checked == 0) {
+	/* the table can reach itself */
+	return -1;
+      }
+      return c->tables[id].same;
+    }
+  }
+
+  tables = realloc(c->tables, (c->ntables + 1) * sizeof(dfa_table));
+  if(tables == NULL) {
+    return -1;
+  }
+  c->tables = tables;
+  id = c->ntables++;
+
+  for(nrows = 0; table[nrows].current_state != -1; nrows++) {
+  }
+
+  c->tables[id].table = table;
+  c->tables[id].checked = 0;
+  c->tables[id].same = id;
+  c->tables[id].sub = calloc(nrows + 1, sizeof(int));
+  if(c->tables[id].sub == NULL) {
+    return -1;
+  }
+
+  for(i = 0; i < nrows; i++) {
+    switch(table[i].match_type) {
+    case EXACT_STR:
+    case SINGLE_CHR: {
+      char *str;
+      if(table[i].str == NULL) {
+	break;
+      }
+      if(table[i].match_type == SINGLE_CHR) {
+	split_classes(c, table[i].str, 0);
+	break;
+      }
+      for(str = table[i].str; *str != '\0'; str++) {
+	split_classes(c, str, 1);
+      }
+    } break;
+
+    case INVALID:
+      break;
+
+    case SUBFSM: {
+      int sub;
+      if(table[i].transition_table == NULL) {
+	break;
+      }
+      sub = add_table(c, table[i].transition_table);
+      if(sub < 0) {
+	return -1;
+      }
+      c->tables[id].sub[i] = sub;
+    } break;
+
+    default:
+      /* a FUNCTION can do anything with the data, so it can not be
+	 flattened */
+      return -1;
+    }
+  }
+
+  c->tables[id].checked = 1;
+
+  /* tables are often written out more than once - one with the same
+     rows as a table already added is the same machine, and giving
+     both the one number lets their runs, and so their states, be the
+     same too */
+  for(i = 0; i < id; i++) {
+    if(same_table(c, i, id)) {
+      c->tables[id].same = i;
+      break;
+    }
+  }
+
+  return c->tables[id].same;
+}
+
+static int same_table(compiler *c, int a, int b)
+{
+  /* whether tables a and b have the same rows. their sub-FSMs were
+     added first, so the same sub-FSM has the same number in both.
+     transfns, names and captures are left out, as a compiled machine
+     only recognizes */
+  transition *ta = c->tables[a].table;
+  transition *tb = c->tables[b].table;
+  int i;
+
+  if((c->tables[a].checked == 0) ||
+     (c->tables[a].same != a)) {
+    return 0;
+  }
+
+  for(i = 0; ta[i].current_state == tb[i].current_state; i++) {
+    if(ta[i].current_state == -1) {
+      return 1;
+    }
+    if((ta[i].match_type != tb[i].match_type) ||
+       (ta[i].state_pass != tb[i].state_pass) ||
+       (ta[i].state_fail != tb[i].state_fail) ||
+       (ta[i].type != tb[i].type) ||
+       (c->tables[a].sub[i] != c->tables[b].sub[i])) {
+      return 0;
+    }
+    if((ta[i].str != tb[i].str) &&
+       ((ta[i].str == NULL) ||
+	(tb[i].str == NULL) ||
+	(strcmp(ta[i].str, tb[i].str) != 0))) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+static void split_classes(compiler *c, char *chars, int single)
+{
+  /* split the byte classes so that the bytes in chars (or just its
+     first byte, if single is set) are in classes of their own */
+  int split[256 * 2];
+  int in[256];
+  int i;
+
+  memset(in, 0, sizeof(in));
+  for(; *chars != '\0'; chars++) {
+    in[(unsigned char)*chars] = 1;
+    if(single) {
+      break;
+    }
+  }
+
+  for(i = 0; i < c->nclasses * 2; i++) {
+    split[i] = -1;
+  }
+
+  c->nclasses = 0;
+  for(i = 0; i < 256; i++) {
+    int *to = &split[c->byte_class[i] * 2 + in[i]];
+    if(*to < 0) {
+      *to = c->nclasses;
+      c->class_byte[c->nclasses++] = i;
+    }
+    c->byte_class[i] = *to;
+  }
+}
+
+static int next_row(transition *table, int state, int after)
+{
+  /* the row number of the first transition leaving state that comes
+     after the row numbered after, or -1 */
+  int i;
+
+  for(i = after + 1; table[i].current_state != -1; i++) {
+    if(table[i].current_state == state) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static run *intern(compiler *c, enum run_kind kind, int reg, frame *frames, int nframes)
+{
+  /* find the run made of these parts, building it if it is new */
+  unsigned int h = 2166136261u;
+  unsigned int i;
+  int j;
+  run *r;
+
+#define HASH(x) (h = (h ^ (unsigned int)(x)) * 16777619u)
+  HASH(kind);
+  HASH(reg);
+  for(j = 0; j < nframes; j++) {
+    HASH(frames[j].table);
+    HASH(frames[j].state);
+    HASH(frames[j].accept);
+    HASH(frames[j].mode);
+    HASH(frames[j].row);
+    HASH(frames[j].offset);
+    HASH((size_t)frames[j].alt);
+    HASH((size_t)frames[j].alt >> 16 >> 16);
+  }
+#undef HASH
+
+  for(i = h & (c->runs_size - 1); c->runs[i] != NULL; i = (i + 1) & (c->runs_size - 1)) {
+    r = c->runs[i];
+    if((r->hash != h) ||
+       (r->kind != kind) ||
+       (r->reg != reg) ||
+       (r->nframes != nframes)) {
+      continue;
+    }
+    for(j = 0; j < nframes; j++) {
+      if((r->frames[j].table != frames[j].table) ||
+	 (r->frames[j].state != frames[j].state) ||
+	 (r->frames[j].accept != frames[j].accept) ||
+	 (r->frames[j].mode != frames[j].mode) ||
+	 (r->frames[j].row != frames[j].row) ||
+	 (r->frames[j].offset != frames[j].offset) ||
+	 (r->frames[j].alt != frames[j].alt)) {
+	break;
+      }
+    }
+    if(j == nframes) {
+      return r;
+    }
+  }
+
+  if(c->nruns == MAX_RUNS) {
+    c->error = 1;
+    return c->failed;
+  }
+
+  r = calloc(1, sizeof(run) + ((nframes > 0) ? nframes - 1 : 0) * sizeof(frame));
+  if(r == NULL) {
+    c->error = 1;
+    return c->failed;
+  }
+  r->kind = kind;
+  r->reg = reg;
+  r->state = -1;
+  r->hash = h;
+  r->nframes = nframes;
+  if(nframes > 0) {
+    memcpy(r->frames, frames, nframes * sizeof(frame));
+  }
+  c->runs[i] = r;
+  c->nruns++;
+
+  if(c->nruns * 2 > c->runs_size) {
+    /* keep the table at most half full */
+    run **old = c->runs;
+    int old_size = c->runs_size;
+    run **runs = calloc(old_size * 2, sizeof(run*));
+    if(runs == NULL) {
+      c->error = 1;
+      return r;
+    }
+    c->runs = runs;
+    c->runs_size = old_size * 2;
+    for(j = 0; j < old_size; j++) {
+      if(old[j] != NULL) {
+	for(i = old[j]->hash & (c->runs_size - 1); c->runs[i] != NULL; i = (i + 1) & (c->runs_size - 1)) {
+	}
+	c->runs[i] = old[j];
+      }
+    }
+    free(old);
+  }
+
+  return r;
+}
+
+static int load(work *w, run *r)
+{
+  /* start working on a copy of the frames of r */
+  w->nframes = 0;
+  w->maxframes = r->nframes + 8;
+  w->frames = malloc(w->maxframes * sizeof(frame));
+  if(w->frames == NULL) {
+    return -1;
+  }
+  memcpy(w->frames, r->frames, r->nframes * sizeof(frame));
+  w->nframes = r->nframes;
+  return 0;
+}
+
+static frame *push_frame(work *w, int table)
+{
+  frame *f;
+
+  if(w->nframes == w->maxframes) {
+    int maxframes = w->maxframes * 2;
+    frame *frames = realloc(w->frames, maxframes * sizeof(frame));
+    if(frames == NULL) {
+      return NULL;
+    }
+    w->frames = frames;
+    w->maxframes = maxframes;
+  }
+
+  f = &w->frames[w->nframes++];
+  memset(f, 0, sizeof(frame));
+  f->table = table;
+  f->mode = TRY;
+  f->row = -1;
+  return f;
+}
+
+static void fail_row(frame *f, transition *row, int r)
+{
+  /* the transition in row r failed - carry on after it, in its
+     state_fail if it has one */
+  if(row->state_fail >= 0) {
+    f->state = row->state_fail;
+  }
+  f->row = r;
+  f->mode = TRY;
+}
+
+static void succeed(frame *f, transition *row)
+{
+  /* the transition row was made */
+  f->accept = (row->type == ACCEPT);
+  f->offset = 0;
+  f->row = -1;
+  f->alt = NULL;
+
+  if(row->type == REJECT) {
+    f->mode = ABORT;
+    return;
+  }
+
+  f->state = row->state_pass;
+  f->mode = (f->state < 0) ? HALT : TRY;
+}
+
+static run *fork_alt(compiler *c, work *w, transition *row, int r)
+{
+  /* build the run where row r, about to be tried by the top frame
+     of w, fails */
+  frame *top = &w->frames[w->nframes - 1];
+  frame saved = *top;
+  run *alt;
+
+  fail_row(top, row, r);
+  alt = intern(c, RUNNING, REG_NOW, w->frames, w->nframes);
+  *top = saved;
+
+  return alt;
+}
+
+static run *settle(compiler *c, run *r, int cls)
+{
+  /* run r up to the point where it either reads a byte of class cls
+     or finishes, along with all of its alternatives. returns the run
+     to carry on with */
+  run *settled;
+
+  if(r->kind != RUNNING) {
+    return r;
+  }
+
+  if(r->settled == NULL) {
+    r->settled = calloc(c->nclasses, sizeof(run*));
+    if(r->settled == NULL) {
+      c->error = 1;
+      return c->failed;
+    }
+  }
+
+  if(r->settled[cls] == NULL) {
+    settled = settle_run(c, r, cls);
+    r->settled[cls] = settled;
+  }
+
+  return r->settled[cls];
+}
+
+static run *settle_run(compiler *c, run *r, int cls)
+{
+  int byte = c->class_byte[cls];
+  run *result = NULL;
+  int steps = 0;
+  work w;
+  int i;
+
+  if(load(&w, r) < 0) {
+    c->error = 1;
+    return c->failed;
+  }
+
+  while(result == NULL) {
+    frame *f = &w.frames[w.nframes - 1];
+    transition *table = c->tables[f->table].table;
+    transition *row = (f->row >= 0) ? &table[f->row] : NULL;
+
+    if(++steps > MAX_STEPS) {
+      c->error = 1;
+      result = c->failed;
+      break;
+    }
+
+    switch(f->mode) {
+    case TRY: {
+      int next = next_row(table, f->state, f->row);
+
+      if(next < 0) {
+	/* nothing left to try - run_fsm would leave its loop here */
+	f->mode = HALT;
+	break;
+      }
+      row = &table[next];
+
+      if(row->match_type == SINGLE_CHR) {
+	if((row->str != NULL) &&
+	   (byte != '\0') &&
+	   (strchr(row->str, byte) != NULL)) {
+	  f->mode = TAKE;
+	  f->row = next;
+	} else {
+	  fail_row(f, row, next);
+	}
+      } else if(row->match_type == EXACT_STR) {
+	if(row->str == NULL) {
+	  fail_row(f, row, next);
+	} else if(row->str[0] == '\0') {
+	  succeed(f, row);
+	} else if((unsigned char)row->str[0] != byte) {
+	  fail_row(f, row, next);
+	} else {
+	  if(row->str[1] != '\0') {
+	    /* the rest of the string might not match - keep the run
+	       where it did not around */
+	    f->alt = fork_alt(c, &w, row, next);
+	  }
+	  f->mode = TAKE;
+	  f->row = next;
+	  f->offset = 0;
+	}
+      } else if((row->match_type == SUBFSM) &&
+		(row->transition_table != NULL)) {
+	f->alt = fork_alt(c, &w, row, next);
+	f->mode = CALL;
+	f->row = next;
+	if(push_frame(&w, c->tables[f->table].sub[next]) == NULL) {
+	  c->error = 1;
+	  result = c->failed;
+	}
+      } else {
+	/* anything else never matches */
+	fail_row(f, row, next);
+      }
+    } break;
+
+    case LITERAL:
+      if((unsigned char)row->str[f->offset] == byte) {
+	f->mode = TAKE;
+      } else {
+	/* the string did not match after all */
+	result = settle(c, f->alt, cls);
+      }
+      break;
+
+    case HALT:
+    case ABORT: {
+      int accept = (f->mode == HALT) && f->accept;
+
+      w.nframes--;
+      if(w.nframes == 0) {
+	/* the outermost table is done, the machine stops here */
+	result = intern(c, accept ? ACCEPTED : FAILED, REG_NOW, NULL, 0);
+	break;
+      }
+
+      f = &w.frames[w.nframes - 1];
+      if(accept) {
+	/* the sub-FSM worked, so its alternative is not needed */
+	succeed(f, &c->tables[f->table].table[f->row]);
+      } else {
+	result = settle(c, f->alt, cls);
+      }
+    } break;
+
+    default:
+      c->error = 1;
+      result = c->failed;
+    }
+
+    if((result == NULL) &&
+       (w.frames[w.nframes - 1].mode == TAKE)) {
+      /* the run reads the byte next - settle the alternatives too */
+      for(i = 0; i < w.nframes; i++) {
+	if(w.frames[i].alt != NULL) {
+	  w.frames[i].alt = settle(c, w.frames[i].alt, cls);
+	}
+      }
+      result = intern(c, RUNNING, REG_NOW, w.frames, w.nframes);
+    }
+  }
+
+  free(w.frames);
+  return result;
+}
+
+static run *consume(compiler *c, run *r, int cls)
+{
+  /* a settled run, and all of its alternatives, read a byte of
+     class cls */
+  frame *f;
+  transition *row;
+  work w;
+  int i;
+
+  if(r->kind != RUNNING) {
+    return r;
+  }
+
+  if(r->consumed == NULL) {
+    r->consumed = calloc(c->nclasses, sizeof(run*));
+    if(r->consumed == NULL) {
+      c->error = 1;
+      return c->failed;
+    }
+  }
+  if(r->consumed[cls] != NULL) {
+    return r->consumed[cls];
+  }
+
+  if(load(&w, r) < 0) {
+    c->error = 1;
+    return c->failed;
+  }
+
+  for(i = 0; i < w.nframes; i++) {
+    if(w.frames[i].alt != NULL) {
+      w.frames[i].alt = consume(c, w.frames[i].alt, cls);
+    }
+  }
+
+  f = &w.frames[w.nframes - 1];
+  row = &c->tables[f->table].table[f->row];
+
+  if((row->match_type == EXACT_STR) &&
+     (row->str[f->offset + 1] != '\0')) {
+    f->offset++;
+    f->mode = LITERAL;
+  } else {
+    succeed(f, row);
+  }
+
+  r->consumed[cls] = intern(c, RUNNING, REG_NOW, w.frames, w.nframes);
+  free(w.frames);
+  return r->consumed[cls];
+}
+
+static run *renumber(compiler *c, run *r)
+{
+  /* number the registers of r in the order they turn up, recording
+     where each came from in c->regs - two runs that only differ in
+     how their registers are numbered are then the same state */
+  run *result = r;
+  work w;
+  int i;
+
+  if(r->stamp == c->stamp) {
+    return r->renumbered;
+  }
+
+  if(r->kind == ACCEPTED) {
+    for(i = 0; i < c->nregs; i++) {
+      if(c->regs[i] == r->reg) {
+	break;
+      }
+    }
+    if(i == c->nregs) {
+      if(c->nregs == FSM_DFA_MAXREGS) {
+	c->error = 1;
+	return c->failed;
+      }
+      c->regs[c->nregs++] = r->reg;
+    }
+    result = intern(c, ACCEPTED, i, NULL, 0);
+  } else if(r->kind == RUNNING) {
+    if(load(&w, r) < 0) {
+      c->error = 1;
+      return c->failed;
+    }
+    for(i = 0; i < w.nframes; i++) {
+      if(w.frames[i].alt != NULL) {
+	w.frames[i].alt = renumber(c, w.frames[i].alt);
+      }
+    }
+    result = intern(c, RUNNING, REG_NOW, w.frames, w.nframes);
+    free(w.frames);
+  }
+
+  r->stamp = c->stamp;
+  r->renumbered = result;
+  return result;
+}
+
+static int minimize(fsm_dfa *dfa)
+{
+  /* merge the states of a compiled machine that no data can tell
+     apart, and drop those that can never lead to a match, keeping
+     the start state as state 0 - a smaller machine keeps more of
+     itself in the cache. returns -1 if it ran out of memory */
+  int n = dfa->nstates;
+  int nc = dfa->nclasses;
+  int total = n + STOPS;
+  list_pool ops;
+  list_pool rows;
+  int *space = NULL;
+  int *first = NULL;
+  int *sources = NULL;
+  int *numbered = NULL;
+  int *next = NULL;
+  int *op = NULL;
+  int *elems, *where, *block, *start, *end, *marked;
+  int *pending, *in_pending, *splitter, *touched, *number;
+  int nblocks = 0;
+  int npending = 0;
+  int count;
+  int ret = -1;
+  int s, t, b, i, cls;
+
+  memset(&ops, 0, sizeof(list_pool));
+  memset(&rows, 0, sizeof(list_pool));
+
+  space = malloc(11 * total * sizeof(int));
+  first = malloc((nc * total + 1) * sizeof(int));
+  sources = malloc(nc * total * sizeof(int));
+  next = malloc(n * nc * sizeof(int));
+  op = malloc(n * nc * sizeof(int));
+  if((space == NULL) ||
+     (first == NULL) ||
+     (sources == NULL) ||
+     (next == NULL) ||
+     (op == NULL)) {
+    goto done;
+  }
+  elems = space;
+  where = elems + total;
+  block = where + total;
+  start = block + total;
+  end = start + total;
+  marked = end + total;
+  pending = marked + total;
+  in_pending = pending + total;
+  splitter = in_pending + total;
+  touched = splitter + total;
+  number = touched + total;
+
+  /* the compiler adds an op for every step that moves registers,
+     even when another step moves them the same way, so keep each op
+     once - and a step that fails, or matches where it is, leaves
+     registers that are never looked at again */
+  for(t = 0; t < n * nc; t++) {
+    if((dfa->next[t] == FSM_DFA_FAIL) ||
+       (dfa->next[t] == FSM_DFA_MATCH)) {
+      dfa->op[t] = 0;
+    } else if(dfa->op[t] != 0) {
+      int *o = &dfa->ops[dfa->op[t]];
+      dfa->op[t] = intern_list(&ops, o, o[0] + 1);
+      if(dfa->op[t] < 0) {
+	goto done;
+      }
+    }
+  }
+
+  /* a state that can not lead to a match is as good as a failure,
+     so find the states that can, working back from the matches */
+  find_sources(dfa, first, sources);
+  memset(marked, 0, total * sizeof(int));
+  count = 0;
+  for(s = STOP_STATE(n, FSM_DFA_MATCH); s < total; s++) {
+    marked[s] = 1;
+    elems[count++] = s;
+  }
+  for(i = 0; i < count; i++) {
+    for(cls = 0; cls < nc; cls++) {
+      int at = cls * total + elems[i];
+      int k;
+      for(k = first[at]; k < first[at + 1]; k++) {
+	if(marked[sources[k]] == 0) {
+	  marked[sources[k]] = 1;
+	  elems[count++] = sources[k];
+	}
+      }
+    }
+  }
+  for(t = 0; t < n * nc; t++) {
+    if((dfa->next[t] >= 0) &&
+       (marked[dfa->next[t]] == 0)) {
+      dfa->next[t] = FSM_DFA_FAIL;
+      dfa->op[t] = 0;
+    }
+  }
+  find_sources(dfa, first, sources);
+
+  /* to start with, states are told apart by how they move the
+     registers on each class - and each stop is on its own */
+  for(s = 0; s < n; s++) {
+    block[s] = intern_list(&rows, &dfa->op[s * nc], nc);
+    if(block[s] < 0) {
+      goto done;
+    }
+  }
+  numbered = malloc(rows.nints * sizeof(int));
+  if(numbered == NULL) {
+    goto done;
+  }
+  for(i = 0; i < rows.nints; i++) {
+    numbered[i] = -1;
+  }
+  for(s = 0; s < total; s++) {
+    if(s >= n) {
+      block[s] = nblocks++;
+    } else if(numbered[block[s]] >= 0) {
+      block[s] = numbered[block[s]];
+    } else {
+      numbered[block[s]] = nblocks;
+      block[s] = nblocks++;
+    }
+  }
+
+  /* the states of a block are elems[start[b]] up to elems[end[b]] */
+  memset(end, 0, nblocks * sizeof(int));
+  for(s = 0; s < total; s++) {
+    end[block[s]]++;
+  }
+  for(b = 0, i = 0; b < nblocks; b++) {
+    start[b] = i;
+    i += end[b];
+    end[b] = start[b];
+  }
+  for(s = 0; s < total; s++) {
+    where[s] = end[block[s]]++;
+    elems[where[s]] = s;
+  }
+  for(b = 0; b < nblocks; b++) {
+    marked[b] = 0;
+    pending[npending++] = b;
+    in_pending[b] = 1;
+  }
+
+  /* Hopcroft's algorithm: split every block whose states go, on some
+     class, both into a pending block and out of it, until no block
+     can be split - the states left sharing a block are the same */
+  while(npending > 0) {
+    int a = pending[--npending];
+    int nsplitter = end[a] - start[a];
+
+    in_pending[a] = 0;
+    memcpy(splitter, &elems[start[a]], nsplitter * sizeof(int));
+
+    for(cls = 0; cls < nc; cls++) {
+      int ntouched = 0;
+
+      /* move the states that go into a to the front of their
+	 blocks */
+      for(i = 0; i < nsplitter; i++) {
+	int at = cls * total + splitter[i];
+	int k;
+	for(k = first[at]; k < first[at + 1]; k++) {
+	  int from = sources[k];
+	  int to;
+	  int other;
+
+	  b = block[from];
+	  to = start[b] + marked[b];
+	  other = elems[to];
+	  elems[to] = from;
+	  elems[where[from]] = other;
+	  where[other] = where[from];
+	  where[from] = to;
+	  if(marked[b]++ == 0) {
+	    touched[ntouched++] = b;
+	  }
+	}
+      }
+
+      /* and split them off into blocks of their own */
+      for(i = 0; i < ntouched; i++) {
+	int z;
+
+	b = touched[i];
+	if(marked[b] == end[b] - start[b]) {
+	  marked[b] = 0;
+	  continue;
+	}
+
+	z = nblocks++;
+	start[z] = start[b];
+	end[z] = start[b] + marked[b];
+	start[b] = end[z];
+	marked[b] = 0;
+	marked[z] = 0;
+	for(t = start[z]; t < end[z]; t++) {
+	  block[elems[t]] = z;
+	}
+
+	/* if b was still to be used to split others, both halves
+	   are, otherwise splitting by the smaller one does */
+	if(in_pending[b] == 0) {
+	  b = (end[z] - start[z] <= end[b] - start[b]) ? z : b;
+	} else {
+	  b = z;
+	}
+	pending[npending++] = b;
+	in_pending[b] = 1;
+      }
+    }
+  }
+
+  /* number the blocks in the order they are reached from the start
+     state, which leaves out the ones that can not be reached */
+  for(b = 0; b < nblocks; b++) {
+    number[b] = -1;
+  }
+  count = 0;
+  number[block[0]] = count;
+  elems[count++] = 0;
+  for(i = 0; i < count; i++) {
+    for(cls = 0; cls < nc; cls++) {
+      t = elems[i] * nc + cls;
+      s = dfa->next[t];
+      if(s >= 0) {
+	if(number[block[s]] < 0) {
+	  number[block[s]] = count;
+	  elems[count++] = s;
+	}
+	s = number[block[s]];
+      }
+      next[i * nc + cls] = s;
+      op[i * nc + cls] = dfa->op[t];
+    }
+  }
+
+  free(dfa->next);
+  free(dfa->op);
+  free(dfa->ops);
+  dfa->next = next;
+  dfa->op = op;
+  dfa->ops = ops.ints;
+  dfa->nops = ops.nints;
+  dfa->nstates = count;
+  next = NULL;
+  op = NULL;
+  ops.ints = NULL;
+  ret = 0;
+
+ done:
+  free(space);
+  free(first);
+  free(sources);
+  free(numbered);
+  free(next);
+  free(op);
+  free(ops.ints);
+  free(ops.slots);
+  free(rows.ints);
+  free(rows.slots);
+  return ret;
+}
+
+static int step_to(fsm_dfa *dfa, int s, int cls)
+{
+  /* the state s goes to on reading a byte of class cls, while the
+     machine is being minimized */
+  int next;
+
+  if(s >= dfa->nstates) {
+    return s;
+  }
+  next = dfa->next[s * dfa->nclasses + cls];
+  return (next >= 0) ? next : STOP_STATE(dfa->nstates, next);
+}
+
+static void find_sources(fsm_dfa *dfa, int *first, int *sources)
+{
+  /* the states that go to state s on reading a byte of class cls
+     are sources[first[at]] up to sources[first[at + 1]], where at is
+     cls * (nstates + STOPS) + s */
+  int total = dfa->nstates + STOPS;
+  int nc = dfa->nclasses;
+  int s, cls, at;
+
+  memset(first, 0, (nc * total + 1) * sizeof(int));
+  for(s = 0; s < total; s++) {
+    for(cls = 0; cls < nc; cls++) {
+      first[cls * total + step_to(dfa, s, cls) + 1]++;
+    }
+  }
+  for(at = 0; at < nc * total; at++) {
+    first[at + 1] += first[at];
+  }
+
+  /* fill in each list from its start, which leaves first[at]
+     where the next list starts - so move them all back one */
+  for(s = 0; s < total; s++) {
+    for(cls = 0; cls < nc; cls++) {
+      at = cls * total + step_to(dfa, s, cls);
+      sources[first[at]++] = s;
+    }
+  }
+  for(at = nc * total; at > 0; at--) {
+    first[at] = first[at - 1];
+  }
+  first[0] = 0;
+}
+
+fsm_dfa *fsm_compile_dfa(transition action_table[])
+{
+  compiler c;
+  fsm_dfa *dfa = NULL;
+  int *ops = NULL;
+  int max_ops = 0;
+  int max_states = 0;
+  int state;
+  int i;
+
+  if(action_table == NULL) {
+    return NULL;
+  }
+
+  memset(&c, 0, sizeof(compiler));
+  c.nclasses = 1;
+
+  if(add_table(&c, action_table) != 0) {
+    goto done;
+  }
+
+  c.runs_size = 1024;
+  c.runs = calloc(c.runs_size, sizeof(run*));
+  c.states = calloc(MAX_STATES, sizeof(run*));
+  dfa = calloc(1, sizeof(fsm_dfa));
+  if((c.runs == NULL) ||
+     (c.states == NULL) ||
+     (dfa == NULL)) {
+    goto fail;
+  }
+  c.failed = intern(&c, FAILED, REG_NOW, NULL, 0);
+
+  /* the start state - the root table, in state 0 */
+  {
+    frame root;
+    memset(&root, 0, sizeof(frame));
+    root.mode = TRY;
+    root.row = -1;
+    c.states[0] = intern(&c, RUNNING, REG_NOW, &root, 1);
+    c.states[0]->state = 0;
+    c.nstates = 1;
+    if(c.error) {
+      goto fail;
+    }
+  }
+
+  /* work out every state reachable from the start state, a byte at a
+     time. new states are added to the end, so this stops when the
+     last state has been done */
+  for(state = 0; state < c.nstates; state++) {
+    if(state == max_states) {
+      int *next;
+      int *op;
+
+      max_states = (max_states == 0) ? 64 : max_states * 2;
+      next = realloc(dfa->next, max_states * c.nclasses * sizeof(int));
+      if(next == NULL) {
+	goto fail;
+      }
+      dfa->next = next;
+      op = realloc(dfa->op, max_states * c.nclasses * sizeof(int));
+      if(op == NULL) {
+	goto fail;
+      }
+      dfa->op = op;
+    }
+
+    for(i = 0; i < c.nclasses; i++) {
+      int reg;
+      int t = state * c.nclasses + i;
+      run *r = settle(&c, c.states[state], i);
+
+      dfa->op[t] = 0;
+      if(r->kind == FAILED) {
+	dfa->next[t] = FSM_DFA_FAIL;
+      } else if(r->kind == ACCEPTED) {
+	dfa->next[t] = (r->reg == REG_NOW) ? FSM_DFA_MATCH : FSM_DFA_MATCH_REG(r->reg);
+      } else {
+	r = consume(&c, r, i);
+	c.stamp++;
+	c.nregs = 0;
+	r = renumber(&c, r);
+	if(c.error) {
+	  goto fail;
+	}
+
+	if(r->state < 0) {
+	  if(c.nstates == MAX_STATES) {
+	    goto fail;
+	  }
+	  r->state = c.nstates;
+	  c.states[c.nstates++] = r;
+	}
+	dfa->next[t] = r->state;
+
+	/* unless the registers stay where they are, the step needs
+	   to move them */
+	for(reg = 0; reg < c.nregs; reg++) {
+	  if(c.regs[reg] != reg) {
+	    break;
+	  }
+	}
+	if(reg < c.nregs) {
+	  if(max_ops < dfa->nops + c.nregs + 2) {
+	    int *grown;
+	    max_ops = (max_ops + c.nregs + 2) * 2;
+	    grown = realloc(ops, max_ops * sizeof(int));
+	    if(grown == NULL) {
+	      goto fail;
+	    }
+	    ops = grown;
+	  }
+	  if(dfa->nops == 0) {
+	    /* op 0 means no op, so nothing lives there */
+	    ops[dfa->nops++] = 0;
+	  }
+	  dfa->op[t] = dfa->nops;
+	  ops[dfa->nops++] = c.nregs;
+	  for(reg = 0; reg < c.nregs; reg++) {
+	    ops[dfa->nops++] = c.regs[reg];
+	  }
+	}
+	if(c.nregs > dfa->nregs) {
+	  dfa->nregs = c.nregs;
+	}
+      }
+
+      if(c.error) {
+	goto fail;
+      }
+    }
+  }
+
+  /* the rest of the bytes share the columns of their classes */
+  for(i = 0; i < 256; i++) {
+    dfa->classes[i] = c.byte_class[i];
+  }
+  dfa->nclasses = c.nclasses;
+  dfa->nstates = c.nstates;
+  dfa->built_states = c.nstates;
+  dfa->ops = ops;
+  ops = NULL;
+  if(minimize(dfa) != 0) {
+    goto fail;
+  }
+  goto done;
+
+ fail:
+  fsm_dfa_free(dfa);
+  dfa = NULL;
+
+ done:
+  free(ops);
+  for(i = 0; i < c.ntables; i++) {
+    free(c.tables[i].sub);
+  }
+  free(c.tables);
+  for(i = 0; i < c.runs_size; i++) {
+    if(c.runs[i] != NULL) {
+      free(c.runs[i]->settled);
+      free(c.runs[i]->consumed);
+      free(c.runs[i]);
+    }
+  }
+  free(c.runs);
+  free(c.states);
+
+  return dfa;
+}
+
+void fsm_dfa_free(fsm_dfa *dfa)
+{
+  if(dfa == NULL) {
+    return;
+  }
+
+  free(dfa->next);
+  free(dfa->op);
+  free(dfa->ops);
+  free(dfa);
+}
+
+int run_dfa(fsm_dfa *dfa, char **data)
+{
+  if((data == NULL) ||
+     (*data == NULL)) {
+    return -1;
+  }
+
+  /* the NUL stops the machine, so the data never has to be measured */
+  return run_dfa_n(dfa, data, (size_t)-1);
+}
+
+int run_dfa_n(fsm_dfa *dfa, char **data, size_t length)
+{
+  unsigned char *in;
+  unsigned char *classes;
+  int nclasses;
+  int regs[FSM_DFA_MAXREGS];
+  int state = 0;
+  size_t pos = 0;
+  int next;
+  int ret;
+
+  if((dfa == NULL) ||
+     (data == NULL) ||
+     (*data == NULL)) {
+    return -1;
+  }
+
+  in = (unsigned char*)*data;
+  classes = dfa->classes;
+  nclasses = dfa->nclasses;
+
+  /* one lookup per byte, once its class is known - past the end of
+     the data the machine sees a NUL, and nothing ever matches that,
+     so it always stops there at the latest */
+  for(;;) {
+    int t = state * nclasses + classes[(pos < length) ? in[pos] : 0];
+
+    if(dfa->op[t] != 0) {
+      /* move the registers around */
+      int *op = &dfa->ops[dfa->op[t]];
+      int moved[FSM_DFA_MAXREGS];
+      int i;
+      for(i = 0; i < op[0]; i++) {
+	moved[i] = (op[i+1] < 0) ? (int)pos : regs[op[i+1]];
+      }
+      memcpy(regs, moved, op[0] * sizeof(int));
+    }
+
+    next = dfa->next[t];
+    if(next < 0) {
+      break;
+    }
+    state = next;
+    pos++;
+  }
+
+  if(next == FSM_DFA_FAIL) {
+    return -1;
+  }
+
+  ret = (next == FSM_DFA_MATCH) ? (int)pos : regs[-3 - next];
+  *data += ret;
+  return ret;
+}
+
+fsm_multi *fsm_multi_new(transition *tables[], int n)
+{
+  fsm_multi *m;
+  int nregs = 0;
+  int i;
+
+  if((tables == NULL) ||
+     (n <= 0) ||
+     (n > FSM_MULTI_MAX)) {
+    return NULL;
+  }
+
+  m = calloc(1, sizeof(fsm_multi));
+  if(m == NULL) {
+    return NULL;
+  }
+  m->n = n;
+
+  for(i = 0; i < n; i++) {
+    m->dfas[i] = fsm_compile_dfa(tables[i]);
+    if(m->dfas[i] != NULL) {
+      m->compiled[m->ncompiled] = i;
+      m->first_reg[m->ncompiled] = nregs;
+      m->ncompiled++;
+      nregs += m->dfas[i]->nregs;
+      continue;
+    }
+
+    m->fsms[i] = fsm_prepare(tables[i]);
+    if(m->fsms[i] == NULL) {
+      fsm_multi_free(m);
+      return NULL;
+    }
+  }
+
+  /* a single compiled machine is its own product, and a product that
+     can not be built is not needed - the machines can always be run
+     side by side */
+  if((m->ncompiled > 1) &&
+     (nregs <= MULTI_MAXREGS)) {
+    build_product(m);
+  }
+
+  return m;
+}
+
+void fsm_multi_free(fsm_multi *m)
+{
+  int i;
+
+  if(m == NULL) {
+    return;
+  }
+
+  for(i = 0; i < m->n; i++) {
+    fsm_dfa_free(m->dfas[i]);
+    fsm_free(m->fsms[i]);
+  }
+  fsm_dfa_free(m->product);
+  free(m->event);
+  free(m->events);
+  free(m);
+}
+
+int run_fsm_multi(fsm_multi *m, char *data, size_t length, int results[], void **context, dup_fn dup_context, free_fn free_context)
+{
+  int accepted = 0;
+  int i;
+
+  if((m == NULL) ||
+     (data == NULL) ||
+     (results == NULL)) {
+    return -1;
+  }
+
+  for(i = 0; i < m->n; i++) {
+    results[i] = -1;
+  }
+
+  if(m->product != NULL) {
+    run_product(m, (unsigned char*)data, length, results);
+  } else if(m->ncompiled > 0) {
+    run_side_by_side(m, (unsigned char*)data, length, results);
+  }
+
+  /* the rest can only be run one at a time */
+  for(i = 0; i < m->n; i++) {
+    if(m->fsms[i] != NULL) {
+      char *in = data;
+      results[i] = run_prepared_fsm_n(m->fsms[i], &in, length, context, dup_context, free_context);
+    }
+    if(results[i] >= 0) {
+      accepted++;
+    }
+  }
+
+  return accepted;
+}
+
+static int intern_list(list_pool *p, int *list, int length)
+{
+  /* find where list is kept in the pool, adding it if it is new.
+     returns -1 if it could not be added */
+  unsigned int h = 2166136261u;
+  unsigned int i = 0;
+  int j;
+
+  for(j = 0; j < length; j++) {
+    h = (h ^ (unsigned int)list[j]) * 16777619u;
+  }
+
+  if(p->nslots > 0) {
+    for(i = h & (p->nslots - 1); p->slots[i].at != 0; i = (i + 1) & (p->nslots - 1)) {
+      list_slot *slot = &p->slots[i];
+      if((slot->hash == h) &&
+	 (slot->length == length) &&
+	 (memcmp(&p->ints[slot->at], list, length * sizeof(int)) == 0)) {
+	return slot->at;
+      }
+    }
+  }
+
+  if(p->nlists * 2 >= p->nslots) {
+    /* keep the table at most half full */
+    int nslots = (p->nslots == 0) ? 256 : p->nslots * 2;
+    list_slot *slots = calloc(nslots, sizeof(list_slot));
+    if(slots == NULL) {
+      return -1;
+    }
+    for(j = 0; j < p->nslots; j++) {
+      if(p->slots[j].at != 0) {
+	for(i = p->slots[j].hash & (nslots - 1); slots[i].at != 0; i = (i + 1) & (nslots - 1)) {
+	}
+	slots[i] = p->slots[j];
+      }
+    }
+    free(p->slots);
+    p->slots = slots;
+    p->nslots = nslots;
+    for(i = h & (p->nslots - 1); p->slots[i].at != 0; i = (i + 1) & (p->nslots - 1)) {
+    }
+  }
+
+  if(p->max_ints < p->nints + length + 1) {
+    int max_ints = (p->max_ints + length + 1) * 2;
+    int *ints = realloc(p->ints, max_ints * sizeof(int));
+    if(ints == NULL) {
+      return -1;
+    }
+    p->ints = ints;
+    p->max_ints = max_ints;
+  }
+  if(p->nints == 0) {
+    /* 0 means no list, so nothing lives there */
+    p->ints[p->nints++] = 0;
+  }
+
+  p->slots[i].at = p->nints;
+  p->slots[i].length = length;
+  p->slots[i].hash = h;
+  memcpy(&p->ints[p->nints], list, length * sizeof(int));
+  p->nints += length;
+  p->nlists++;
+
+  return p->slots[i].at;
+}
+
+static int build_product(fsm_multi *m)
+{
+  /* work out every state of the product reachable from the start
+     state, where every machine is in its own start state, as
+     fsm_compile_dfa does. returns -1 (and leaves m->product NULL) if
+     the product is too big, or memory runs out */
+  list_pool states, ops, events;
+  fsm_dfa *product;
+  int *event = NULL;
+  int k = m->ncompiled;
+  int nregs = 0;
+  int max_states = 0;
+  int nstates = 1;
+  int tuple[FSM_MULTI_MAX];
+  int op[MULTI_MAXREGS + 1];
+  int ev[2 * FSM_MULTI_MAX + 1];
+  int class_byte[256];
+  int state, b, i, j;
+
+  memset(&states, 0, sizeof(list_pool));
+  memset(&ops, 0, sizeof(list_pool));
+  memset(&events, 0, sizeof(list_pool));
+
+  product = calloc(1, sizeof(fsm_dfa));
+  if(product == NULL) {
+    return -1;
+  }
+
+  for(i = 0; i < k; i++) {
+    nregs += m->dfas[m->compiled[i]]->nregs;
+    tuple[i] = 0;
+  }
+
+  /* two bytes are in the same class of the product if they are in
+     the same class of every machine */
+  for(b = 0; b < 256; b++) {
+    for(j = 0; j < product->nclasses; j++) {
+      for(i = 0; i < k; i++) {
+	fsm_dfa *dfa = m->dfas[m->compiled[i]];
+	if(dfa->classes[b] != dfa->classes[class_byte[j]]) {
+	  break;
+	}
+      }
+      if(i == k) {
+	break;
+      }
+    }
+    if(j == product->nclasses) {
+      class_byte[product->nclasses++] = b;
+    }
+    product->classes[b] = j;
+  }
+
+  /* the states are kept in a pool of their own, k machines' states
+     each, so state s is at 1 + s * k */
+  if(intern_list(&states, tuple, k) < 0) {
+    goto fail;
+  }
+
+  for(state = 0; state < nstates; state++) {
+    int from[FSM_MULTI_MAX];
+
+    if(state == max_states) {
+      int *grown;
+
+      max_states = (max_states == 0) ? 64 : max_states * 2;
+      grown = realloc(product->next, max_states * product->nclasses * sizeof(int));
+      if(grown == NULL) {
+	goto fail;
+      }
+      product->next = grown;
+      grown = realloc(product->op, max_states * product->nclasses * sizeof(int));
+      if(grown == NULL) {
+	goto fail;
+      }
+      product->op = grown;
+      grown = realloc(event, max_states * product->nclasses * sizeof(int));
+      if(grown == NULL) {
+	goto fail;
+      }
+      event = grown;
+    }
+
+    memcpy(from, &states.ints[1 + state * k], k * sizeof(int));
+
+    for(b = 0; b < product->nclasses; b++) {
+      int t = state * product->nclasses + b;
+      int moved = 0;
+      int running = 0;
+
+      op[0] = nregs;
+      ev[0] = 0;
+      for(i = 0; i < k; i++) {
+	fsm_dfa *dfa = m->dfas[m->compiled[i]];
+	int first = m->first_reg[i];
+	int u = from[i] * dfa->nclasses + dfa->classes[class_byte[b]];
+	int next;
+
+	for(j = 0; j < dfa->nregs; j++) {
+	  op[1 + first + j] = first + j;
+	}
+
+	if(from[i] < 0) {
+	  /* this machine has already stopped */
+	  tuple[i] = -1;
+	  continue;
+	}
+
+	if(dfa->op[u] != 0) {
+	  int *o = &dfa->ops[dfa->op[u]];
+	  for(j = 0; j < o[0]; j++) {
+	    op[1 + first + j] = (o[j+1] < 0) ? -1 : first + o[j+1];
+	    moved |= (op[1 + first + j] != first + j);
+	  }
+	}
+
+	next = dfa->next[u];
+	if(next < 0) {
+	  ev[1 + 2 * ev[0]] = m->compiled[i];
+	  ev[2 + 2 * ev[0]] = (next <= FSM_DFA_MATCH_REG(0)) ? FSM_DFA_MATCH_REG(first - 3 - next) : next;
+	  ev[0]++;
+	  tuple[i] = -1;
+	} else {
+	  tuple[i] = next;
+	  running = 1;
+	}
+      }
+
+      product->op[t] = moved ? intern_list(&ops, op, nregs + 1) : 0;
+      event[t] = (ev[0] > 0) ? intern_list(&events, ev, 2 * ev[0] + 1) : 0;
+      if((product->op[t] < 0) ||
+	 (event[t] < 0)) {
+	goto fail;
+      }
+
+      if(!running) {
+	product->next[t] = FSM_DFA_FAIL;
+	continue;
+      }
+
+      j = intern_list(&states, tuple, k);
+      if(j < 0) {
+	goto fail;
+      }
+      product->next[t] = (j - 1) / k;
+      if(product->next[t] == nstates) {
+	if(nstates == MAX_STATES) {
+	  goto fail;
+	}
+	nstates++;
+      }
+    }
+  }
+
+  product->nstates = nstates;
+  product->ops = ops.ints;
+  product->nops = ops.nints;
+  product->nregs = nregs;
+  m->product = product;
+  m->event = event;
+  m->events = events.ints;
+  free(states.ints);
+  free(states.slots);
+  free(ops.slots);
+  free(events.slots);
+  return 0;
+
+ fail:
+  fsm_dfa_free(product);
+  free(event);
+  free(states.ints);
+  free(states.slots);
+  free(ops.ints);
+  free(ops.slots);
+  free(events.ints);
+  free(events.slots);
+  return -1;
+}
+
+static void run_product(fsm_multi *m, unsigned char *in, size_t length, int results[])
+{
+  /* one lookup per byte, as run_dfa_n does, which also says which
+     machines stopped on the byte */
+  fsm_dfa *product = m->product;
+  int regs[MULTI_MAXREGS];
+  int state = 0;
+  size_t pos = 0;
+
+  for(;; pos++) {
+    int t = state * product->nclasses + product->classes[(pos < length) ? in[pos] : 0];
+    int next;
+
+    if(product->op[t] != 0) {
+      /* move the registers around */
+      int *op = &product->ops[product->op[t]];
+      int moved[MULTI_MAXREGS];
+      int i;
+      for(i = 0; i < op[0]; i++) {
+	moved[i] = (op[i+1] < 0) ? (int)pos : regs[op[i+1]];
+      }
+      memcpy(regs, moved, op[0] * sizeof(int));
+    }
+
+    if(m->event[t] != 0) {
+      int *ev = &m->events[m->event[t]];
+      int i;
+      for(i = 0; i < ev[0]; i++) {
+	results[ev[1 + 2 * i]] = stopped_at(ev[2 + 2 * i], pos, regs);
+      }
+    }
+
+    next = product->next[t];
+    if(next < 0) {
+      break;
+    }
+    state = next;
+  }
+}
+
+static void run_side_by_side(fsm_multi *m, unsigned char *in, size_t length, int results[])
+{
+  /* every compiled machine reads each byte before the next is read */
+  int state[FSM_MULTI_MAX];
+  int regs[FSM_MULTI_MAX][FSM_DFA_MAXREGS];
+  int running = m->ncompiled;
+  size_t pos;
+  int i;
+
+  for(i = 0; i < m->ncompiled; i++) {
+    state[i] = 0;
+  }
+
+  for(pos = 0; running > 0; pos++) {
+    int byte = (pos < length) ? in[pos] : 0;
+
+    for(i = 0; i < m->ncompiled; i++) {
+      fsm_dfa *dfa = m->dfas[m->compiled[i]];
+      int t = state[i] * dfa->nclasses + dfa->classes[byte];
+      int next;
+
+      if(state[i] < 0) {
+	continue;
+      }
+
+      if(dfa->op[t] != 0) {
+	int *op = &dfa->ops[dfa->op[t]];
+	int moved[FSM_DFA_MAXREGS];
+	int j;
+	for(j = 0; j < op[0]; j++) {
+	  moved[j] = (op[j+1] < 0) ? (int)pos : regs[i][op[j+1]];
+	}
+	memcpy(regs[i], moved, op[0] * sizeof(int));
+      }
+
+      next = dfa->next[t];
+      if(next < 0) {
+	results[m->compiled[i]] = stopped_at(next, pos, regs[i]);
+	state[i] = -1;
+	running--;
+      } else {
+	state[i] = next;
+      }
+    }
+  }
+}
+
+static int stopped_at(int next, size_t pos, int *regs)
+{
+  /* what a machine that stopped with next at pos returns */
+  if(next == FSM_DFA_FAIL) {
+    return -1;
+  }
+
+  return (next == FSM_DFA_MATCH) ? (int)pos : regs[-3 - next];
+}
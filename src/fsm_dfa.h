@@ -0,0 +1,190 @@
+/**
+ * @file   fsm_dfa.h
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ * 
+ * @brief This is the header file for the flattened (DFA) form of a
+ * finite state machine. A table built only from EXACT_STRING,
+ * SINGLE_CHARACTER and (non-recursive) FSM transitions can be
+ * compiled, nested tables and all, into one machine that looks at
+ * each input byte exactly once, through a lookup of the byte's class
+ * and then of the next state.
+ * 
+ * 
+ */
+
+
+#ifndef FSM_DFA_H
+#define FSM_DFA_H
+
+#include <fsm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the most positions a compiled machine will remember at once - see
+   the comment on fsm_dfa_s */
+#define FSM_DFA_MAXREGS 16
+
+/* the special values of next[] - anything 0 or above is the next
+   state. a match ending at the current byte (which is not part of
+   it) is FSM_DFA_MATCH, a match ending at a remembered position is
+   FSM_DFA_MATCH_REG(n) */
+#define FSM_DFA_FAIL        -1
+#define FSM_DFA_MATCH       -2
+#define FSM_DFA_MATCH_REG(n) (-3 - (n))
+
+typedef struct fsm_dfa_s fsm_dfa;
+struct fsm_dfa_s {
+  /* the number of states - state 0 is the start state */
+  int nstates;
+
+  /* the number of states the machine was built with, before the
+     states that no data can tell apart were merged, and those that
+     can never lead to a match dropped */
+  int built_states;
+
+  /* bytes that no transition of the machine tells apart behave the
+     same in every state, so they share a class - classes[byte] is
+     the class of byte, and there are nclasses of them. a grammar
+     only tells a few kinds of bytes apart (letters, digits, a few
+     delimiters), so the tables below have a column for each class
+     rather than one for each of the 256 bytes */
+  unsigned char classes[256];
+  int nclasses;
+
+  /* next[state * nclasses + classes[byte]] is what happens when byte
+     is read in state: another state, a failure or a match */
+  int *next;
+
+  /* the table engine decides between alternatives in table order,
+     and an earlier alternative can need more input before it is
+     known to fail. while that input is read the machine has to
+     remember where the later alternatives would have finished, so
+     it keeps a few positions in registers. op[] is indexed like
+     next[], and is 0 if reading the byte leaves the registers
+     alone, otherwise it is an index into ops[], where ops[op] is the
+     number of registers after the step, followed by where each one
+     comes from: the number of an old register, or -1 for the
+     position of the byte being read */
+  int *op;
+  int *ops;
+  int nops;
+  int nregs;
+};
+
+/**
+ * Compile a finite state machine into a single flat DFA. The tables
+ * reachable from action_table may only use EXACT_STRING,
+ * SINGLE_CHARACTER and FSM transitions, and no table may reach
+ * itself. The compiled machine accepts exactly what run_fsm would
+ * accept on the same table, and consumes the same number of bytes,
+ * but it only recognizes - transfn functions are never called. A
+ * compiled machine is only read by run_dfa, so it can be shared
+ * between threads. Tables with the same rows are compiled as one, and
+ * the machine is minimized - built_states says how many states it
+ * had before that.
+ *
+ * @param action_table the actual finite state machine main table
+ *
+ * @return the compiled machine, or NULL if the table can not be
+ *         compiled (or is too big to compile)
+ */
+fsm_dfa *fsm_compile_dfa(transition action_table[]);
+
+/**
+ * Free a machine created by fsm_compile_dfa
+ *
+ * @param dfa the compiled machine
+ */
+void fsm_dfa_free(fsm_dfa *dfa);
+
+/**
+ * Run a compiled machine on some NUL terminated data. This returns
+ * what run_fsm would return on the table the machine was compiled
+ * from, and moves *data forward the same way when the data is
+ * accepted. Unlike run_fsm, *data is left where it was when the data
+ * is not accepted.
+ *
+ * @param dfa the compiled machine
+ * @param data the data to use while running the machine
+ *
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         accept the data
+ */
+int run_dfa(fsm_dfa *dfa, char **data);
+
+/**
+ * Run a compiled machine on length bytes of data, which do not have
+ * to be NUL terminated. This returns what run_fsm_n would return on
+ * the table the machine was compiled from.
+ *
+ * @param dfa the compiled machine
+ * @param data the data to use while running the machine
+ * @param length the number of bytes of data
+ *
+ * @return the number of bytes processed, or -1 if the machine did not
+ *         accept the data
+ */
+int run_dfa_n(fsm_dfa *dfa, char **data, size_t length);
+
+/* the most machines that can be run over the same data at once */
+#define FSM_MULTI_MAX 32
+
+/* several machines run over the same data at once - see
+   fsm_multi_new */
+typedef struct fsm_multi_s fsm_multi;
+
+/**
+ * Get several finite state machines ready to be run over the same
+ * data at once, each reporting whether it accepted the data, and how
+ * much of it. The tables that can be compiled (see fsm_compile_dfa)
+ * are combined into one product machine, whose states are a state of
+ * each of them, so that each byte is read once, through the same two
+ * lookups, however many machines are running. If the product is too
+ * big to build, the compiled machines are run side by side instead,
+ * still reading each byte once. Compiled machines only recognize,
+ * as run_dfa does. Tables that can not be compiled are run on the
+ * table engine, one after the other. The machines can then be run
+ * by several threads at once.
+ *
+ * @param tables the main tables of the machines
+ * @param n the number of machines, at most FSM_MULTI_MAX
+ *
+ * @return the machines, or NULL if they could not be made ready
+ */
+fsm_multi *fsm_multi_new(transition *tables[], int n);
+
+/**
+ * Free machines made ready by fsm_multi_new
+ *
+ * @param m the machines
+ */
+void fsm_multi_free(fsm_multi *m);
+
+/**
+ * Run several machines over length bytes of data. results[i] is set
+ * to what run_fsm_n would return for the i'th table - the number of
+ * bytes processed, or -1 if the machine did not accept the data. The
+ * machines that run on the table engine are given context, as
+ * run_fsm_n would be.
+ *
+ * @param m the machines
+ * @param data the data to use while running the machines
+ * @param length the number of bytes of data
+ * @param results where the result of each machine is put
+ * @param context a pointer to the pointer to the context, or NULL
+ * @param dup_context the function that duplicates the context
+ * @param free_context the function that frees the context
+ *
+ * @return the number of machines that accepted the data, or -1 if
+ *         they could not be run
+ */
+int run_fsm_multi(fsm_multi *m, char *data, size_t length, int results[], void **context, dup_fn dup_context, free_fn free_context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_DFA_H */
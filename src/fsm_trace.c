@@ -0,0 +1,183 @@
+/**
+ * @file   fsm_trace.c
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the source code for the trace decoder, and the
+ * profile report.
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fsm_trace.h"
+
+/* Private Functions */
+static void print_transition(FILE *out, transition *table, int row);
+static int by_attempts(const void *a, const void *b);
+static int by_failures(const void *a, const void *b);
+static int by_exclusive(const void *a, const void *b);
+
+void fsm_trace_print(FILE *out, fsm_trace_event events[], size_t n)
+{
+  size_t i;
+
+  for(i = 0; i < n; i++) {
+    fsm_trace_event *e = &events[i];
+
+    fprintf(out, "%8lu %*s", (unsigned long)e->offset, 2 * e->depth, "");
+    switch(e->kind) {
+    case FSM_TRACE_ATTEMPT:
+      fprintf(out, "trying ");
+      print_transition(out, e->table, e->row);
+      break;
+
+    case FSM_TRACE_MATCH:
+      fprintf(out, "made ");
+      print_transition(out, e->table, e->row);
+      fprintf(out, ", using %d bytes", e->nbytes);
+      break;
+
+    case FSM_TRACE_FAIL:
+      fprintf(out, "could not make ");
+      print_transition(out, e->table, e->row);
+      break;
+
+    case FSM_TRACE_ENTER:
+      fprintf(out, "starting the sub-FSM of ");
+      print_transition(out, e->table, e->row);
+      break;
+
+    case FSM_TRACE_EXIT:
+      fprintf(out, "finished the sub-FSM of ");
+      print_transition(out, e->table, e->row);
+      fprintf(out, ", which returned %d", e->nbytes);
+      break;
+
+    default:
+      fprintf(out, "unknown event %d", e->kind);
+      break;
+    }
+    fprintf(out, "\n");
+  }
+}
+
+int fsm_profile_report(FILE *out, fsm_profile *p, int top)
+{
+  fsm_profile_row *rows;
+  fsm_profile_table *tables;
+  size_t nrows, ntables, i;
+
+  if(p == NULL) {
+    return -1;
+  }
+
+  nrows = fsm_profile_rows(p, NULL, 0);
+  ntables = fsm_profile_tables(p, NULL, 0);
+  rows = malloc((nrows + 1) * sizeof(fsm_profile_row));
+  tables = malloc((ntables + 1) * sizeof(fsm_profile_table));
+  if((rows == NULL) ||
+     (tables == NULL)) {
+    free(rows);
+    free(tables);
+    return -1;
+  }
+  fsm_profile_rows(p, rows, nrows);
+  fsm_profile_tables(p, tables, ntables);
+
+  fprintf(out, "most tried transitions:\n");
+  fprintf(out, "%12s %12s %14s  %s\n", "attempts", "matches", "bytes", "transition");
+  qsort(rows, nrows, sizeof(fsm_profile_row), by_attempts);
+  for(i = 0; (i < nrows) && (i < (size_t)top); i++) {
+    fprintf(out, "%12lu %12lu %14llu  ", rows[i].attempts, rows[i].matches, rows[i].bytes);
+    print_transition(out, rows[i].table, rows[i].row);
+    fprintf(out, "\n");
+  }
+
+  fprintf(out, "\nmost wasted attempts:\n");
+  fprintf(out, "%12s %12s %14s  %s\n", "failures", "attempts", "", "transition");
+  qsort(rows, nrows, sizeof(fsm_profile_row), by_failures);
+  for(i = 0; (i < nrows) && (i < (size_t)top); i++) {
+    if(rows[i].attempts == rows[i].matches) {
+      break;
+    }
+    fprintf(out, "%12lu %12lu %14s  ", rows[i].attempts - rows[i].matches, rows[i].attempts, "");
+    print_transition(out, rows[i].table, rows[i].row);
+    fprintf(out, "\n");
+  }
+
+  fprintf(out, "\nmost expensive tables:\n");
+  fprintf(out, "%12s %12s %14s  %s\n", "runs", "exclusive", "inclusive", "table");
+  qsort(tables, ntables, sizeof(fsm_profile_table), by_exclusive);
+  for(i = 0; (i < ntables) && (i < (size_t)top); i++) {
+    fprintf(out, "%12lu %12llu %14llu  %p\n", tables[i].runs, tables[i].exclusive, tables[i].inclusive, (void*)tables[i].table);
+  }
+
+  free(rows);
+  free(tables);
+  return 0;
+}
+
+static int by_attempts(const void *a, const void *b)
+{
+  const fsm_profile_row *ra = a, *rb = b;
+
+  if(ra->attempts != rb->attempts) {
+    return (ra->attempts < rb->attempts) ? 1 : -1;
+  }
+  return (ra->matches < rb->matches) - (ra->matches > rb->matches);
+}
+
+static int by_failures(const void *a, const void *b)
+{
+  const fsm_profile_row *ra = a, *rb = b;
+  unsigned long fa = ra->attempts - ra->matches;
+  unsigned long fb = rb->attempts - rb->matches;
+
+  return (fa < fb) - (fa > fb);
+}
+
+static int by_exclusive(const void *a, const void *b)
+{
+  const fsm_profile_table *ta = a, *tb = b;
+
+  return (ta->exclusive < tb->exclusive) - (ta->exclusive > tb->exclusive);
+}
+
+static void print_transition(FILE *out, transition *table, int row)
+{
+  /* name a transition - by its name if it has one, otherwise by
+     where it is and what it matches */
+  transition *trans = &table[row];
+
+  if(trans->transition_name != NULL) {
+    fprintf(out, "%s", trans->transition_name);
+    return;
+  }
+
+  fprintf(out, "row %d of %p, state %d ", row, (void*)table, trans->current_state);
+  switch(trans->match_type) {
+  case EXACT_STR:
+    fprintf(out, "EXACT_STRING(\"%s\")", (trans->str == NULL) ? "" : trans->str);
+    break;
+
+  case SINGLE_CHR:
+    fprintf(out, "SINGLE_CHARACTER(\"%s\")", (trans->str == NULL) ? "" : trans->str);
+    break;
+
+  case SUBFSM:
+    fprintf(out, "FSM(%p)", (void*)trans->transition_table);
+    break;
+
+  case FUNC:
+    fprintf(out, "FUNCTION");
+    break;
+
+  default:
+    fprintf(out, "INVALID");
+    break;
+  }
+}
@@ -0,0 +1,59 @@
+/**
+ * @file   fsm_trace.h
+ * @author Adam Risi <ajrisi@gmail.com>
+ * @date   Fri Oct 16 09:41:17 2026
+ *
+ * @brief This is the header file for the trace decoder, which turns
+ * the binary events a traced run writes (see fsm_trace_start) into
+ * text - after the run, so that none of the formatting is done while
+ * the machine is running - and for the profile report, which does
+ * the same for the counts of a profile (see fsm_profile_start).
+ *
+ *
+ */
+
+
+#ifndef FSM_TRACE_H
+#define FSM_TRACE_H
+
+#include <stdio.h>
+#include <fsm.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Write events read from a trace out as text, one line per event,
+ * indented by how deep in sub-FSMs it happened. A transition is
+ * written as its transition_name, or if it has none, as its row and
+ * what it matches. The tables the events are about must still exist.
+ *
+ * @param out where to write the events
+ * @param events the events, as read by fsm_trace_read
+ * @param n the number of events
+ */
+void fsm_trace_print(FILE *out, fsm_trace_event events[], size_t n);
+
+/** 
+ * Write a report of a profile out as text - the top transitions
+ * that were tried the most, the top transitions that failed the
+ * most, and the top tables that spent the most cycles of their own,
+ * with their inclusive cycles alongside. Transitions are named as
+ * they are by fsm_trace_print, and the tables the profile counted
+ * must still exist.
+ * 
+ * @param out where to write the report
+ * @param p the profile
+ * @param top the most lines to write in each part of the report
+ * 
+ * @return 0 on success, -1 if there was not the memory to sort the
+ *         counts
+ */
+int fsm_profile_report(FILE *out, fsm_profile *p, int top);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FSM_TRACE_H */